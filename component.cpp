@@ -1,11 +1,26 @@
 ﻿#include <iostream>
+#include <fstream>
 #include <vector>
+#include <array>
+#include <string>
 #include <string_view>
+#include <memory>
+#include <variant>
+#include <type_traits>
+#include <utility>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 
 // tested x64, c++17
 
 using namespace std;
+using namespace std::chrono;
 
 class Graphics {};
 class World {};
@@ -13,11 +28,59 @@ class World {};
 class Player;
 
 
+// typed messages: a component subscribes to the message types it handles and
+// only gets those, the string receive goes to every component
+enum class MessageType : uint8_t {
+    Jump,
+    Land,
+    Damage,
+    Heal,
+    Stun,
+    Teleport,
+    Respawn,
+    PowerUp,
+    ChangeSkin,
+    PlaySound,
+    Count
+};
+
+const int MESSAGE_TYPE_COUNT = static_cast<int>(MessageType::Count);
+
+using MessageMask = uint32_t;
+
+constexpr MessageMask MaskOf(MessageType type)
+{
+    return MessageMask(1) << static_cast<int>(type);
+}
+
+const char* MessageName(MessageType type)
+{
+    static const char* const names[MESSAGE_TYPE_COUNT] = {
+        "jump", "land", "damage", "heal", "stun", "teleport", "respawn", "power up", "change skin", "play sound"
+    };
+
+    return names[static_cast<int>(type)];
+}
+
+struct Message
+{
+    MessageType type;
+    int value;
+};
+
+
+// the components report to the console, benchmarks switch it off
+bool componentLog = true;
+
 class Component
 {
 public:
     virtual ~Component() = default;
     virtual void receive(string_view msg) = 0;
+
+    // the typed messages this component wants
+    virtual MessageMask subscriptions() const { return 0; }
+    virtual void receive(const Message&) {}
 };
 
 
@@ -28,31 +91,53 @@ public:
     virtual void update(Player& player) = 0;
 };
 
-class DemoInputComponent : public InputComponent
+class DemoInputComponent final : public InputComponent
 {
 public:
     virtual ~DemoInputComponent() = default;
 
     virtual void receive(string_view msg) override {
-        cout << "DemoInputComponent receive: " << msg << endl;
+        if (componentLog)
+            cout << "DemoInputComponent receive: " << msg << endl;
+    }
+
+    virtual MessageMask subscriptions() const override {
+        return MaskOf(MessageType::Stun) | MaskOf(MessageType::Respawn);
+    }
+
+    virtual void receive(const Message& msg) override {
+        if (componentLog)
+            cout << "DemoInputComponent receive: " << MessageName(msg.type) << " " << msg.value << endl;
     }
 
     virtual void update(Player& player) override {
-        cout << "DemoInputComponent update" << endl;
+        if (componentLog)
+            cout << "DemoInputComponent update" << endl;
     }
 };
 
-class GameInputComponent : public InputComponent
+class GameInputComponent final : public InputComponent
 {
 public:
     virtual ~GameInputComponent() = default;
 
     virtual void receive(string_view msg) override {
-        cout << "GameInputComponent receive: " << msg << endl;
+        if (componentLog)
+            cout << "GameInputComponent receive: " << msg << endl;
+    }
+
+    virtual MessageMask subscriptions() const override {
+        return MaskOf(MessageType::Stun) | MaskOf(MessageType::Respawn);
+    }
+
+    virtual void receive(const Message& msg) override {
+        if (componentLog)
+            cout << "GameInputComponent receive: " << MessageName(msg.type) << " " << msg.value << endl;
     }
 
     virtual void update(Player& player) override {
-        cout << "GameInputComponent update" << endl;
+        if (componentLog)
+            cout << "GameInputComponent update" << endl;
     }
 };
 
@@ -64,31 +149,53 @@ public:
     virtual void update(Player& player, World& world) = 0;
 };
 
-class ZeroGPhysicsComponent : public PhysicsComponent
+class ZeroGPhysicsComponent final : public PhysicsComponent
 {
 public:
     virtual ~ZeroGPhysicsComponent() = default;
 
     virtual void receive(string_view msg) override {
-        cout << "ZeroGPhysicsComponent receive: " << msg << endl;
+        if (componentLog)
+            cout << "ZeroGPhysicsComponent receive: " << msg << endl;
+    }
+
+    virtual MessageMask subscriptions() const override {
+        return MaskOf(MessageType::Jump) | MaskOf(MessageType::Land) | MaskOf(MessageType::Teleport);
+    }
+
+    virtual void receive(const Message& msg) override {
+        if (componentLog)
+            cout << "ZeroGPhysicsComponent receive: " << MessageName(msg.type) << " " << msg.value << endl;
     }
 
     virtual void update(Player& player, World& world) override {
-        cout << "ZeroGPhysicsComponent update" << endl;
+        if (componentLog)
+            cout << "ZeroGPhysicsComponent update" << endl;
     }
 };
 
-class NormalPhysicsComponent : public PhysicsComponent
+class NormalPhysicsComponent final : public PhysicsComponent
 {
 public:
     virtual ~NormalPhysicsComponent() = default;
 
     virtual void receive(string_view msg) override {
-        cout << "NormalPhysicsComponent receive: " << msg << endl;
+        if (componentLog)
+            cout << "NormalPhysicsComponent receive: " << msg << endl;
+    }
+
+    virtual MessageMask subscriptions() const override {
+        return MaskOf(MessageType::Jump) | MaskOf(MessageType::Land) | MaskOf(MessageType::Teleport) | MaskOf(MessageType::Stun);
+    }
+
+    virtual void receive(const Message& msg) override {
+        if (componentLog)
+            cout << "NormalPhysicsComponent receive: " << MessageName(msg.type) << " " << msg.value << endl;
     }
 
     virtual void update(Player& player, World& world) override {
-        cout << "NormalPhysicsComponent update" << endl;
+        if (componentLog)
+            cout << "NormalPhysicsComponent update" << endl;
     }
 };
 
@@ -100,35 +207,69 @@ public:
     virtual void update(Player& player, Graphics& graphics) = 0;
 };
 
-class ToonGraphicsComponent : public GraphicsComponent
+class ToonGraphicsComponent final : public GraphicsComponent
 {
 public:
     virtual ~ToonGraphicsComponent() = default;
 
     virtual void receive(string_view msg) override {
-        cout << "ToonGraphicsComponent receive: " << msg << endl;
+        if (componentLog)
+            cout << "ToonGraphicsComponent receive: " << msg << endl;
+    }
+
+    virtual MessageMask subscriptions() const override {
+        return MaskOf(MessageType::Damage) | MaskOf(MessageType::Heal) | MaskOf(MessageType::PowerUp) | MaskOf(MessageType::ChangeSkin);
+    }
+
+    virtual void receive(const Message& msg) override {
+        if (componentLog)
+            cout << "ToonGraphicsComponent receive: " << MessageName(msg.type) << " " << msg.value << endl;
     }
 
     virtual void update(Player& player, Graphics& graphics) override {
-        cout << "ToonGraphicsComponent update" << endl;
+        if (componentLog)
+            cout << "ToonGraphicsComponent update" << endl;
     }
 };
 
-class RealGraphicsComponent : public GraphicsComponent
+class RealGraphicsComponent final : public GraphicsComponent
 {
 public:
     virtual ~RealGraphicsComponent() = default;
 
     virtual void receive(string_view msg) override {
-        cout << "RealGraphicsComponent receive: " << msg << endl;
+        if (componentLog)
+            cout << "RealGraphicsComponent receive: " << msg << endl;
+    }
+
+    virtual MessageMask subscriptions() const override {
+        return MaskOf(MessageType::Damage) | MaskOf(MessageType::Heal) | MaskOf(MessageType::PowerUp) | MaskOf(MessageType::ChangeSkin) | MaskOf(MessageType::Teleport);
+    }
+
+    virtual void receive(const Message& msg) override {
+        if (componentLog)
+            cout << "RealGraphicsComponent receive: " << MessageName(msg.type) << " " << msg.value << endl;
     }
 
     virtual void update(Player& player, Graphics& graphics) override {
-        cout << "RealGraphicsComponent update" << endl;
+        if (componentLog)
+            cout << "RealGraphicsComponent update" << endl;
     }
 };
 
 
+// a slot holds one of the known implementations inside the player, so a
+// player is a single block without refcounts. the first one is the default.
+using InputSlot = variant<GameInputComponent, DemoInputComponent>;
+using PhysicsSlot = variant<NormalPhysicsComponent, ZeroGPhysicsComponent>;
+using GraphicsSlot = variant<RealGraphicsComponent, ToonGraphicsComponent>;
+
+template <typename T, typename Slot>
+struct IsSlotOf : false_type {};
+
+template <typename T, typename... Ts>
+struct IsSlotOf<T, variant<Ts...>> : bool_constant<(is_same_v<T, Ts> || ...)> {};
+
 class Player
 {
 public:
@@ -139,16 +280,37 @@ public:
     void update(World& world, Graphics& graphics);
     void sendMessage(string_view msg);
 
+    // right away, to the subscribed components only
+    void sendMessage(const Message& msg);
+
+    // replaces the implementation in the slot T belongs to
+    template <typename T>
+    void setComponent();
+
+    static const int COMPONENT_COUNT = 3;
+
+    Component& component(int index);
+
+    // T has to be the implementation in its slot
+    template <typename T>
+    T& get();
+
+    // which implementation slot 0 input, 1 physics or 2 graphics holds
+    size_t implementation(int slot) const;
+
 public:
     int posX, posY;
     int velocity;
 
 private:
-    shared_ptr<InputComponent> inputC;
-    shared_ptr<PhysicsComponent> physicsC;
-    shared_ptr<GraphicsComponent> graphicsC;
+    void subscribe();
+
+    InputSlot inputC;
+    PhysicsSlot physicsC;
+    GraphicsSlot graphicsC;
 
-    vector<shared_ptr<Component>> components;
+    // bit i set: component(i) subscribes to the type
+    array<uint8_t, MESSAGE_TYPE_COUNT> subscribers{};
 };
 
 void Player::create()
@@ -157,31 +319,498 @@ void Player::create()
     posY = 130;
     velocity = 20;
 
-    inputC = make_shared<GameInputComponent>();
-    physicsC = make_shared<NormalPhysicsComponent>();
-    graphicsC = make_shared<RealGraphicsComponent>();
+    inputC.emplace<GameInputComponent>();
+    physicsC.emplace<NormalPhysicsComponent>();
+    graphicsC.emplace<RealGraphicsComponent>();
+
+    subscribe();
+}
+
+template <typename T>
+void Player::setComponent()
+{
+    if constexpr (IsSlotOf<T, InputSlot>::value)
+        inputC.emplace<T>();
+    else if constexpr (IsSlotOf<T, PhysicsSlot>::value)
+        physicsC.emplace<T>();
+    else {
+        static_assert(IsSlotOf<T, GraphicsSlot>::value, "not a known component implementation");
+        graphicsC.emplace<T>();
+    }
 
-    components.push_back(inputC);
-    components.push_back(physicsC);
-    components.push_back(graphicsC);
+    subscribe();
 }
 
+Component& Player::component(int index)
+{
+    auto base = [](auto& component) -> Component& { return component; };
+
+    if (index == 0)
+        return visit(base, inputC);
+    if (index == 1)
+        return visit(base, physicsC);
+    return visit(base, graphicsC);
+}
+
+template <typename T>
+T& Player::get()
+{
+    if constexpr (IsSlotOf<T, InputSlot>::value)
+        return std::get<T>(inputC);
+    else if constexpr (IsSlotOf<T, PhysicsSlot>::value)
+        return std::get<T>(physicsC);
+    else
+        return std::get<T>(graphicsC);
+}
+
+size_t Player::implementation(int slot) const
+{
+    if (slot == 0)
+        return inputC.index();
+    if (slot == 1)
+        return physicsC.index();
+    return graphicsC.index();
+}
+
+void Player::subscribe()
+{
+    subscribers.fill(0);
+
+    for (int i = 0; i < COMPONENT_COUNT; ++i) {
+        MessageMask mask = component(i).subscriptions();
+        for (int type = 0; type < MESSAGE_TYPE_COUNT; ++type) {
+            if (mask & (MessageMask(1) << type))
+                subscribers[type] |= uint8_t(1 << i);
+        }
+    }
+}
+
+// visit calls the concrete type, the compiler does not need the vtable
 void Player::update(World& world, Graphics& graphics)
 {
-    inputC->update(*this);
-    physicsC->update(*this, world);
-    graphicsC->update(*this, graphics);
+    visit([&](auto& input) { input.update(*this); }, inputC);
+    visit([&](auto& physics) { physics.update(*this, world); }, physicsC);
+    visit([&](auto& graphic) { graphic.update(*this, graphics); }, graphicsC);
 }
 
 void Player::sendMessage(string_view msg)
 {
-    for (auto& com : components)
-        com->receive(msg);
+    for (int i = 0; i < COMPONENT_COUNT; ++i)
+        component(i).receive(msg);
+}
+
+void Player::sendMessage(const Message& msg)
+{
+    uint8_t bits = subscribers[static_cast<int>(msg.type)];
+
+    for (int i = 0; bits != 0; ++i, bits >>= 1) {
+        if (bits & 1)
+            component(i).receive(msg);
+    }
+}
+
+
+// players grouped by the implementation in each of their slots. update runs
+// batch by batch, one virtual call per batch, and the loop inside calls the
+// update of a final class the compiler can inline. swaps go through the
+// batches so a player always sits in the batch of what it holds.
+class PlayerBatches
+{
+public:
+    explicit PlayerBatches(vector<Player>& players);
+
+    // all input batches, then physics, then graphics
+    void update(World& world, Graphics& graphics);
+
+    // replaces the implementation and moves the player to its new batch
+    template <typename T>
+    void setComponent(size_t index);
+
+    // after players were added or removed
+    void rebuild();
+
+    size_t batchCount() const {
+        return batches.size();
+    }
+
+private:
+    struct Batch
+    {
+        virtual ~Batch() = default;
+        virtual void run(vector<Player>& players, World& world, Graphics& graphics) = 0;
+
+        vector<uint32_t> members;
+    };
+
+    template <typename T>
+    struct TypedBatch final : Batch
+    {
+        void run(vector<Player>& players, World& world, Graphics& graphics) override;
+    };
+
+    template <typename Slot, size_t... Is>
+    void addBatches(index_sequence<Is...>);
+
+    size_t batchOf(uint32_t index, int slot) const {
+        return slotOffsets[slot] + players[index].implementation(slot);
+    }
+
+    void add(uint32_t index, int slot);
+    void remove(uint32_t index, int slot);
+
+    vector<Player>& players;
+    vector<unique_ptr<Batch>> batches;
+    array<size_t, Player::COMPONENT_COUNT> slotOffsets{};
+
+    // where every player sits in the batch of each slot
+    vector<array<uint32_t, Player::COMPONENT_COUNT>> positions;
+};
+
+template <typename T>
+void PlayerBatches::TypedBatch<T>::run(vector<Player>& players, World& world, Graphics& graphics)
+{
+    for (uint32_t index : this->members) {
+        Player& player = players[index];
+        T& component = player.get<T>();
+
+        if constexpr (IsSlotOf<T, InputSlot>::value)
+            component.update(player);
+        else if constexpr (IsSlotOf<T, PhysicsSlot>::value)
+            component.update(player, world);
+        else
+            component.update(player, graphics);
+    }
+}
+
+PlayerBatches::PlayerBatches(vector<Player>& players) : players(players)
+{
+    slotOffsets[0] = batches.size();
+    addBatches<InputSlot>(make_index_sequence<variant_size_v<InputSlot>>());
+    slotOffsets[1] = batches.size();
+    addBatches<PhysicsSlot>(make_index_sequence<variant_size_v<PhysicsSlot>>());
+    slotOffsets[2] = batches.size();
+    addBatches<GraphicsSlot>(make_index_sequence<variant_size_v<GraphicsSlot>>());
+
+    rebuild();
+}
+
+template <typename Slot, size_t... Is>
+void PlayerBatches::addBatches(index_sequence<Is...>)
+{
+    (batches.push_back(make_unique<TypedBatch<variant_alternative_t<Is, Slot>>>()), ...);
+}
+
+void PlayerBatches::update(World& world, Graphics& graphics)
+{
+    for (auto& batch : batches)
+        batch->run(players, world, graphics);
+}
+
+template <typename T>
+void PlayerBatches::setComponent(size_t index)
+{
+    int slot = IsSlotOf<T, InputSlot>::value ? 0 : IsSlotOf<T, PhysicsSlot>::value ? 1 : 2;
+    uint32_t player = static_cast<uint32_t>(index);
+
+    remove(player, slot);
+    players[index].setComponent<T>();
+    add(player, slot);
+}
+
+void PlayerBatches::rebuild()
+{
+    for (auto& batch : batches)
+        batch->members.clear();
+
+    positions.resize(players.size());
+
+    for (uint32_t index = 0; index < players.size(); ++index) {
+        for (int slot = 0; slot < Player::COMPONENT_COUNT; ++slot)
+            add(index, slot);
+    }
+}
+
+void PlayerBatches::add(uint32_t index, int slot)
+{
+    vector<uint32_t>& members = batches[batchOf(index, slot)]->members;
+
+    positions[index][slot] = static_cast<uint32_t>(members.size());
+    members.push_back(index);
+}
+
+void PlayerBatches::remove(uint32_t index, int slot)
+{
+    vector<uint32_t>& members = batches[batchOf(index, slot)]->members;
+    uint32_t position = positions[index][slot];
+
+    members[position] = members.back();
+    positions[members[position]][slot] = position;
+    members.pop_back();
 }
 
 
-int main()
+// messages posted during a frame wait here and are delivered together at the
+// sync point, in the order they were posted. messages posted while delivering
+// wait for the next sync point.
+class MessageBus
 {
+public:
+    void post(Player& player, const Message& msg) {
+        queue.push_back({ &player, msg });
+    }
+
+    void deliver();
+
+    size_t pending() const {
+        return queue.size();
+    }
+
+private:
+    using Queue = vector<pair<Player*, Message>>;
+
+    // the two swap, so the buffers are reused from frame to frame
+    Queue queue;
+    Queue delivering;
+};
+
+void MessageBus::deliver()
+{
+    swap(queue, delivering);
+
+    for (auto& [player, msg] : delivering)
+        player->sendMessage(msg);
+
+    delivering.clear();
+}
+
+
+// benchmark harness, "--bench [out.json]" runs it instead of the demo.
+// the batch size doubles until a batch takes minBatch, which also warms up
+// caches and branch predictors, then every repetition times one batch.
+#if defined(_MSC_VER)
+volatile const void* benchSink = nullptr;
+#endif
+
+// the optimizer has to assume the value is read
+template <typename T>
+void DoNotOptimize(const T& value)
+{
+#if defined(_MSC_VER)
+    benchSink = &value;
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+// and that any memory may have been read or written
+void ClobberMemory()
+{
+#if defined(_MSC_VER)
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : : "memory");
+#endif
+}
+
+struct BenchResult
+{
+    string name;
+    long long param;      // the sweep point, unit count, batch size...
+    long long iterations; // operations per repetition
+    double median;        // ns per operation
+    double p10;
+    double p90;
+    double fastest;
+};
+
+class Bench
+{
+public:
+    explicit Bench(string_view suite, ostream& report = cout, int repetitions = 11, nanoseconds minBatch = 5ms)
+        : suite(suite), report(report), repetitions(repetitions), minBatch(minBatch) {}
+
+    // f runs one operation
+    template <typename F>
+    void run(string_view name, long long param, F f);
+
+    bool writeJson(const string& path) const;
+
+private:
+    string suite;
+    ostream& report;
+    int repetitions;
+    nanoseconds minBatch;
+
+    vector<BenchResult> results;
+};
+
+template <typename F>
+void Bench::run(string_view name, long long param, F f)
+{
+    auto timeBatch = [&](long long iterations) {
+        steady_clock::time_point begin = steady_clock::now();
+        for (long long i = 0; i < iterations; ++i) {
+            f();
+            ClobberMemory();
+        }
+        return nanoseconds(steady_clock::now() - begin);
+    };
+
+    long long iterations = 1;
+    while (timeBatch(iterations) < minBatch)
+        iterations *= 2;
+
+    vector<double> samples;
+    for (int r = 0; r < repetitions; ++r)
+        samples.push_back(double(timeBatch(iterations).count()) / iterations);
+
+    sort(samples.begin(), samples.end());
+    auto at = [&](double ratio) { return samples[static_cast<size_t>(ratio * (samples.size() - 1) + 0.5)]; };
+
+    BenchResult result{ string(name), param, iterations, at(0.5), at(0.1), at(0.9), samples.front() };
+    results.push_back(result);
+
+    report << name << " [" << param << "]: median " << result.median << " ns"
+           << ", p10: " << result.p10 << ", p90: " << result.p90 << ", iterations: " << iterations << endl;
+}
+
+bool Bench::writeJson(const string& path) const
+{
+    ofstream out(path);
+    if (!out)
+        return false;
+
+    out << "{\n  \"suite\": \"" << suite << "\",\n  \"results\": [\n";
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        out << "    { \"name\": \"" << r.name << "\", \"param\": " << r.param << ", \"iterations\": " << r.iterations
+            << ", \"median_ns\": " << r.median << ", \"p10_ns\": " << r.p10 << ", \"p90_ns\": " << r.p90
+            << ", \"min_ns\": " << r.fastest << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n}\n";
+    return true;
+}
+
+
+const int BENCH_PLAYER_COUNT = 100000;
+
+// every player gets one message per frame, the types take turns
+void BenchMessages(Bench& bench)
+{
+    vector<Player> players(BENCH_PLAYER_COUNT);
+    MessageBus bus;
+
+    componentLog = false;
+
+    bench.run("string broadcast", BENCH_PLAYER_COUNT, [&] {
+        for (size_t i = 0; i < players.size(); ++i)
+            players[i].sendMessage(string_view(MessageName(static_cast<MessageType>(i % MESSAGE_TYPE_COUNT))));
+    });
+
+    bench.run("typed direct", BENCH_PLAYER_COUNT, [&] {
+        for (size_t i = 0; i < players.size(); ++i)
+            players[i].sendMessage(Message{ static_cast<MessageType>(i % MESSAGE_TYPE_COUNT), int(i) });
+    });
+
+    bench.run("typed bus", BENCH_PLAYER_COUNT, [&] {
+        for (size_t i = 0; i < players.size(); ++i)
+            bus.post(players[i], Message{ static_cast<MessageType>(i % MESSAGE_TYPE_COUNT), int(i) });
+        bus.deliver();
+    });
+
+    componentLog = true;
+}
+
+// the components are inside the player, creating one touches no heap
+void BenchPlayers(Bench& bench)
+{
+    World world;
+    Graphics graphics;
+    vector<Player> players;
+    players.reserve(BENCH_PLAYER_COUNT);
+
+    componentLog = false;
+
+    bench.run("create players", BENCH_PLAYER_COUNT, [&] {
+        players.clear();
+        for (int i = 0; i < BENCH_PLAYER_COUNT; ++i)
+            players.emplace_back();
+    });
+
+    bench.run("update players", BENCH_PLAYER_COUNT, [&] {
+        for (Player& player : players)
+            player.update(world, graphics);
+    });
+
+    componentLog = true;
+}
+
+// every slot gets a pseudo random implementation, so the per player path
+// cannot predict which update comes next
+void MixPlayers(vector<Player>& players)
+{
+    uint32_t seed = 17;
+
+    for (Player& player : players) {
+        seed = seed * 1664525u + 1013904223u;
+
+        if (seed & (1u << 20))
+            player.setComponent<DemoInputComponent>();
+        if (seed & (1u << 21))
+            player.setComponent<ZeroGPhysicsComponent>();
+        if (seed & (1u << 22))
+            player.setComponent<ToonGraphicsComponent>();
+    }
+}
+
+void BenchBatches(Bench& bench)
+{
+    World world;
+    Graphics graphics;
+    vector<Player> players(BENCH_PLAYER_COUNT);
+    MixPlayers(players);
+
+    PlayerBatches batches(players);
+
+    componentLog = false;
+
+    bench.run("update mixed per player", BENCH_PLAYER_COUNT, [&] {
+        for (Player& player : players)
+            player.update(world, graphics);
+    });
+
+    bench.run("update mixed batches", BENCH_PLAYER_COUNT, [&] {
+        batches.update(world, graphics);
+    });
+
+    size_t next = 0;
+    bench.run("swap through batches", 1, [&] {
+        next = (next + 7919) % players.size();
+        if (players[next].implementation(1) == 0)
+            batches.setComponent<ZeroGPhysicsComponent>(next);
+        else
+            batches.setComponent<NormalPhysicsComponent>(next);
+    });
+
+    componentLog = true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && string_view(argv[1]) == "--bench") {
+        Bench bench("component");
+        BenchMessages(bench);
+        BenchPlayers(bench);
+        BenchBatches(bench);
+
+        if (argc > 2 && !bench.writeJson(argv[2]))
+            cout << "cannot write: " << argv[2] << endl;
+        return 0;
+    }
+
     World world;
     Graphics graphics;
     Player player;
@@ -189,6 +818,41 @@ int main()
     player.update(world, graphics);
     player.sendMessage("player msg");
 
+    cout << endl << "message bus =======" << endl;
+
+    MessageBus bus;
+    bus.post(player, Message{ MessageType::Damage, 30 });
+    bus.post(player, Message{ MessageType::Jump, 1 });
+    bus.post(player, Message{ MessageType::PlaySound, 7 });
+    bus.post(player, Message{ MessageType::Teleport, 2 });
+
+    cout << "pending: " << bus.pending() << ", delivered at the sync point:" << endl;
+    bus.deliver();
+
+    cout << endl << "inline components =======" << endl;
+
+    cout << "player size: " << sizeof(Player) << " bytes, no heap blocks" << endl;
+
+    player.setComponent<ZeroGPhysicsComponent>();
+    player.setComponent<ToonGraphicsComponent>();
+    player.update(world, graphics);
+
+    // the subscriptions follow the swap, zero g does not handle stun
+    player.sendMessage(Message{ MessageType::Stun, 3 });
+
+    cout << endl << "type batches =======" << endl;
+
+    vector<Player> squad(3);
+    squad[1].setComponent<DemoInputComponent>();
+    squad[2].setComponent<ZeroGPhysicsComponent>();
+
+    PlayerBatches batches(squad);
+    batches.update(world, graphics);
+
+    cout << "swap player 0 to toon graphics" << endl;
+
+    batches.setComponent<ToonGraphicsComponent>(0);
+    batches.update(world, graphics);
+
     return 0;
 }
-
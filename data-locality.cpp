@@ -1,6 +1,52 @@
 ﻿#include <iostream>
+#include <fstream>
+#include <iomanip>
 #include <vector>
+#include <array>
+#include <deque>
+#include <string>
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+#include <tuple>
+#include <optional>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <algorithm>
+#include <charconv>
+#include <new>
+#include <random>
+#include <limits>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#if !defined(_MSC_VER)
+#include <cpuid.h>
+#endif
+#endif
 
 
 // tested x64, c++17
@@ -8,6 +54,453 @@
 using namespace std;
 using namespace std::chrono;
 
+// heap accounting: the global operator new counts every allocation, so a
+// frame can report how many it made. the steady state should make none.
+// the aligned forms are replaced too: pmr::new_delete_resource, the simd
+// buffers and the huge page blocks allocate through them. every replaced new
+// pairs with a replaced delete, malloc with free and _aligned_malloc with
+// _aligned_free. gcc sees the replaced new as the real one and warns about
+// the free, hence the pragma. interpreter.cpp and observer.cpp carry the
+// same code under a one line comment.
+atomic<long long> heapAllocations{ 0 };
+
+void* operator new(size_t size)
+{
+    heapAllocations.fetch_add(1, memory_order_relaxed);
+
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
+
+void* operator new(size_t size, align_val_t align)
+{
+    heapAllocations.fetch_add(1, memory_order_relaxed);
+
+    size_t alignment = static_cast<size_t>(align);
+#if defined(_MSC_VER)
+    void* p = _aligned_malloc(size ? size : 1, alignment);
+#else
+    void* p = aligned_alloc(alignment, (max<size_t>(size, 1) + alignment - 1) & ~(alignment - 1));
+#endif
+    if (p)
+        return p;
+    throw bad_alloc();
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+#if defined(_MSC_VER)
+void operator delete(void* p, align_val_t) noexcept { _aligned_free(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { _aligned_free(p); }
+#else
+void operator delete(void* p, align_val_t) noexcept { free(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { free(p); }
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// heap allocations since the previous take
+class AllocationCounter
+{
+public:
+    long long take() {
+        long long now = heapAllocations.load(memory_order_relaxed);
+        long long count = now - mark;
+        mark = now;
+        return count;
+    }
+
+private:
+    long long mark = heapAllocations.load(memory_order_relaxed);
+};
+
+
+// a linear arena: allocation bumps an offset, deallocation does nothing and
+// reset drops everything at once. used as a frame arena reset every frame and
+// as a level arena reset on level change. when the block runs out it bumps
+// through overflow blocks from upstream, the next reset folds them into one
+// bigger block, so after the first frames the arena stops touching the heap.
+class LinearArena : public pmr::memory_resource
+{
+public:
+    explicit LinearArena(size_t capacity, pmr::memory_resource* upstream = pmr::new_delete_resource());
+    ~LinearArena();
+
+    LinearArena(const LinearArena&) = delete;
+    LinearArena& operator=(const LinearArena&) = delete;
+
+    void reset();
+
+    // bytes handed out since the last reset, overflow blocks included
+    size_t used() const;
+
+    // the block, grown by the resets so far
+    size_t capacity() const {
+        return size;
+    }
+
+    // the block and the overflow blocks taken from upstream since the last reset
+    size_t reserved() const {
+        return size + overflowBytes;
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void*, size_t, size_t) override {}
+
+    bool do_is_equal(const pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    // overflow blocks are chained through a header at their start
+    struct Overflow
+    {
+        Overflow* next;
+        size_t bytes;
+        size_t alignment;
+        size_t offset;
+    };
+
+    static void* bump(unsigned char* base, size_t& offset, size_t limit, size_t bytes, size_t alignment);
+
+    pmr::memory_resource* upstream;
+    unsigned char* block;
+    size_t size;
+    size_t offset = 0;
+
+    Overflow* overflow = nullptr;
+    size_t overflowBytes = 0;
+};
+
+LinearArena::LinearArena(size_t capacity, pmr::memory_resource* upstream)
+    : upstream(upstream), size(capacity)
+{
+    block = static_cast<unsigned char*>(upstream->allocate(size, alignof(max_align_t)));
+}
+
+LinearArena::~LinearArena()
+{
+    reset();
+    upstream->deallocate(block, size, alignof(max_align_t));
+}
+
+size_t LinearArena::used() const
+{
+    size_t total = offset;
+
+    for (const Overflow* o = overflow; o != nullptr; o = o->next)
+        total += o->offset - sizeof(Overflow);
+
+    return total;
+}
+
+void* LinearArena::bump(unsigned char* base, size_t& offset, size_t limit, size_t bytes, size_t alignment)
+{
+    uintptr_t start = reinterpret_cast<uintptr_t>(base);
+    uintptr_t aligned = (start + offset + alignment - 1) & ~(alignment - 1);
+
+    if (aligned + bytes > start + limit)
+        return nullptr;
+
+    offset = aligned + bytes - start;
+    return reinterpret_cast<void*>(aligned);
+}
+
+void* LinearArena::do_allocate(size_t bytes, size_t alignment)
+{
+    if (void* p = bump(block, offset, size, bytes, alignment))
+        return p;
+
+    if (overflow != nullptr) {
+        if (void* p = bump(reinterpret_cast<unsigned char*>(overflow), overflow->offset, overflow->bytes, bytes, alignment))
+            return p;
+    }
+
+    // at least as big as the block, so a run of small allocations takes few
+    size_t blockAlignment = max(alignment, alignof(Overflow));
+    size_t total = max(size, sizeof(Overflow) + blockAlignment + bytes);
+    auto* extra = static_cast<Overflow*>(upstream->allocate(total, blockAlignment));
+
+    *extra = { overflow, total, blockAlignment, sizeof(Overflow) };
+    overflow = extra;
+    overflowBytes += total;
+
+    return bump(reinterpret_cast<unsigned char*>(extra), extra->offset, total, bytes, alignment);
+}
+
+void LinearArena::reset()
+{
+    if (overflow != nullptr) {
+        size_t grown = size + overflowBytes;
+
+        while (overflow != nullptr) {
+            Overflow* next = overflow->next;
+            upstream->deallocate(overflow, overflow->bytes, overflow->alignment);
+            overflow = next;
+        }
+
+        upstream->deallocate(block, size, alignof(max_align_t));
+        size = grown;
+        block = static_cast<unsigned char*>(upstream->allocate(size, alignof(max_align_t)));
+        overflowBytes = 0;
+    }
+
+    offset = 0;
+}
+
+
+// size class pools for objects that outlive a frame, freed blocks are kept
+// for reuse instead of going back to the heap. not thread safe.
+class PooledResource : public pmr::memory_resource
+{
+public:
+    explicit PooledResource(pmr::memory_resource* upstream = pmr::new_delete_resource())
+        : pools(upstream) {}
+
+    // blocks handed out and not yet given back
+    size_t live() const {
+        return liveCount;
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        ++liveCount;
+        return pools.allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        --liveCount;
+        pools.deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    pmr::unsynchronized_pool_resource pools;
+    size_t liveCount = 0;
+};
+
+
+// hardware counters through perf_event_open, opened as one group on the
+// calling thread so they all count over the same interval. a counter the
+// host refuses is left out, and where perf_event_open is missing or blocked
+// (containers, vms, other platforms) only the time is measured.
+const int PERF_EVENT_COUNT = 6;
+const char* const PERF_EVENT_NAMES[PERF_EVENT_COUNT] = {
+    "cycles", "instructions", "l1d misses", "llc misses", "branch misses", "dtlb misses"
+};
+
+enum PerfEvent {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_DTLB_MISSES
+};
+
+// counts of a measured interval, -1 for a counter that is not available
+struct PerfSample
+{
+    nanoseconds elapsed{ 0 };
+    array<long long, PERF_EVENT_COUNT> counts{};
+
+    PerfSample() {
+        counts.fill(-1);
+    }
+
+    bool has(PerfEvent event) const {
+        return counts[event] >= 0;
+    }
+
+    PerfSample& operator+=(const PerfSample& other);
+};
+
+PerfSample& PerfSample::operator+=(const PerfSample& other)
+{
+    elapsed += other.elapsed;
+
+    for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+        if (other.counts[i] >= 0)
+            counts[i] = max(counts[i], 0LL) + other.counts[i];
+    }
+
+    return *this;
+}
+
+class PerfCounters
+{
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available() const {
+        return leader >= 0;
+    }
+
+    // running totals, scaled up when the kernel had to multiplex the group
+    array<long long, PERF_EVENT_COUNT> read() const;
+
+private:
+    int leader = -1;
+    vector<int> fds;
+    array<int, PERF_EVENT_COUNT> slot; // place in the group read, -1 if not open
+};
+
+PerfCounters::PerfCounters()
+{
+    slot.fill(-1);
+
+#if defined(__linux__)
+    const pair<uint32_t, uint64_t> configs[PERF_EVENT_COUNT] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    };
+
+    for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = configs[i].first;
+        attr.config = configs[i].second;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        int fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0));
+        if (fd < 0) {
+            // without cycles there is no group to join
+            if (i == PERF_CYCLES)
+                return;
+            continue;
+        }
+
+        if (leader < 0)
+            leader = fd;
+
+        slot[i] = static_cast<int>(fds.size());
+        fds.push_back(fd);
+    }
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#if defined(__linux__)
+    for (int fd : fds)
+        close(fd);
+#endif
+}
+
+array<long long, PERF_EVENT_COUNT> PerfCounters::read() const
+{
+    array<long long, PERF_EVENT_COUNT> counts;
+    counts.fill(-1);
+
+#if defined(__linux__)
+    if (leader < 0)
+        return counts;
+
+    // nr, time enabled, time running, then a value per counter in open order
+    uint64_t data[3 + PERF_EVENT_COUNT] = {};
+    if (::read(leader, data, sizeof(data)) < ssize_t(3 * sizeof(uint64_t)) || data[2] == 0)
+        return counts;
+
+    double scale = double(data[1]) / double(data[2]);
+
+    for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+        if (slot[i] >= 0 && uint64_t(slot[i]) < data[0])
+            counts[i] = static_cast<long long>(double(data[3 + slot[i]]) * scale);
+    }
+#endif
+
+    return counts;
+}
+
+// adds the time and counts of its own lifetime, or up to stop, to total
+class PerfScope
+{
+public:
+    PerfScope(const PerfCounters& counters, PerfSample& total)
+        : counters(counters), total(total), begin(counters.read()), beginTime(steady_clock::now()) {}
+
+    ~PerfScope() {
+        if (!stopped)
+            stop();
+    }
+
+    void stop();
+
+private:
+    const PerfCounters& counters;
+    PerfSample& total;
+
+    array<long long, PERF_EVENT_COUNT> begin;
+    steady_clock::time_point beginTime;
+    bool stopped = false;
+};
+
+void PerfScope::stop()
+{
+    stopped = true;
+
+    PerfSample sample;
+    sample.elapsed = steady_clock::now() - beginTime;
+
+    array<long long, PERF_EVENT_COUNT> end = counters.read();
+    for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+        if (begin[i] >= 0 && end[i] >= 0)
+            sample.counts[i] = max(end[i] - begin[i], 0LL);
+    }
+
+    total += sample;
+}
+
+// time and counts divided by per, the number of units, frames or operations measured
+void PrintPerf(ostream& os, const string& label, const PerfSample& sample, double per = 1.)
+{
+    os << label << " time: " << double(sample.elapsed.count()) / per << "ns";
+
+    if (!sample.has(PERF_CYCLES)) {
+        os << ", counters unavailable" << endl;
+        return;
+    }
+
+    if (sample.has(PERF_INSTRUCTIONS) && sample.counts[PERF_CYCLES] > 0)
+        os << ", ipc: " << double(sample.counts[PERF_INSTRUCTIONS]) / double(sample.counts[PERF_CYCLES]);
+
+    for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+        if (sample.counts[i] >= 0)
+            os << ", " << PERF_EVENT_NAMES[i] << ": " << double(sample.counts[i]) / per;
+    }
+
+    os << endl;
+}
+
+// opened once, the tests and benchmarks all read the same group
+PerfCounters& SharedPerfCounters()
+{
+    static PerfCounters counters;
+    return counters;
+}
+
+
 class Graphics {};
 class World {};
 
@@ -33,11 +526,13 @@ public:
 
     void setUnitId(int id) { unitId = id; }
 
-    void update(World& world) {}
-    void update(Unit& unit, World& world) {}
+    // a little state to touch, so the loops are not optimized away
+    void update(World& world) { ++frameCount; }
+    void update(Unit& unit, World& world) { ++frameCount; }
 
 private:
     int unitId;
+    int frameCount = 0;
 };
 
 class PhysicsComponent : public Component
@@ -52,11 +547,13 @@ public:
 
     void setUnitId(int id) { unitId = id; }
 
-    void update(World& world) {}
-    void update(Unit& unit, World& world) {}
+    // a little state to touch, so the loops are not optimized away
+    void update(World& world) { ++frameCount; }
+    void update(Unit& unit, World& world) { ++frameCount; }
 
 private:
     int unitId;
+    int frameCount = 0;
 };
 
 class RenderComponent : public Component
@@ -71,18 +568,21 @@ public:
 
     void setUnitId(int id) { unitId = id; }
 
-    void render(Graphics& graphics) {}
-    void render(Unit& unit, Graphics& graphics) {}
+    void render(Graphics& graphics) { ++frameCount; }
+    void render(Unit& unit, Graphics& graphics) { ++frameCount; }
 
 private:
     int unitId;
+    int frameCount = 0;
 };
 
 
 class Unit
 {
 public:
-    Unit() { create(); }
+    Unit() : Unit(pmr::get_default_resource()) {}
+    // the components and their control blocks come from resource
+    explicit Unit(pmr::memory_resource* resource) : components(resource) { create(); }
     virtual ~Unit() = default;
 
     void create();
@@ -99,7 +599,7 @@ private:
     shared_ptr<PhysicsComponent> physicsC;
     shared_ptr<RenderComponent> renderC;
 
-    vector<shared_ptr<Component>> components;
+    pmr::vector<shared_ptr<Component>> components;
 };
 
 void Unit::create()
@@ -113,10 +613,13 @@ void Unit::create()
     posY = 130;
     velocity = 20;
 
-    aiC = make_shared<AIComponent>(id);
-    physicsC = make_shared<PhysicsComponent>(id);
-    renderC = make_shared<RenderComponent>(id);
+    pmr::memory_resource* resource = components.get_allocator().resource();
+
+    aiC = allocate_shared<AIComponent>(pmr::polymorphic_allocator<AIComponent>(resource), id);
+    physicsC = allocate_shared<PhysicsComponent>(pmr::polymorphic_allocator<PhysicsComponent>(resource), id);
+    renderC = allocate_shared<RenderComponent>(pmr::polymorphic_allocator<RenderComponent>(resource), id);
 
+    components.reserve(3);
     components.push_back(aiC);
     components.push_back(physicsC);
     components.push_back(renderC);
@@ -136,183 +639,2948 @@ void Unit::sendMessage(string_view msg)
 }
 
 
-const int MAX_UNIT_COUNT = 10000;
-const int MAX_LOOP_COUNT = 1000;
-
-void TestDataLocality1()
+// every thread owns a deque of tasks, it pops the newest of its own and steals
+// the oldest from the others when it runs dry. threads outside the pool share
+// deque 0 and help out while they wait, so waiting inside a task never deadlocks.
+class WorkStealingPool
 {
-    World world;
-    Graphics graphics;
-
-    vector<unique_ptr<Unit>> units;
+public:
+    explicit WorkStealingPool(size_t workerCount);
+    ~WorkStealingPool();
 
-    for (int i = 0; i < MAX_UNIT_COUNT; ++i)
-        units.push_back(make_unique<Unit>());
+    // pending is decremented once the task has run
+    void submit(function<void()> task, atomic<int>& pending);
 
-    int loopCount = 0;
-    steady_clock::time_point begin = steady_clock::now();
+    // runs queued tasks until pending drops to zero
+    void wait(atomic<int>& pending);
 
-    while (loopCount < MAX_LOOP_COUNT) {
-        for (auto& unit : units)
-            unit->update(world, graphics);
+    // f(begin, end) over [0, count) in ranges of grain, the caller takes the first range
+    template <typename F>
+    void parallelFor(size_t count, size_t grain, F f);
 
-        ++loopCount;
+    size_t threadCount() const {
+        return workers.size() + 1;
     }
 
-    steady_clock::time_point end = steady_clock::now();
-    nanoseconds elapsed = end - begin;
-    milliseconds elapsed2 = duration_cast<milliseconds>(elapsed);
+private:
+    struct Task
+    {
+        function<void()> run;
+        atomic<int>* pending;
+    };
 
-    cout << "test_1 elapsed time: " << elapsed << ", " << elapsed2 << endl;
-}
+    struct alignas(64) TaskDeque
+    {
+        mutex lock;
+        deque<Task> tasks;
+    };
 
-void TestDataLocality2()
-{
-    World world;
-    Graphics graphics;
+    size_t currentDeque() const;
+    bool tryRun(size_t self);
+    void workerLoop(size_t self);
 
-    vector<Unit> units;
+    vector<unique_ptr<TaskDeque>> deques;
+    vector<thread> workers;
 
-    for (int i = 0; i < MAX_UNIT_COUNT; ++i)
-        units.push_back(Unit());
+    atomic<bool> running = true;
+    atomic<int> queued = 0;
 
-    int loopCount = 0;
-    steady_clock::time_point begin = steady_clock::now();
+    mutex sleepLock;
+    condition_variable wakeup;
 
-    while (loopCount < MAX_LOOP_COUNT) {
-        for (auto& unit : units)
-            unit.update(world, graphics);
+    static thread_local const WorkStealingPool* ownerPool;
+    static thread_local size_t ownDeque;
+};
 
-        ++loopCount;
+thread_local const WorkStealingPool* WorkStealingPool::ownerPool = nullptr;
+thread_local size_t WorkStealingPool::ownDeque = 0;
+
+WorkStealingPool::WorkStealingPool(size_t workerCount)
+{
+    for (size_t i = 0; i <= workerCount; ++i)
+        deques.push_back(make_unique<TaskDeque>());
+
+    for (size_t i = 1; i <= workerCount; ++i)
+        workers.emplace_back(&WorkStealingPool::workerLoop, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        lock_guard<mutex> guard(sleepLock);
+        running = false;
     }
+    wakeup.notify_all();
 
-    steady_clock::time_point end = steady_clock::now();
-    nanoseconds elapsed = end - begin;
-    milliseconds elapsed2 = duration_cast<milliseconds>(elapsed);
+    for (auto& t : workers)
+        t.join();
+}
 
-    cout << "test_2 elapsed time: " << elapsed << ", " << elapsed2 << endl;
+size_t WorkStealingPool::currentDeque() const
+{
+    return (ownerPool == this) ? ownDeque : 0;
 }
 
-void TestDataLocality3()
+void WorkStealingPool::submit(function<void()> task, atomic<int>& pending)
 {
-    World world;
-    Graphics graphics;
+    TaskDeque& own = *deques[currentDeque()];
+    {
+        lock_guard<mutex> guard(own.lock);
+        own.tasks.push_back({ move(task), &pending });
+    }
+    queued.fetch_add(1, memory_order_release);
 
-    vector<unique_ptr<AIComponent>> aiComps;
-    vector<unique_ptr<PhysicsComponent>> physicsComps;
-    vector<unique_ptr<RenderComponent>> renderComps;
+    // taking the lock orders this with a worker that is about to sleep
+    { lock_guard<mutex> guard(sleepLock); }
+    wakeup.notify_one();
+}
 
-    for (int i = 1; i <= MAX_UNIT_COUNT; ++i) {
-        aiComps.push_back(make_unique<AIComponent>(i));
-        physicsComps.push_back(make_unique<PhysicsComponent>(i));
-        renderComps.push_back(make_unique<RenderComponent>(i));
+bool WorkStealingPool::tryRun(size_t self)
+{
+    Task task;
+    bool found = false;
+
+    for (size_t i = 0; i < deques.size() && !found; ++i) {
+        size_t victim = (self + i) % deques.size();
+        TaskDeque& d = *deques[victim];
+
+        lock_guard<mutex> guard(d.lock);
+        if (d.tasks.empty())
+            continue;
+
+        // newest of our own for locality, oldest of the others since it is the biggest
+        if (victim == self) {
+            task = move(d.tasks.back());
+            d.tasks.pop_back();
+        }
+        else {
+            task = move(d.tasks.front());
+            d.tasks.pop_front();
+        }
+        found = true;
     }
 
-    int loopCount = 0;
-    steady_clock::time_point begin = steady_clock::now();
+    if (!found)
+        return false;
 
-    while (loopCount < MAX_LOOP_COUNT) {
-        for (auto& ac : aiComps)
-            ac->update(world);
+    queued.fetch_sub(1, memory_order_relaxed);
+    task.run();
+    task.pending->fetch_sub(1, memory_order_acq_rel);
 
-        for (auto& pc : physicsComps)
-            pc->update(world);
+    return true;
+}
 
-        for (auto& rc : renderComps)
-            rc->render(graphics);
+void WorkStealingPool::wait(atomic<int>& pending)
+{
+    size_t self = currentDeque();
 
-        ++loopCount;
+    while (pending.load(memory_order_acquire) > 0) {
+        if (!tryRun(self))
+            this_thread::yield();
     }
+}
 
-    steady_clock::time_point end = steady_clock::now();
-    nanoseconds elapsed = end - begin;
-    milliseconds elapsed2 = duration_cast<milliseconds>(elapsed);
+void WorkStealingPool::workerLoop(size_t self)
+{
+    ownerPool = this;
+    ownDeque = self;
 
-    cout << "test_3 elapsed time: " << elapsed << ", " << elapsed2 << endl;
+    while (true) {
+        if (tryRun(self))
+            continue;
+
+        unique_lock<mutex> guard(sleepLock);
+        wakeup.wait(guard, [this] { return !running || queued.load(memory_order_acquire) > 0; });
+
+        if (!running)
+            return;
+    }
 }
 
-void TestDataLocality4()
+template <typename F>
+void WorkStealingPool::parallelFor(size_t count, size_t grain, F f)
 {
-    World world;
-    Graphics graphics;
-
-    vector<AIComponent> aiComps;
-    vector<PhysicsComponent> physicsComps;
-    vector<RenderComponent> renderComps;
+    grain = max<size_t>(grain, 1);
+    atomic<int> pending = 0;
 
-    for (int i = 1; i <= MAX_UNIT_COUNT; ++i) {
-        aiComps.push_back(AIComponent(i));
-        physicsComps.push_back(PhysicsComponent(i));
-        renderComps.push_back(RenderComponent(i));
+    for (size_t begin = grain; begin < count; begin += grain) {
+        size_t end = min(begin + grain, count);
+        pending.fetch_add(1, memory_order_relaxed);
+        submit([&f, begin, end] { f(begin, end); }, pending);
     }
 
-    int loopCount = 0;
-    steady_clock::time_point begin = steady_clock::now();
+    f(0, min(grain, count));
+    wait(pending);
+}
 
-    while (loopCount < MAX_LOOP_COUNT) {
+
+// an index into a sparse set plus the generation of its slot when the handle
+// was made. destroying bumps the generation, so older handles stop matching.
+struct Handle
+{
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+
+    bool operator==(const Handle& other) const {
+        return index == other.index && generation == other.generation;
+    }
+
+    bool operator!=(const Handle& other) const {
+        return !(*this == other);
+    }
+};
+
+ostream& operator<<(ostream& os, const Handle& handle)
+{
+    if (handle.index == UINT32_MAX)
+        return os << "none";
+
+    return os << handle.index << ":" << handle.generation;
+}
+
+// the sparse array maps a handle's index to a slot of the dense arrays.
+// destroy moves the last element into the hole, so iteration has no holes,
+// and freed indices are reused through a free list threaded through sparse.
+template <typename T>
+class SparseSet
+{
+public:
+    template <typename... Args>
+    Handle create(Args&&... args);
+
+    // false for a stale handle
+    bool destroy(Handle handle);
+
+    // nullptr for a stale handle
+    T* get(Handle handle) {
+        return contains(handle) ? &dense[sparse[handle.index].dense] : nullptr;
+    }
+
+    bool contains(Handle handle) const {
+        if (handle.index >= sparse.size())
+            return false;
+
+        uint32_t slot = sparse[handle.index].dense;
+        return slot < denseHandles.size() && denseHandles[slot] == handle;
+    }
+
+    size_t size() const {
+        return dense.size();
+    }
+
+    // dense order, destroy moves the last element
+    typename vector<T>::iterator begin() { return dense.begin(); }
+    typename vector<T>::iterator end() { return dense.end(); }
+
+    Handle handleAt(size_t denseIndex) const {
+        return denseHandles[denseIndex];
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t dense = 0; // next free index while the slot is free
+        uint32_t generation = 0;
+    };
+
+    static const uint32_t NO_SLOT = UINT32_MAX;
+
+    vector<Slot> sparse;
+    vector<T> dense;
+    vector<Handle> denseHandles;
+
+    uint32_t freeHead = NO_SLOT;
+};
+
+template <typename T>
+template <typename... Args>
+Handle SparseSet<T>::create(Args&&... args)
+{
+    uint32_t index = freeHead;
+
+    if (index != NO_SLOT) {
+        freeHead = sparse[index].dense;
+    }
+    else {
+        index = static_cast<uint32_t>(sparse.size());
+        sparse.push_back(Slot());
+    }
+
+    Slot& slot = sparse[index];
+    slot.dense = static_cast<uint32_t>(dense.size());
+
+    Handle handle{ index, slot.generation };
+    dense.emplace_back(forward<Args>(args)...);
+    denseHandles.push_back(handle);
+
+    return handle;
+}
+
+template <typename T>
+bool SparseSet<T>::destroy(Handle handle)
+{
+    if (!contains(handle))
+        return false;
+
+    Slot& slot = sparse[handle.index];
+    uint32_t hole = slot.dense;
+    uint32_t last = static_cast<uint32_t>(dense.size() - 1);
+
+    if (hole != last) {
+        dense[hole] = move(dense[last]);
+        denseHandles[hole] = denseHandles[last];
+        sparse[denseHandles[hole].index].dense = hole;
+    }
+
+    dense.pop_back();
+    denseHandles.pop_back();
+
+    ++slot.generation;
+    slot.dense = freeHead;
+    freeHead = handle.index;
+
+    return true;
+}
+
+
+// archetype storage: entities with the same component set share chunks of
+// CHUNK_SIZE bytes, every component type is its own array inside a chunk.
+// queries walk the matching chunks linearly and only touch their columns.
+// an entity is a generational handle, one of a destroyed entity finds nothing.
+using Entity = Handle;
+using ComponentMask = uint64_t;
+
+const Entity INVALID_ENTITY = Handle();
+const size_t CHUNK_SIZE = 16 * 1024;
+const int MAX_COMPONENT_TYPES = 64;
+
+struct ComponentInfo
+{
+    size_t size;
+    size_t align;
+};
+
+// reserved up front, so readers never see the vector reallocate
+vector<ComponentInfo>& ComponentInfos()
+{
+    static vector<ComponentInfo> infos = [] {
+        vector<ComponentInfo> reserved;
+        reserved.reserve(MAX_COMPONENT_TYPES);
+        return reserved;
+    }();
+    return infos;
+}
+
+int RegisterComponentType(size_t size, size_t align)
+{
+    static mutex registerLock;
+    lock_guard<mutex> guard(registerLock);
+
+    vector<ComponentInfo>& infos = ComponentInfos();
+    if (infos.size() == MAX_COMPONENT_TYPES)
+        throw length_error("too many component types");
+
+    infos.push_back({ size, align });
+    return static_cast<int>(infos.size() - 1);
+}
+
+template <typename T>
+int ComponentTypeId()
+{
+    static_assert(is_trivially_copyable_v<T>, "components are moved between chunks with memcpy");
+
+    static const int id = RegisterComponentType(sizeof(T), alignof(T));
+    return id;
+}
+
+template <typename... Ts>
+ComponentMask MaskOf()
+{
+    return (ComponentMask(0) | ... | (ComponentMask(1) << ComponentTypeId<Ts>()));
+}
+
+
+struct Chunk
+{
+    alignas(64) unsigned char data[CHUNK_SIZE];
+    uint32_t count = 0;
+};
+
+class Archetype
+{
+public:
+    explicit Archetype(ComponentMask mask);
+
+    // appends a row in the last chunk, returns its chunk index and row
+    pair<uint32_t, uint32_t> push(Entity entity);
+
+    // fills the hole with the last row, returns the entity moved there
+    Entity removeRow(uint32_t chunkIndex, uint32_t row);
+
+    // exchanges two rows, entity ids included
+    void swapRows(uint32_t chunkA, uint32_t rowA, uint32_t chunkB, uint32_t rowB);
+
+    size_t rowCount() const {
+        return chunks.empty() ? 0 : (chunks.size() - 1) * capacity + chunks.back()->count;
+    }
+
+    Entity* entities(Chunk& chunk) const {
+        return reinterpret_cast<Entity*>(chunk.data);
+    }
+
+    unsigned char* column(Chunk& chunk, int typeId) const {
+        return chunk.data + offsets[typeId];
+    }
+
+    template <typename T>
+    T* column(Chunk& chunk) const {
+        return reinterpret_cast<T*>(column(chunk, ComponentTypeId<T>()));
+    }
+
+public:
+    const ComponentMask mask;
+    vector<int> types;
+    uint32_t capacity; // rows per chunk
+
+    vector<unique_ptr<Chunk>> chunks;
+
+private:
+    size_t layout(uint32_t rowCount);
+
+    array<uint32_t, MAX_COMPONENT_TYPES> offsets{};
+};
+
+Archetype::Archetype(ComponentMask mask) : mask(mask)
+{
+    const vector<ComponentInfo>& infos = ComponentInfos();
+    size_t rowSize = sizeof(Entity);
+
+    for (int id = 0; id < MAX_COMPONENT_TYPES; ++id) {
+        if (mask & (ComponentMask(1) << id)) {
+            types.push_back(id);
+            rowSize += infos[id].size;
+        }
+    }
+
+    // columns start on a cache line, give back rows until the padding fits
+    capacity = static_cast<uint32_t>(CHUNK_SIZE / rowSize);
+    while (layout(capacity) > CHUNK_SIZE)
+        --capacity;
+    layout(capacity);
+}
+
+size_t Archetype::layout(uint32_t rowCount)
+{
+    const vector<ComponentInfo>& infos = ComponentInfos();
+    size_t offset = sizeof(Entity) * rowCount;
+
+    for (int id : types) {
+        size_t align = max<size_t>(infos[id].align, 64);
+        offset = (offset + align - 1) & ~(align - 1);
+        offsets[id] = static_cast<uint32_t>(offset);
+        offset += infos[id].size * rowCount;
+    }
+
+    return offset;
+}
+
+pair<uint32_t, uint32_t> Archetype::push(Entity entity)
+{
+    if (chunks.empty() || chunks.back()->count == capacity)
+        chunks.push_back(make_unique<Chunk>());
+
+    Chunk& chunk = *chunks.back();
+    uint32_t row = chunk.count++;
+    entities(chunk)[row] = entity;
+
+    return { static_cast<uint32_t>(chunks.size() - 1), row };
+}
+
+Entity Archetype::removeRow(uint32_t chunkIndex, uint32_t row)
+{
+    const vector<ComponentInfo>& infos = ComponentInfos();
+
+    Chunk& chunk = *chunks[chunkIndex];
+    Chunk& last = *chunks.back();
+    uint32_t lastRow = last.count - 1;
+
+    Entity moved = INVALID_ENTITY;
+
+    if (&chunk != &last || row != lastRow) {
+        moved = entities(last)[lastRow];
+        entities(chunk)[row] = moved;
+
+        for (int id : types) {
+            size_t size = infos[id].size;
+            memcpy(column(chunk, id) + row * size, column(last, id) + lastRow * size, size);
+        }
+    }
+
+    if (--last.count == 0)
+        chunks.pop_back();
+
+    return moved;
+}
+
+void Archetype::swapRows(uint32_t chunkA, uint32_t rowA, uint32_t chunkB, uint32_t rowB)
+{
+    const vector<ComponentInfo>& infos = ComponentInfos();
+
+    Chunk& a = *chunks[chunkA];
+    Chunk& b = *chunks[chunkB];
+
+    swap(entities(a)[rowA], entities(b)[rowB]);
+
+    for (int id : types) {
+        size_t size = infos[id].size;
+        unsigned char* first = column(a, id) + rowA * size;
+        swap_ranges(first, first + size, column(b, id) + rowB * size);
+    }
+}
+
+
+class ArchetypeWorld
+{
+public:
+    template <typename... Ts>
+    Entity create(const Ts&... components);
+    void destroy(Entity entity);
+
+    // adding or removing a component moves the entity to another archetype
+    template <typename T>
+    void add(Entity entity, const T& component);
+    template <typename T>
+    void remove(Entity entity);
+
+    // nullptr when the entity does not have the component or is destroyed
+    template <typename T>
+    T* get(Entity entity);
+
+    bool contains(Entity entity) const {
+        return records.contains(entity);
+    }
+
+    size_t entityCount() const {
+        return records.size();
+    }
+
+    // f(count, columns...) once per matching chunk
+    template <typename... Ts, typename F>
+    void eachChunk(F f);
+
+    // f(components...) once per matching entity
+    template <typename... Ts, typename F>
+    void each(F f);
+
+    // f(entity, components...) once per matching entity, in storage order
+    template <typename... Ts, typename F>
+    void eachEntity(F f);
+
+    // eachChunk spread over the pool, f may only write inside the chunk it gets
+    template <typename... Ts, typename F>
+    void parallelEachChunk(WorkStealingPool& pool, F f);
+
+    size_t archetypeCount() const {
+        return archetypes.size();
+    }
+
+    size_t chunkCount() const;
+
+    // incremental reordering. planReorder sorts the entities of every archetype
+    // with T by key(const T&), reorderStep then walks at most maxSteps entries of
+    // the plan and swaps those entities onto their planned row. handles stay
+    // valid, entities created or destroyed meanwhile only make the order less
+    // exact until the next plan. returns the number of swaps.
+    template <typename T, typename Key>
+    void planReorder(Key key);
+    size_t reorderStep(size_t maxSteps);
+
+    bool reordering() const {
+        return !reorderPlans.empty();
+    }
+
+private:
+    struct Record
+    {
+        Archetype* archetype = nullptr;
+        uint32_t chunk = 0;
+        uint32_t row = 0;
+    };
+
+    struct ReorderPlan
+    {
+        Archetype* archetype = nullptr;
+        vector<Entity> order;
+        size_t next = 0;   // next entry of order
+        size_t placed = 0; // rows already in planned order
+    };
+
+    Archetype& findOrCreate(ComponentMask mask);
+    void moveEntity(Entity entity, Archetype& to);
+
+    SparseSet<Record> records;
+    deque<ReorderPlan> reorderPlans;
+
+    unordered_map<ComponentMask, unique_ptr<Archetype>> archetypeByMask;
+    vector<Archetype*> archetypes;
+};
+
+Archetype& ArchetypeWorld::findOrCreate(ComponentMask mask)
+{
+    auto found = archetypeByMask.find(mask);
+    if (found != archetypeByMask.end())
+        return *found->second;
+
+    auto archetype = make_unique<Archetype>(mask);
+    archetypes.push_back(archetype.get());
+
+    return *archetypeByMask.emplace(mask, move(archetype)).first->second;
+}
+
+template <typename... Ts>
+Entity ArchetypeWorld::create(const Ts&... components)
+{
+    Archetype& archetype = findOrCreate(MaskOf<Ts...>());
+
+    Entity entity = records.create();
+    auto [chunk, row] = archetype.push(entity);
+    *records.get(entity) = { &archetype, chunk, row };
+
+    Chunk& storage = *archetype.chunks[chunk];
+    ((archetype.column<Ts>(storage)[row] = components), ...);
+
+    return entity;
+}
+
+void ArchetypeWorld::destroy(Entity entity)
+{
+    Record* record = records.get(entity);
+    if (record == nullptr)
+        return;
+
+    Entity moved = record->archetype->removeRow(record->chunk, record->row);
+    if (moved != INVALID_ENTITY) {
+        Record& other = *records.get(moved);
+        other.chunk = record->chunk;
+        other.row = record->row;
+    }
+
+    records.destroy(entity);
+}
+
+void ArchetypeWorld::moveEntity(Entity entity, Archetype& to)
+{
+    const vector<ComponentInfo>& infos = ComponentInfos();
+
+    Record& record = *records.get(entity);
+    Archetype& from = *record.archetype;
+
+    auto [chunk, row] = to.push(entity);
+    Chunk& source = *from.chunks[record.chunk];
+    Chunk& target = *to.chunks[chunk];
+
+    // components both archetypes have are copied, a new one is written by the caller
+    for (int id : from.types) {
+        if (to.mask & (ComponentMask(1) << id)) {
+            size_t size = infos[id].size;
+            memcpy(to.column(target, id) + row * size, from.column(source, id) + record.row * size, size);
+        }
+    }
+
+    Entity moved = from.removeRow(record.chunk, record.row);
+    if (moved != INVALID_ENTITY) {
+        Record& other = *records.get(moved);
+        other.chunk = record.chunk;
+        other.row = record.row;
+    }
+
+    record = { &to, chunk, row };
+}
+
+template <typename T>
+void ArchetypeWorld::add(Entity entity, const T& component)
+{
+    Record* record = records.get(entity);
+    if (record == nullptr)
+        return;
+
+    ComponentMask mask = record->archetype->mask;
+    if ((mask & MaskOf<T>()) == 0)
+        moveEntity(entity, findOrCreate(mask | MaskOf<T>()));
+
+    *get<T>(entity) = component;
+}
+
+template <typename T>
+void ArchetypeWorld::remove(Entity entity)
+{
+    Record* record = records.get(entity);
+    if (record == nullptr)
+        return;
+
+    ComponentMask mask = record->archetype->mask;
+    if (mask & MaskOf<T>())
+        moveEntity(entity, findOrCreate(mask & ~MaskOf<T>()));
+}
+
+template <typename T>
+T* ArchetypeWorld::get(Entity entity)
+{
+    Record* record = records.get(entity);
+    if (record == nullptr || (record->archetype->mask & MaskOf<T>()) == 0)
+        return nullptr;
+
+    return record->archetype->column<T>(*record->archetype->chunks[record->chunk]) + record->row;
+}
+
+template <typename... Ts, typename F>
+void ArchetypeWorld::eachChunk(F f)
+{
+    ComponentMask required = MaskOf<Ts...>();
+
+    for (Archetype* archetype : archetypes) {
+        if ((archetype->mask & required) != required)
+            continue;
+
+        for (auto& chunk : archetype->chunks)
+            f(size_t(chunk->count), archetype->column<Ts>(*chunk)...);
+    }
+}
+
+template <typename... Ts, typename F>
+void ArchetypeWorld::each(F f)
+{
+    eachChunk<Ts...>([&](size_t count, Ts*... columns) {
+        for (size_t i = 0; i < count; ++i)
+            f(columns[i]...);
+    });
+}
+
+template <typename... Ts, typename F>
+void ArchetypeWorld::eachEntity(F f)
+{
+    ComponentMask required = MaskOf<Ts...>();
+
+    for (Archetype* archetype : archetypes) {
+        if ((archetype->mask & required) != required)
+            continue;
+
+        for (auto& chunk : archetype->chunks) {
+            Entity* entities = archetype->entities(*chunk);
+            for (uint32_t i = 0; i < chunk->count; ++i)
+                f(entities[i], archetype->column<Ts>(*chunk)[i]...);
+        }
+    }
+}
+
+template <typename... Ts, typename F>
+void ArchetypeWorld::parallelEachChunk(WorkStealingPool& pool, F f)
+{
+    ComponentMask required = MaskOf<Ts...>();
+    vector<pair<Archetype*, Chunk*>> matching;
+
+    for (Archetype* archetype : archetypes) {
+        if ((archetype->mask & required) != required)
+            continue;
+
+        for (auto& chunk : archetype->chunks)
+            matching.push_back({ archetype, chunk.get() });
+    }
+
+    // a few ranges per thread, so stealing can even out slow chunks
+    size_t grain = matching.size() / (pool.threadCount() * 4) + 1;
+
+    pool.parallelFor(matching.size(), grain, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto [archetype, chunk] = matching[i];
+            f(size_t(chunk->count), archetype->column<Ts>(*chunk)...);
+        }
+    });
+}
+
+size_t ArchetypeWorld::chunkCount() const
+{
+    size_t total = 0;
+
+    for (Archetype* archetype : archetypes)
+        total += archetype->chunks.size();
+
+    return total;
+}
+
+template <typename T, typename Key>
+void ArchetypeWorld::planReorder(Key key)
+{
+    ComponentMask required = MaskOf<T>();
+    vector<pair<uint64_t, Entity>> keyed;
+
+    reorderPlans.clear();
+
+    for (Archetype* archetype : archetypes) {
+        if ((archetype->mask & required) == 0)
+            continue;
+
+        keyed.clear();
+        for (auto& chunk : archetype->chunks) {
+            Entity* entities = archetype->entities(*chunk);
+            T* column = archetype->column<T>(*chunk);
+
+            for (uint32_t i = 0; i < chunk->count; ++i)
+                keyed.push_back({ uint64_t(key(column[i])), entities[i] });
+        }
+
+        // stable, so entities with equal keys keep their rows and cost no swap
+        stable_sort(keyed.begin(), keyed.end(), [](const auto& a, const auto& b) {
+            return a.first < b.first;
+        });
+
+        ReorderPlan plan;
+        plan.archetype = archetype;
+        plan.order.reserve(keyed.size());
+        for (auto& entry : keyed)
+            plan.order.push_back(entry.second);
+
+        reorderPlans.push_back(move(plan));
+    }
+}
+
+size_t ArchetypeWorld::reorderStep(size_t maxSteps)
+{
+    size_t swaps = 0;
+
+    for (size_t step = 0; step < maxSteps && !reorderPlans.empty(); ++step) {
+        ReorderPlan& plan = reorderPlans.front();
+        Archetype& archetype = *plan.archetype;
+
+        if (plan.next == plan.order.size() || plan.placed >= archetype.rowCount()) {
+            reorderPlans.pop_front();
+            continue;
+        }
+
+        // destroyed or moved to another archetype since the plan was made
+        Entity entity = plan.order[plan.next++];
+        Record* record = records.get(entity);
+        if (record == nullptr || record->archetype != &archetype)
+            continue;
+
+        uint32_t chunk = static_cast<uint32_t>(plan.placed / archetype.capacity);
+        uint32_t row = static_cast<uint32_t>(plan.placed % archetype.capacity);
+        ++plan.placed;
+
+        if (record->chunk == chunk && record->row == row)
+            continue;
+
+        Entity other = archetype.entities(*archetype.chunks[chunk])[row];
+        archetype.swapRows(chunk, row, record->chunk, record->row);
+
+        Record& otherRecord = *records.get(other);
+        otherRecord.chunk = record->chunk;
+        otherRecord.row = record->row;
+        record->chunk = chunk;
+        record->row = row;
+
+        ++swaps;
+    }
+
+    return swaps;
+}
+
+
+// plain data components for the archetype world
+struct Position
+{
+    int x, y;
+};
+
+struct Velocity
+{
+    int dx, dy;
+};
+
+struct Brain
+{
+    int unitId;
+    int thinkTimer;
+};
+
+struct Sprite
+{
+    int unitId;
+    int frame;
+};
+
+// interleaves the bits of x and y, units close on the map get close codes
+uint32_t MortonCode(uint32_t x, uint32_t y)
+{
+    auto spread = [](uint32_t v) {
+        v &= 0xffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+
+    return spread(x) | (spread(y) << 1);
+}
+
+// a small set associative cache, 32KB of 64 byte lines in 8 ways with lru.
+// estimates the miss rate of an access pattern without hardware counters.
+class CacheModel
+{
+public:
+    // true on a hit
+    bool access(const void* address);
+
+    double missRate() const {
+        return accesses ? double(misses) / double(accesses) : 0.;
+    }
+
+private:
+    static const int LINE_BITS = 6;
+    static const int SETS = 64;
+    static const int WAYS = 8;
+
+    // every set is ordered most recently used first
+    array<uintptr_t, SETS * WAYS> lines{};
+    long long accesses = 0;
+    long long misses = 0;
+};
+
+bool CacheModel::access(const void* address)
+{
+    uintptr_t line = (reinterpret_cast<uintptr_t>(address) >> LINE_BITS) + 1;
+    uintptr_t* set = &lines[(line % SETS) * WAYS];
+
+    ++accesses;
+
+    int way = 0;
+    while (way < WAYS && set[way] != line)
+        ++way;
+
+    bool hit = way < WAYS;
+    if (!hit) {
+        ++misses;
+        way = WAYS - 1;
+    }
+
+    for (; way > 0; --way)
+        set[way] = set[way - 1];
+    set[0] = line;
+
+    return hit;
+}
+
+
+// systems declare the component types they read and write. a system depends on
+// every earlier one it conflicts with, the rest run side by side on the pool.
+// registration order settles every conflict, so a frame gives the same result
+// on any thread count as long as a system only writes inside its own chunks.
+class SystemScheduler
+{
+public:
+    using Run = function<void(ArchetypeWorld&, WorkStealingPool&)>;
+
+    SystemScheduler(ArchetypeWorld& world, WorkStealingPool& pool) : world(world), pool(pool) {}
+
+    void add(string_view name, ComponentMask reads, ComponentMask writes, Run run);
+
+    void runFrame();
+
+    // one line per system with the systems it waits for
+    void printGraph(ostream& out) const;
+
+private:
+    struct System
+    {
+        string name;
+        ComponentMask reads;
+        ComponentMask writes;
+        Run run;
+
+        vector<size_t> dependents;
+        vector<size_t> dependencies;
+        atomic<int> waitingFor = 0;
+    };
+
+    static bool conflicts(const System& a, const System& b) {
+        return (a.writes & (b.reads | b.writes)) != 0 || (b.writes & a.reads) != 0;
+    }
+
+    void buildGraph();
+    void launch(size_t index, atomic<int>& pending);
+
+    ArchetypeWorld& world;
+    WorkStealingPool& pool;
+
+    vector<unique_ptr<System>> systems;
+};
+
+void SystemScheduler::add(string_view name, ComponentMask reads, ComponentMask writes, Run run)
+{
+    auto system = make_unique<System>();
+    system->name = name;
+    system->reads = reads;
+    system->writes = writes;
+    system->run = move(run);
+
+    systems.push_back(move(system));
+}
+
+void SystemScheduler::buildGraph()
+{
+    for (auto& system : systems) {
+        system->dependents.clear();
+        system->dependencies.clear();
+    }
+
+    for (size_t later = 0; later < systems.size(); ++later) {
+        for (size_t earlier = 0; earlier < later; ++earlier) {
+            if (!conflicts(*systems[earlier], *systems[later]))
+                continue;
+
+            systems[earlier]->dependents.push_back(later);
+            systems[later]->dependencies.push_back(earlier);
+        }
+    }
+}
+
+void SystemScheduler::launch(size_t index, atomic<int>& pending)
+{
+    pool.submit([this, index, &pending] {
+        System& system = *systems[index];
+        system.run(world, pool);
+
+        for (size_t next : system.dependents) {
+            if (systems[next]->waitingFor.fetch_sub(1, memory_order_acq_rel) == 1)
+                launch(next, pending);
+        }
+    }, pending);
+}
+
+void SystemScheduler::runFrame()
+{
+    buildGraph();
+
+    // every system is one pending task, dependents are submitted by the last dependency
+    atomic<int> pending = static_cast<int>(systems.size());
+
+    for (auto& system : systems)
+        system->waitingFor.store(static_cast<int>(system->dependencies.size()), memory_order_relaxed);
+
+    for (size_t i = 0; i < systems.size(); ++i) {
+        if (systems[i]->dependencies.empty())
+            launch(i, pending);
+    }
+
+    pool.wait(pending);
+}
+
+void SystemScheduler::printGraph(ostream& out) const
+{
+    for (auto& system : systems) {
+        out << system->name << " after:";
+        for (size_t d : system->dependencies)
+            out << " " << systems[d]->name;
+        out << endl;
+    }
+}
+
+
+// physics step over positions and velocities kept as separate aligned arrays.
+// the kernel is picked at runtime from what the cpu and os support, the
+// scalar loop is the fallback and also finishes the tail of every simd kernel.
+#if defined(__x86_64__) || defined(_M_X64)
+#define PHYSICS_SIMD 1
+#endif
+
+#if defined(_MSC_VER)
+#define TARGET_ISA(isa)
+#elif defined(__clang__)
+#define TARGET_ISA(isa) __attribute__((target(isa)))
+#else
+// gcc fuses the multiply and add once fma is on, and avx512f turns it on
+#define TARGET_ISA(isa) __attribute__((target(isa), optimize("fp-contract=off")))
+#endif
+
+// the same guard for plain code, -march with fma would fuse it too.
+// clang takes #pragma clang fp contract(off) inside the function instead
+#if defined(__GNUC__) && !defined(__clang__)
+#define NO_FP_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define NO_FP_CONTRACT
+#endif
+
+struct AlignedDelete
+{
+    void operator()(float* p) const {
+        ::operator delete[](p, align_val_t(64));
+    }
+};
+
+using AlignedFloats = unique_ptr<float[], AlignedDelete>;
+
+AlignedFloats MakeAlignedFloats(size_t count)
+{
+    return AlignedFloats(static_cast<float*>(::operator new[](count * sizeof(float), align_val_t(64))));
+}
+
+struct PhysicsSoA
+{
+    explicit PhysicsSoA(size_t count)
+        : count(count), posX(MakeAlignedFloats(count)), posY(MakeAlignedFloats(count)),
+          velX(MakeAlignedFloats(count)), velY(MakeAlignedFloats(count)) {}
+
+    size_t count;
+    AlignedFloats posX, posY;
+    AlignedFloats velX, velY;
+};
+
+const float WORLD_MIN = 0.f;
+const float WORLD_MAX = 4096.f;
+
+// p += v * dt, clamped to the world. every kernel does a separate multiply and
+// add and the same max then min per lane, so they all give the same bits. that
+// holds only because contraction is off here and in the kernels: with fma
+// enabled the compiler would fuse p + v * dt into one rounding. this is the
+// scalar reference and the tail of every simd kernel.
+NO_FP_CONTRACT
+void IntegrateRange(PhysicsSoA& units, size_t begin, size_t end, float dt)
+{
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+    float* posX = units.posX.get();
+    float* posY = units.posY.get();
+    const float* velX = units.velX.get();
+    const float* velY = units.velY.get();
+
+    for (size_t i = begin; i < end; ++i) {
+        float x = posX[i] + velX[i] * dt;
+        float y = posY[i] + velY[i] * dt;
+
+        x = (x > WORLD_MIN) ? x : WORLD_MIN;
+        y = (y > WORLD_MIN) ? y : WORLD_MIN;
+        posX[i] = (x < WORLD_MAX) ? x : WORLD_MAX;
+        posY[i] = (y < WORLD_MAX) ? y : WORLD_MAX;
+    }
+}
+
+void IntegrateScalar(PhysicsSoA& units, float dt)
+{
+    IntegrateRange(units, 0, units.count, dt);
+}
+
+#ifdef PHYSICS_SIMD
+
+TARGET_ISA("sse2")
+void IntegrateSse2(PhysicsSoA& units, float dt)
+{
+    const __m128 step = _mm_set1_ps(dt);
+    const __m128 lo = _mm_set1_ps(WORLD_MIN);
+    const __m128 hi = _mm_set1_ps(WORLD_MAX);
+
+    size_t i = 0;
+    for (; i + 4 <= units.count; i += 4) {
+        __m128 x = _mm_add_ps(_mm_load_ps(&units.posX[i]), _mm_mul_ps(_mm_load_ps(&units.velX[i]), step));
+        __m128 y = _mm_add_ps(_mm_load_ps(&units.posY[i]), _mm_mul_ps(_mm_load_ps(&units.velY[i]), step));
+
+        _mm_store_ps(&units.posX[i], _mm_min_ps(_mm_max_ps(x, lo), hi));
+        _mm_store_ps(&units.posY[i], _mm_min_ps(_mm_max_ps(y, lo), hi));
+    }
+
+    IntegrateRange(units, i, units.count, dt);
+}
+
+TARGET_ISA("avx2")
+void IntegrateAvx2(PhysicsSoA& units, float dt)
+{
+    const __m256 step = _mm256_set1_ps(dt);
+    const __m256 lo = _mm256_set1_ps(WORLD_MIN);
+    const __m256 hi = _mm256_set1_ps(WORLD_MAX);
+
+    size_t i = 0;
+    for (; i + 8 <= units.count; i += 8) {
+        __m256 x = _mm256_add_ps(_mm256_load_ps(&units.posX[i]), _mm256_mul_ps(_mm256_load_ps(&units.velX[i]), step));
+        __m256 y = _mm256_add_ps(_mm256_load_ps(&units.posY[i]), _mm256_mul_ps(_mm256_load_ps(&units.velY[i]), step));
+
+        _mm256_store_ps(&units.posX[i], _mm256_min_ps(_mm256_max_ps(x, lo), hi));
+        _mm256_store_ps(&units.posY[i], _mm256_min_ps(_mm256_max_ps(y, lo), hi));
+    }
+
+    IntegrateRange(units, i, units.count, dt);
+}
+
+// gcc 12 warns about the undefined source operand inside its own avx512 headers
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+TARGET_ISA("avx512f")
+void IntegrateAvx512(PhysicsSoA& units, float dt)
+{
+    const __m512 step = _mm512_set1_ps(dt);
+    const __m512 lo = _mm512_set1_ps(WORLD_MIN);
+    const __m512 hi = _mm512_set1_ps(WORLD_MAX);
+
+    size_t i = 0;
+    for (; i + 16 <= units.count; i += 16) {
+        __m512 x = _mm512_add_ps(_mm512_load_ps(&units.posX[i]), _mm512_mul_ps(_mm512_load_ps(&units.velX[i]), step));
+        __m512 y = _mm512_add_ps(_mm512_load_ps(&units.posY[i]), _mm512_mul_ps(_mm512_load_ps(&units.velY[i]), step));
+
+        _mm512_store_ps(&units.posX[i], _mm512_min_ps(_mm512_max_ps(x, lo), hi));
+        _mm512_store_ps(&units.posY[i], _mm512_min_ps(_mm512_max_ps(y, lo), hi));
+    }
+
+    IntegrateRange(units, i, units.count, dt);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+struct CpuFeatures
+{
+    bool sse2 = false;
+    bool avx2 = false;
+    bool avx512 = false;
+};
+
+void Cpuid(uint32_t leaf, uint32_t subLeaf, uint32_t regs[4])
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuidex(info, static_cast<int>(leaf), static_cast<int>(subLeaf));
+    for (int i = 0; i < 4; ++i)
+        regs[i] = static_cast<uint32_t>(info[i]);
+#else
+    __cpuid_count(leaf, subLeaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// which register states the os saves on a context switch
+uint64_t ReadXcr0()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t lo, hi;
+    asm volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (uint64_t(hi) << 32) | lo;
+#endif
+}
+
+CpuFeatures DetectCpuFeatures()
+{
+    CpuFeatures features;
+    uint32_t regs[4];
+
+    Cpuid(0, 0, regs);
+    uint32_t maxLeaf = regs[0];
+
+    Cpuid(1, 0, regs);
+    features.sse2 = (regs[3] & (1u << 26)) != 0;
+
+    bool osxsave = (regs[2] & (1u << 27)) != 0;
+    if (!osxsave || maxLeaf < 7)
+        return features;
+
+    uint64_t xcr0 = ReadXcr0();
+    bool avxState = (xcr0 & 0x6) == 0x6;        // xmm, ymm
+    bool avx512State = (xcr0 & 0xE6) == 0xE6;   // and opmask, upper zmm
+
+    Cpuid(7, 0, regs);
+    features.avx2 = avxState && (regs[1] & (1u << 5)) != 0;
+    features.avx512 = avx512State && (regs[1] & (1u << 16)) != 0;
+
+    return features;
+}
+
+#endif // PHYSICS_SIMD
+
+using IntegrateKernel = void (*)(PhysicsSoA& units, float dt);
+
+struct PhysicsKernel
+{
+    string_view name;
+    IntegrateKernel integrate;
+};
+
+// scalar first, the widest last
+const vector<PhysicsKernel>& SupportedPhysicsKernels()
+{
+    static const vector<PhysicsKernel> kernels = [] {
+        vector<PhysicsKernel> supported = { { "scalar", IntegrateScalar } };
+
+#ifdef PHYSICS_SIMD
+        CpuFeatures features = DetectCpuFeatures();
+        if (features.sse2)
+            supported.push_back({ "sse2", IntegrateSse2 });
+        if (features.avx2)
+            supported.push_back({ "avx2", IntegrateAvx2 });
+        if (features.avx512)
+            supported.push_back({ "avx512", IntegrateAvx512 });
+#endif
+
+        return supported;
+    }();
+
+    return kernels;
+}
+
+const PhysicsKernel& SelectPhysicsKernel()
+{
+    return SupportedPhysicsKernels().back();
+}
+
+void FillPhysics(PhysicsSoA& units)
+{
+    uint32_t seed = 11;
+
+    for (size_t i = 0; i < units.count; ++i) {
+        seed = seed * 1664525u + 1013904223u;
+        units.posX[i] = float(seed % 4096);
+        units.posY[i] = float((seed >> 12) % 4096);
+        units.velX[i] = float(int(seed >> 24) - 128) * 0.37f;
+        units.velY[i] = float(int((seed >> 4) & 255) - 128) * 0.21f;
+    }
+}
+
+
+// one description of a unit's fields, stored as aos, soa or aosoa blocks of
+// Width units. systems go through get and each, so they do not change with it.
+// the arrays come from the default memory resource at construction.
+enum class Layout {
+    AoS,
+    SoA,
+    AoSoA
+};
+
+// a field names a column and gives its type
+template <typename T>
+struct Field
+{
+    using type = T;
+};
+
+template <typename F, typename... Fields>
+constexpr size_t FieldIndex()
+{
+    constexpr bool matches[] = { is_same_v<F, Fields>... };
+
+    for (size_t i = 0; i < sizeof...(Fields); ++i) {
+        if (matches[i])
+            return i;
+    }
+
+    return sizeof...(Fields);
+}
+
+template <typename Fn, typename... Ts>
+void EachColumns(size_t count, Fn& f, Ts*... columns)
+{
+    for (size_t i = 0; i < count; ++i)
+        f(columns[i]...);
+}
+
+template <Layout L, size_t Width, typename... Fields>
+class LayoutStorage;
+
+// a struct per unit
+template <size_t Width, typename... Fields>
+class LayoutStorage<Layout::AoS, Width, Fields...>
+{
+public:
+    void resize(size_t count) {
+        rows.resize(count);
+    }
+
+    size_t size() const {
+        return rows.size();
+    }
+
+    template <typename F>
+    typename F::type& get(size_t i) {
+        return std::get<FieldIndex<F, Fields...>()>(rows[i]);
+    }
+
+    template <typename... Fs, typename Fn>
+    void each(Fn f) {
+        for (auto& row : rows)
+            f(std::get<FieldIndex<Fs, Fields...>()>(row)...);
+    }
+
+private:
+    pmr::vector<tuple<typename Fields::type...>> rows;
+};
+
+// an array per field
+template <size_t Width, typename... Fields>
+class LayoutStorage<Layout::SoA, Width, Fields...>
+{
+public:
+    void resize(size_t count) {
+        apply([count](auto&... column) { (column.resize(count), ...); }, columns);
+        unitCount = count;
+    }
+
+    size_t size() const {
+        return unitCount;
+    }
+
+    template <typename F>
+    typename F::type& get(size_t i) {
+        return std::get<FieldIndex<F, Fields...>()>(columns)[i];
+    }
+
+    template <typename... Fs, typename Fn>
+    void each(Fn f) {
+        EachColumns(unitCount, f, std::get<FieldIndex<Fs, Fields...>()>(columns).data()...);
+    }
+
+private:
+    tuple<pmr::vector<typename Fields::type>...> columns;
+    size_t unitCount = 0;
+};
+
+// blocks of Width units, an array per field inside a block
+template <size_t Width, typename... Fields>
+class LayoutStorage<Layout::AoSoA, Width, Fields...>
+{
+    static_assert(Width >= 1 && (Width & (Width - 1)) == 0, "block width must be a power of two");
+
+public:
+    void resize(size_t count) {
+        blocks.resize((count + Width - 1) / Width);
+        unitCount = count;
+    }
+
+    size_t size() const {
+        return unitCount;
+    }
+
+    template <typename F>
+    typename F::type& get(size_t i) {
+        return std::get<FieldIndex<F, Fields...>()>(blocks[i / Width])[i % Width];
+    }
+
+    template <typename... Fs, typename Fn>
+    void each(Fn f) {
+        size_t fullBlocks = unitCount / Width;
+
+        // a constant trip count for full blocks, the compiler can unroll or vectorize it
+        for (size_t b = 0; b < fullBlocks; ++b)
+            EachColumns(Width, f, std::get<FieldIndex<Fs, Fields...>()>(blocks[b]).data()...);
+
+        if (unitCount % Width != 0)
+            EachColumns(unitCount % Width, f, std::get<FieldIndex<Fs, Fields...>()>(blocks[fullBlocks]).data()...);
+    }
+
+private:
+    using Block = tuple<array<typename Fields::type, Width>...>;
+
+    pmr::vector<Block> blocks;
+    size_t unitCount = 0;
+};
+
+
+// the unit description the layout tests and benchmarks use
+struct PosX : Field<float> {};
+struct PosY : Field<float> {};
+struct VelX : Field<float> {};
+struct VelY : Field<float> {};
+struct Health : Field<float> {};
+struct Cooldown : Field<float> {};
+struct UnitId : Field<int> {};
+struct Team : Field<int> {};
+
+template <Layout L, size_t Width = 1>
+using UnitLayout = LayoutStorage<L, Width, PosX, PosY, VelX, VelY, Health, Cooldown, UnitId, Team>;
+
+template <typename Storage>
+void FillLayout(Storage& units, size_t count)
+{
+    units.resize(count);
+
+    for (size_t i = 0; i < count; ++i) {
+        units.template get<PosX>(i) = float(i % 4096);
+        units.template get<PosY>(i) = float((i * 7) % 4096);
+        units.template get<VelX>(i) = float(int(i % 61) - 30);
+        units.template get<VelY>(i) = float(int(i % 37) - 18);
+        units.template get<Health>(i) = 100.f;
+        units.template get<Cooldown>(i) = float(i % 5);
+        units.template get<UnitId>(i) = int(i) + 1;
+        units.template get<Team>(i) = int(i % 4);
+    }
+}
+
+// the access patterns of the layout sweep
+template <typename Storage>
+void LayoutIntegrate(Storage& units)
+{
+    units.template each<PosX, PosY, VelX, VelY>([](float& x, float& y, float& vx, float& vy) {
+        x += vx * 0.016f;
+        y += vy * 0.016f;
+    });
+}
+
+template <typename Storage>
+void LayoutOneField(Storage& units)
+{
+    // wraps around instead of decaying, denormals would swamp the timing
+    units.template each<Health>([](float& health) { health = (health > 1.f) ? health - 0.5f : 100.f; });
+}
+
+template <typename Storage>
+void LayoutAllFields(Storage& units)
+{
+    units.template each<PosX, PosY, VelX, VelY, Health, Cooldown, UnitId, Team>(
+        [](float& x, float& y, float& vx, float& vy, float& health, float& cooldown, int& id, int& team) {
+            x += vx * 0.016f;
+            y += vy * 0.016f;
+            cooldown = (cooldown > 0.f) ? cooldown - 0.016f : 0.f;
+            health += (team == (id & 3)) ? 0.1f : 0.f;
+        });
+}
+
+template <typename Storage>
+float LayoutGather(Storage& units, const vector<uint32_t>& order)
+{
+    float total = 0.f;
+
+    for (uint32_t i : order)
+        total += units.template get<PosX>(i) + units.template get<PosY>(i);
+
+    return total;
+}
+
+
+const int MAX_UNIT_COUNT = 10000;
+const int MAX_LOOP_COUNT = 1000;
+
+void TestDataLocality1()
+{
+    World world;
+    Graphics graphics;
+
+    vector<unique_ptr<Unit>> units;
+
+    for (int i = 0; i < MAX_UNIT_COUNT; ++i)
+        units.push_back(make_unique<Unit>());
+
+    int loopCount = 0;
+    PerfSample counted;
+    PerfScope scope(SharedPerfCounters(), counted);
+    steady_clock::time_point begin = steady_clock::now();
+
+    while (loopCount < MAX_LOOP_COUNT) {
+        for (auto& unit : units)
+            unit->update(world, graphics);
+
+        ++loopCount;
+    }
+
+    steady_clock::time_point end = steady_clock::now();
+    scope.stop();
+    nanoseconds elapsed = end - begin;
+    milliseconds elapsed2 = duration_cast<milliseconds>(elapsed);
+
+    cout << "test_1 elapsed time: " << elapsed << ", " << elapsed2 << endl;
+    PrintPerf(cout, "test_1 per unit-frame", counted, double(MAX_UNIT_COUNT) * MAX_LOOP_COUNT);
+}
+
+void TestDataLocality2()
+{
+    World world;
+    Graphics graphics;
+
+    vector<Unit> units;
+
+    for (int i = 0; i < MAX_UNIT_COUNT; ++i)
+        units.push_back(Unit());
+
+    int loopCount = 0;
+    PerfSample counted;
+    PerfScope scope(SharedPerfCounters(), counted);
+    steady_clock::time_point begin = steady_clock::now();
+
+    while (loopCount < MAX_LOOP_COUNT) {
+        for (auto& unit : units)
+            unit.update(world, graphics);
+
+        ++loopCount;
+    }
+
+    steady_clock::time_point end = steady_clock::now();
+    scope.stop();
+    nanoseconds elapsed = end - begin;
+    milliseconds elapsed2 = duration_cast<milliseconds>(elapsed);
+
+    cout << "test_2 elapsed time: " << elapsed << ", " << elapsed2 << endl;
+    PrintPerf(cout, "test_2 per unit-frame", counted, double(MAX_UNIT_COUNT) * MAX_LOOP_COUNT);
+}
+
+void TestDataLocality3()
+{
+    World world;
+    Graphics graphics;
+
+    vector<unique_ptr<AIComponent>> aiComps;
+    vector<unique_ptr<PhysicsComponent>> physicsComps;
+    vector<unique_ptr<RenderComponent>> renderComps;
+
+    for (int i = 1; i <= MAX_UNIT_COUNT; ++i) {
+        aiComps.push_back(make_unique<AIComponent>(i));
+        physicsComps.push_back(make_unique<PhysicsComponent>(i));
+        renderComps.push_back(make_unique<RenderComponent>(i));
+    }
+
+    int loopCount = 0;
+    PerfSample counted;
+    PerfScope scope(SharedPerfCounters(), counted);
+    steady_clock::time_point begin = steady_clock::now();
+
+    while (loopCount < MAX_LOOP_COUNT) {
+        for (auto& ac : aiComps)
+            ac->update(world);
+
+        for (auto& pc : physicsComps)
+            pc->update(world);
+
+        for (auto& rc : renderComps)
+            rc->render(graphics);
+
+        ++loopCount;
+    }
+
+    steady_clock::time_point end = steady_clock::now();
+    scope.stop();
+    nanoseconds elapsed = end - begin;
+    milliseconds elapsed2 = duration_cast<milliseconds>(elapsed);
+
+    cout << "test_3 elapsed time: " << elapsed << ", " << elapsed2 << endl;
+    PrintPerf(cout, "test_3 per unit-frame", counted, double(MAX_UNIT_COUNT) * MAX_LOOP_COUNT);
+}
+
+void TestDataLocality4()
+{
+    World world;
+    Graphics graphics;
+
+    vector<AIComponent> aiComps;
+    vector<PhysicsComponent> physicsComps;
+    vector<RenderComponent> renderComps;
+
+    for (int i = 1; i <= MAX_UNIT_COUNT; ++i) {
+        aiComps.push_back(AIComponent(i));
+        physicsComps.push_back(PhysicsComponent(i));
+        renderComps.push_back(RenderComponent(i));
+    }
+
+    int loopCount = 0;
+    PerfSample counted;
+    PerfScope scope(SharedPerfCounters(), counted);
+    steady_clock::time_point begin = steady_clock::now();
+
+    while (loopCount < MAX_LOOP_COUNT) {
         for (auto& ac : aiComps)
             ac.update(world);
 
-        for (auto& pc : physicsComps)
-            pc.update(world);
+        for (auto& pc : physicsComps)
+            pc.update(world);
+
+        for (auto& rc : renderComps)
+            rc.render(graphics);
+
+        ++loopCount;
+    }
+
+    steady_clock::time_point end = steady_clock::now();
+    scope.stop();
+    nanoseconds elapsed = end - begin;
+    milliseconds elapsed2 = duration_cast<milliseconds>(elapsed);
+
+    cout << "test_4 elapsed time: " << elapsed << ", " << elapsed2 << endl;
+    PrintPerf(cout, "test_4 per unit-frame", counted, double(MAX_UNIT_COUNT) * MAX_LOOP_COUNT);
+}
+
+void TestDataLocality5()
+{
+    World world;
+    Graphics graphics;
+
+    AIComponent aiComps[MAX_UNIT_COUNT];
+    PhysicsComponent physicsComps[MAX_UNIT_COUNT];
+    RenderComponent renderComps[MAX_UNIT_COUNT];
+
+    for (int i = 0; i < MAX_UNIT_COUNT; ++i) {
+        aiComps[i].setUnitId(i + 1);
+        physicsComps[i].setUnitId(i + 1);
+        renderComps[i].setUnitId(i + 1);
+    }
+
+    int loopCount = 0;
+    PerfSample counted;
+    PerfScope scope(SharedPerfCounters(), counted);
+    steady_clock::time_point begin = steady_clock::now();
+
+    while (loopCount < MAX_LOOP_COUNT) {
+        for (int i = 0; i < MAX_UNIT_COUNT; ++i)
+            aiComps[i].update(world);
+
+        for (int i = 0; i < MAX_UNIT_COUNT; ++i)
+            physicsComps[i].update(world);
+
+        for (int i = 0; i < MAX_UNIT_COUNT; ++i)
+            renderComps[i].render(graphics);
+
+        ++loopCount;
+    }
+
+    steady_clock::time_point end = steady_clock::now();
+    scope.stop();
+    nanoseconds elapsed = end - begin;
+    milliseconds elapsed2 = duration_cast<milliseconds>(elapsed);
+
+    cout << "test_5 elapsed time: " << elapsed << ", " << elapsed2 << endl;
+    PrintPerf(cout, "test_5 per unit-frame", counted, double(MAX_UNIT_COUNT) * MAX_LOOP_COUNT);
+}
+
+const int ARENA_FRAME_COUNT = 100;
+
+// a level's units come from the level arena, per frame scratch from the frame
+// arena. the first level grows the arenas, after that loading a level and
+// running its frames should not touch the heap at all.
+void TestArenaFrames()
+{
+    World world;
+    Graphics graphics;
+
+    LinearArena levelArena(1024 * 1024);
+    LinearArena frameArena(16 * 1024);
+    AllocationCounter counter;
+
+    for (int level = 1; level <= 3; ++level) {
+        counter.take();
+
+        {
+            pmr::vector<Unit> units(&levelArena);
+            units.reserve(MAX_UNIT_COUNT);
+
+            for (int i = 0; i < MAX_UNIT_COUNT; ++i)
+                units.emplace_back(&levelArena);
+
+            cout << "level " << level << " load heap allocations: " << counter.take()
+                 << ", level arena used: " << levelArena.used() << ", reserved: " << levelArena.reserved() << " bytes" << endl;
+
+            long long steadyAllocations = 0;
+
+            for (int frame = 1; frame <= ARENA_FRAME_COUNT; ++frame) {
+                size_t frameBytes = 0;
+                size_t frameReserved = 0;
+
+                {
+                    pmr::vector<int> visible(&frameArena);
+                    pmr::string message("frame ", &frameArena);
+
+                    char number[16];
+                    message.append(number, to_chars(number, number + sizeof(number), frame).ptr);
+
+                    for (auto& unit : units) {
+                        unit.update(world, graphics);
+                        if (unit.posX >= 0 && unit.posX < 1920)
+                            visible.push_back(unit.id);
+                    }
+
+                    units[visible.size() % units.size()].sendMessage(message);
+                    frameBytes = frameArena.used();
+                    frameReserved = frameArena.reserved();
+                }
+
+                // a reset after an overflow grows the arena, that counts for this frame
+                frameArena.reset();
+
+                long long allocations = counter.take();
+                if (frame == 1) {
+                    cout << "level " << level << " frame 1 heap allocations: " << allocations
+                         << ", frame arena used: " << frameBytes << ", reserved: " << frameReserved << " bytes" << endl;
+                }
+                else {
+                    steadyAllocations += allocations;
+                }
+            }
+
+            cout << "level " << level << " frames 2-" << ARENA_FRAME_COUNT << " heap allocations: " << steadyAllocations << endl;
+        }
+
+        levelArena.reset();
+    }
+}
+
+const int POOLED_UNIT_COUNT = 10000;
+const int POOLED_CHURN_PER_FRAME = 100;
+
+// spawned units live for a while, every frame some die and as many spawn.
+// they outlive a frame, so a frame arena does not fit. from the pooled
+// resource their freed blocks are handed out again instead of going back to
+// the heap, after the warm up frames spawning makes no heap allocation.
+void TestPooledUnits()
+{
+    World world;
+    Graphics graphics;
+
+    PooledResource pool;
+    AllocationCounter counter;
+
+    for (pmr::memory_resource* resource : { pmr::new_delete_resource(), static_cast<pmr::memory_resource*>(&pool) }) {
+        string_view name = (resource == &pool) ? "pooled" : "new_delete";
+
+        {
+            vector<optional<Unit>> units(POOLED_UNIT_COUNT);
+            for (auto& unit : units)
+                unit.emplace(resource);
+
+            size_t liveBlocks = pool.live();
+            mt19937 random(11);
+            long long steadyAllocations = 0;
+
+            counter.take();
+            steady_clock::time_point begin = steady_clock::now();
+
+            for (int frame = 1; frame <= ARENA_FRAME_COUNT; ++frame) {
+                for (int i = 0; i < POOLED_CHURN_PER_FRAME; ++i)
+                    units[random() % units.size()].emplace(resource);
+
+                for (auto& unit : units)
+                    unit->update(world, graphics);
+
+                long long allocations = counter.take();
+                if (frame > 1)
+                    steadyAllocations += allocations;
+            }
+
+            nanoseconds elapsed = steady_clock::now() - begin;
+
+            cout << name << " units: " << POOLED_UNIT_COUNT << ", churn per frame: " << POOLED_CHURN_PER_FRAME
+                 << ", frames 2-" << ARENA_FRAME_COUNT << " heap allocations: " << steadyAllocations
+                 << ", frame: " << duration_cast<microseconds>(elapsed / ARENA_FRAME_COUNT).count() << "us";
+            if (resource == &pool)
+                cout << ", pool live blocks: " << liveBlocks;
+            cout << endl;
+        }
+    }
+
+    // every unit gave its blocks back
+    cout << "pool live blocks after the units are gone: " << pool.live() << endl;
+}
+
+const int MAX_ECS_UNIT_COUNT = 1000000;
+const int MAX_ECS_FRAME_COUNT = 100;
+
+// the same three passes over an archetype world, each pass reads only its columns
+void TestArchetypeWorld()
+{
+    ArchetypeWorld world;
+    vector<Entity> entities;
+    entities.reserve(MAX_ECS_UNIT_COUNT);
+
+    // every 8th unit is a prop without brain and velocity
+    for (int i = 1; i <= MAX_ECS_UNIT_COUNT; ++i) {
+        if (i % 8 == 0)
+            entities.push_back(world.create(Position{ 100, 130 }, Sprite{ i, 0 }));
+        else
+            entities.push_back(world.create(Position{ 100, 130 }, Velocity{ 20, 0 }, Brain{ i, i % 30 }, Sprite{ i, 0 }));
+    }
+
+    nanoseconds aiTime = 0ns, physicsTime = 0ns, renderTime = 0ns;
+    long long visible = 0;
+
+    for (int frame = 0; frame < MAX_ECS_FRAME_COUNT; ++frame) {
+        steady_clock::time_point begin = steady_clock::now();
+
+        world.each<Brain, Velocity>([](Brain& brain, Velocity& velocity) {
+            if (--brain.thinkTimer <= 0) {
+                brain.thinkTimer = 30;
+                velocity.dx = -velocity.dx;
+            }
+        });
+
+        steady_clock::time_point aiEnd = steady_clock::now();
+
+        // a whole chunk at a time, the compiler can vectorize this loop
+        world.eachChunk<Position, Velocity>([](size_t count, Position* position, Velocity* velocity) {
+            for (size_t i = 0; i < count; ++i) {
+                position[i].x += velocity[i].dx;
+                position[i].y += velocity[i].dy;
+            }
+        });
+
+        steady_clock::time_point physicsEnd = steady_clock::now();
+
+        world.each<Position, Sprite>([&](Position& position, Sprite& sprite) {
+            sprite.frame = (position.x >> 4) & 7;
+            visible += (position.x >= 0 && position.x < 1920) ? 1 : 0;
+        });
+
+        steady_clock::time_point renderEnd = steady_clock::now();
+
+        aiTime += aiEnd - begin;
+        physicsTime += physicsEnd - aiEnd;
+        renderTime += renderEnd - physicsEnd;
+    }
+
+    cout << "test_ecs archetypes: " << world.archetypeCount() << ", chunks: " << world.chunkCount()
+         << ", visible: " << visible << endl;
+    cout << "test_ecs per frame ai: " << duration_cast<microseconds>(aiTime / MAX_ECS_FRAME_COUNT)
+         << ", physics: " << duration_cast<microseconds>(physicsTime / MAX_ECS_FRAME_COUNT)
+         << ", render: " << duration_cast<microseconds>(renderTime / MAX_ECS_FRAME_COUNT) << endl;
+
+    // stun every 10th unit, its brain comes back afterwards
+    const int STRIDE = 10;
+    int moveCount = 0;
+    steady_clock::time_point begin = steady_clock::now();
+
+    for (size_t i = 0; i < entities.size(); i += STRIDE) {
+        if (world.get<Brain>(entities[i]) != nullptr) {
+            world.remove<Brain>(entities[i]);
+            ++moveCount;
+        }
+    }
+
+    for (size_t i = 0; i < entities.size(); i += STRIDE) {
+        if (world.get<Velocity>(entities[i]) != nullptr) {
+            world.add(entities[i], Brain{ int(i) + 1, 30 });
+            ++moveCount;
+        }
+    }
 
-        for (auto& rc : renderComps)
-            rc.render(graphics);
+    nanoseconds elapsed = steady_clock::now() - begin;
 
-        ++loopCount;
+    cout << "test_ecs archetype moves: " << moveCount << ", archetypes: " << world.archetypeCount()
+         << ", elapsed time: " << duration_cast<milliseconds>(elapsed) << endl;
+}
+
+const int CHURN_PER_SECOND = 100000;
+const int CHURN_FRAME_RATE = 60;
+
+// one frame of churn: despawns random live units and spawns as many new ones.
+// the despawned handles go to stale, they must never find a unit again.
+int ChurnFrame(ArchetypeWorld& world, vector<Entity>& live, vector<Entity>& stale, mt19937& random, int count)
+{
+    for (int i = 0; i < count && !live.empty(); ++i) {
+        size_t victim = random() % live.size();
+        world.destroy(live[victim]);
+        stale.push_back(live[victim]);
+        live[victim] = live.back();
+        live.pop_back();
     }
 
-    steady_clock::time_point end = steady_clock::now();
-    nanoseconds elapsed = end - begin;
-    milliseconds elapsed2 = duration_cast<milliseconds>(elapsed);
+    for (int i = 0; i < count; ++i) {
+        int unitId = static_cast<int>(random() & 0xffff);
+        live.push_back(world.create(Position{ 100, 130 }, Velocity{ 20, 0 }, Brain{ unitId, 30 }, Sprite{ unitId, 0 }));
+    }
 
-    cout << "test_4 elapsed time: " << elapsed << ", " << elapsed2 << endl;
+    return count;
 }
 
-void TestDataLocality5()
+// 100k spawns and despawns per second at 60 fps, a stale handle never
+// reaches the unit that reuses its slot
+void TestHandleChurn(int unitCount, int seconds)
+{
+    ArchetypeWorld world;
+    vector<Entity> live, stale;
+    mt19937 random(7);
+
+    for (int i = 0; i < unitCount; ++i)
+        live.push_back(world.create(Position{ 100, 130 }, Velocity{ 20, 0 }, Brain{ i, 30 }, Sprite{ i, 0 }));
+
+    const int perFrame = CHURN_PER_SECOND / CHURN_FRAME_RATE;
+    long long churned = 0;
+    nanoseconds worst = 0ns;
+    steady_clock::time_point begin = steady_clock::now();
+
+    for (int frame = 0; frame < seconds * CHURN_FRAME_RATE; ++frame) {
+        steady_clock::time_point frameBegin = steady_clock::now();
+        churned += ChurnFrame(world, live, stale, random, perFrame);
+        worst = max<nanoseconds>(worst, steady_clock::now() - frameBegin);
+    }
+
+    nanoseconds elapsed = steady_clock::now() - begin;
+
+    int staleHits = 0;
+    for (Entity entity : stale)
+        staleHits += (world.contains(entity) || world.get<Position>(entity) != nullptr) ? 1 : 0;
+
+    cout << "test_churn units: " << world.entityCount() << ", churned: " << churned
+         << ", per frame: " << duration_cast<microseconds>(elapsed / (seconds * CHURN_FRAME_RATE))
+         << ", worst frame: " << duration_cast<microseconds>(worst) << endl;
+    cout << "test_churn stale handles: " << stale.size() << ", still finding a unit: " << staleHits
+         << ", e.g. " << stale.front() << " -> " << (world.contains(stale.front()) ? "found" : "none") << endl;
+}
+
+const int MAP_SIZE = 4096;
+const int CELL_SHIFT = 6;
+const int CELLS_PER_SIDE = MAP_SIZE >> CELL_SHIFT;
+const int DAY_HOURS = 24;
+const int FRAMES_PER_HOUR = 300;
+const size_t REORDER_STEPS_PER_FRAME = 1024;
+
+uint32_t CellMorton(const Position& position)
+{
+    return MortonCode(uint32_t(position.x) >> CELL_SHIFT, uint32_t(position.y) >> CELL_SHIFT);
+}
+
+void SpawnWanderer(ArchetypeWorld& world, vector<Entity>& live, mt19937& random, int unitId)
+{
+    Position position{ int(random() % MAP_SIZE), int(random() % MAP_SIZE) };
+    Velocity velocity{ int(random() % 5) - 2, int(random() % 5) - 2 };
+
+    live.push_back(world.create(position, velocity, Brain{ unitId, 30 }, Sprite{ unitId, 0 }));
+}
+
+void BuildCells(ArchetypeWorld& world, vector<vector<Entity>>& cells)
+{
+    cells.assign(CELLS_PER_SIDE * CELLS_PER_SIDE, vector<Entity>());
+
+    world.eachEntity<Position>([&](Entity entity, Position& position) {
+        cells[(position.y >> CELL_SHIFT) * CELLS_PER_SIDE + (position.x >> CELL_SHIFT)].push_back(entity);
+    });
+}
+
+// every unit looks at the units of its own cell, in storage order. the cell
+// lists are in storage order too, so sorted storage reads neighboring rows.
+long long NeighborPass(ArchetypeWorld& world, const vector<vector<Entity>>& cells, CacheModel* cache)
+{
+    long long close = 0;
+
+    world.each<Position>([&](Position& position) {
+        for (Entity other : cells[(position.y >> CELL_SHIFT) * CELLS_PER_SIDE + (position.x >> CELL_SHIFT)]) {
+            const Position* neighbor = world.get<Position>(other);
+            if (cache)
+                cache->access(neighbor);
+            close += (abs(neighbor->x - position.x) + abs(neighbor->y - position.y) < 16) ? 1 : 0;
+        }
+    });
+
+    return close;
+}
+
+void WanderFrame(ArchetypeWorld& world)
+{
+    world.eachChunk<Position, Velocity>([](size_t count, Position* position, Velocity* velocity) {
+        for (size_t i = 0; i < count; ++i) {
+            position[i].x = (position[i].x + velocity[i].dx) & (MAP_SIZE - 1);
+            position[i].y = (position[i].y + velocity[i].dy) & (MAP_SIZE - 1);
+        }
+    });
+}
+
+// one simulated day of units wandering the map, dying and respawning somewhere
+// else. both worlds start sorted by cell, only the second one keeps reordering
+// a bounded number of entities per frame. each hour reports the estimated miss
+// rate and time of a neighbor pass and the time of a frame.
+void TestChurnDay(int unitCount)
+{
+    ArchetypeWorld drifting, compacted;
+    ArchetypeWorld* worlds[] = { &drifting, &compacted };
+    vector<Entity> live[2];
+
+    for (int w = 0; w < 2; ++w) {
+        mt19937 random(11);
+        for (int i = 0; i < unitCount; ++i)
+            SpawnWanderer(*worlds[w], live[w], random, i);
+
+        worlds[w]->planReorder<Position>(CellMorton);
+        while (worlds[w]->reordering())
+            worlds[w]->reorderStep(SIZE_MAX);
+    }
+
+    const int churnPerFrame = max(1, unitCount / 1000);
+    mt19937 random[2] = { mt19937(5), mt19937(5) };
+    vector<vector<Entity>> cells;
+    size_t swaps = 0;
+    long long closePairs = 0;
+
+    // the table below switches to fixed notation, restored at the end
+    ios_base::fmtflags flags = cout.flags();
+    streamsize precision = cout.precision();
+
+    cout << "hour  drift miss  neighbor    frame   | compact miss  neighbor    frame" << endl;
+
+    for (int hour = 1; hour <= DAY_HOURS; ++hour) {
+        nanoseconds frameTime[2] = { 0ns, 0ns };
+
+        for (int frame = 0; frame < FRAMES_PER_HOUR; ++frame) {
+            for (int w = 0; w < 2; ++w) {
+                ArchetypeWorld& world = *worlds[w];
+                steady_clock::time_point begin = steady_clock::now();
+
+                for (int i = 0; i < churnPerFrame; ++i) {
+                    size_t victim = random[w]() % live[w].size();
+                    world.destroy(live[w][victim]);
+                    live[w][victim] = live[w].back();
+                    live[w].pop_back();
+                    SpawnWanderer(world, live[w], random[w], i);
+                }
+
+                WanderFrame(world);
+
+                if (w == 1) {
+                    if (!world.reordering())
+                        world.planReorder<Position>(CellMorton);
+                    swaps += world.reorderStep(REORDER_STEPS_PER_FRAME);
+                }
+
+                frameTime[w] += steady_clock::now() - begin;
+            }
+        }
+
+        cout << (hour < 10 ? " " : "") << hour << "  ";
+
+        for (int w = 0; w < 2; ++w) {
+            BuildCells(*worlds[w], cells);
+
+            CacheModel cache;
+            NeighborPass(*worlds[w], cells, &cache);
+
+            steady_clock::time_point begin = steady_clock::now();
+            closePairs += NeighborPass(*worlds[w], cells, nullptr);
+            nanoseconds elapsed = steady_clock::now() - begin;
+
+            cout << (w ? " | " : " ") << fixed << setprecision(1) << setw(10) << cache.missRate() * 100 << "%"
+                 << setw(10) << duration_cast<microseconds>(elapsed).count() << "us"
+                 << setw(7) << duration_cast<microseconds>(frameTime[w] / FRAMES_PER_HOUR).count() << "us";
+        }
+
+        cout << endl;
+    }
+
+    cout.flags(flags);
+    cout.precision(precision);
+
+    cout << "test_day units: " << unitCount << ", compactor swaps: " << swaps
+         << ", budget per frame: " << REORDER_STEPS_PER_FRAME << ", close pairs: " << closePairs << endl;
+}
+
+
+void AddUnitSystems(SystemScheduler& scheduler)
+{
+    // ai and render only share reads, physics waits for both
+    scheduler.add("ai", MaskOf<Position>(), MaskOf<Brain, Velocity>(), [](ArchetypeWorld& world, WorkStealingPool& pool) {
+        world.parallelEachChunk<Brain, Velocity, Position>(pool, [](size_t count, Brain* brain, Velocity* velocity, Position* position) {
+            for (size_t i = 0; i < count; ++i) {
+                if (--brain[i].thinkTimer > 0)
+                    continue;
+
+                brain[i].thinkTimer = 30;
+                velocity[i].dx = (position[i].x > 500) ? -20 : 20;
+                velocity[i].dy = (position[i].y > 500) ? -5 : 5;
+            }
+        });
+    });
+
+    scheduler.add("render", MaskOf<Position>(), MaskOf<Sprite>(), [](ArchetypeWorld& world, WorkStealingPool& pool) {
+        world.parallelEachChunk<Position, Sprite>(pool, [](size_t count, Position* position, Sprite* sprite) {
+            for (size_t i = 0; i < count; ++i)
+                sprite[i].frame = ((position[i].x >> 4) ^ (position[i].y >> 4)) & 7;
+        });
+    });
+
+    scheduler.add("physics", MaskOf<Velocity>(), MaskOf<Position>(), [](ArchetypeWorld& world, WorkStealingPool& pool) {
+        world.parallelEachChunk<Position, Velocity>(pool, [](size_t count, Position* position, Velocity* velocity) {
+            for (size_t i = 0; i < count; ++i) {
+                position[i].x += velocity[i].dx;
+                position[i].y += velocity[i].dy;
+            }
+        });
+    });
+}
+
+uint64_t WorldChecksum(ArchetypeWorld& world)
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    world.each<Position, Sprite>([&](Position& position, Sprite& sprite) {
+        hash = (hash ^ uint32_t(position.x)) * 1099511628211ull;
+        hash = (hash ^ uint32_t(position.y)) * 1099511628211ull;
+        hash = (hash ^ uint32_t(sprite.frame)) * 1099511628211ull;
+    });
+
+    return hash;
+}
+
+void TestSystemScheduler(int unitCount, int frameCount)
+{
+    size_t maxThreadCount = max<size_t>(thread::hardware_concurrency(), 4);
+
+    nanoseconds serialTime = 0ns;
+    uint64_t serialChecksum = 0;
+
+    for (size_t threadCount = 1; threadCount <= maxThreadCount; threadCount *= 2) {
+        ArchetypeWorld world;
+        for (int i = 1; i <= unitCount; ++i)
+            world.create(Position{ i % 1000, i % 700 }, Velocity{ 20, 0 }, Brain{ i, i % 30 }, Sprite{ i, 0 });
+
+        WorkStealingPool pool(threadCount - 1);
+        SystemScheduler scheduler(world, pool);
+        AddUnitSystems(scheduler);
+
+        steady_clock::time_point begin = steady_clock::now();
+
+        for (int frame = 0; frame < frameCount; ++frame)
+            scheduler.runFrame();
+
+        nanoseconds elapsed = steady_clock::now() - begin;
+        uint64_t checksum = WorldChecksum(world);
+
+        if (threadCount == 1) {
+            serialTime = elapsed;
+            serialChecksum = checksum;
+            scheduler.printGraph(cout);
+        }
+
+        cout << "units: " << unitCount << ", threads: " << threadCount
+             << ", per frame: " << duration_cast<microseconds>(elapsed / frameCount)
+             << ", speedup: " << double(serialTime.count()) / elapsed.count()
+             << ", same result: " << (checksum == serialChecksum ? "yes" : "no") << endl;
+    }
+}
+
+
+// benchmark harness, "--bench [out.json]" runs it instead of the demo.
+// the batch size doubles until a batch takes minBatch, which also warms up
+// caches and branch predictors, then every repetition times one batch.
+#if defined(_MSC_VER)
+volatile const void* benchSink = nullptr;
+#endif
+
+// the optimizer has to assume the value is read
+template <typename T>
+void DoNotOptimize(const T& value)
+{
+#if defined(_MSC_VER)
+    benchSink = &value;
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+// and that any memory may have been read or written
+void ClobberMemory()
+{
+#if defined(_MSC_VER)
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : : "memory");
+#endif
+}
+
+struct BenchResult
+{
+    string name;
+    long long param;      // the sweep point, unit count, batch size...
+    long long iterations; // operations per repetition
+    double median;        // ns per operation
+    double p10;
+    double p90;
+    double fastest;
+    PerfSample counted;   // one more repetition under the hardware counters
+};
+
+class Bench
+{
+public:
+    explicit Bench(string_view suite, ostream& report = cout, int repetitions = 11, nanoseconds minBatch = 5ms)
+        : suite(suite), report(report), repetitions(repetitions), minBatch(minBatch) {}
+
+    // f runs one operation
+    template <typename F>
+    void run(string_view name, long long param, F f);
+
+    bool writeJson(const string& path) const;
+
+    const BenchResult& lastResult() const {
+        return results.back();
+    }
+
+    // every run measures one more repetition under these counters
+    void attach(const PerfCounters& perfCounters) {
+        counters = &perfCounters;
+    }
+
+private:
+    string suite;
+    ostream& report;
+    int repetitions;
+    nanoseconds minBatch;
+    const PerfCounters* counters = nullptr;
+
+    vector<BenchResult> results;
+};
+
+template <typename F>
+void Bench::run(string_view name, long long param, F f)
+{
+    auto timeBatch = [&](long long iterations) {
+        steady_clock::time_point begin = steady_clock::now();
+        for (long long i = 0; i < iterations; ++i) {
+            f();
+            ClobberMemory();
+        }
+        return nanoseconds(steady_clock::now() - begin);
+    };
+
+    long long iterations = 1;
+    while (timeBatch(iterations) < minBatch)
+        iterations *= 2;
+
+    vector<double> samples;
+    for (int r = 0; r < repetitions; ++r)
+        samples.push_back(double(timeBatch(iterations).count()) / iterations);
+
+    sort(samples.begin(), samples.end());
+    auto at = [&](double ratio) { return samples[static_cast<size_t>(ratio * (samples.size() - 1) + 0.5)]; };
+
+    BenchResult result{ string(name), param, iterations, at(0.5), at(0.1), at(0.9), samples.front(), PerfSample() };
+
+    if (counters != nullptr && counters->available()) {
+        PerfScope scope(*counters, result.counted);
+        timeBatch(iterations);
+    }
+
+    results.push_back(result);
+
+    report << name << " [" << param << "]: median " << result.median << " ns"
+           << ", p10: " << result.p10 << ", p90: " << result.p90 << ", iterations: " << iterations;
+
+    for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+        if (result.counted.counts[i] >= 0)
+            report << ", " << PERF_EVENT_NAMES[i] << ": " << double(result.counted.counts[i]) / iterations;
+    }
+
+    report << endl;
+}
+
+bool Bench::writeJson(const string& path) const
+{
+    ofstream out(path);
+    if (!out)
+        return false;
+
+    out << "{\n  \"suite\": \"" << suite << "\",\n  \"results\": [\n";
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        out << "    { \"name\": \"" << r.name << "\", \"param\": " << r.param << ", \"iterations\": " << r.iterations
+            << ", \"median_ns\": " << r.median << ", \"p10_ns\": " << r.p10 << ", \"p90_ns\": " << r.p90
+            << ", \"min_ns\": " << r.fastest;
+
+        // counts per operation, "l1d misses" becomes "l1d_misses"
+        for (int e = 0; e < PERF_EVENT_COUNT; ++e) {
+            if (r.counted.counts[e] < 0)
+                continue;
+
+            string key = PERF_EVENT_NAMES[e];
+            replace(key.begin(), key.end(), ' ', '_');
+            out << ", \"" << key << "\": " << double(r.counted.counts[e]) / r.iterations;
+        }
+
+        out << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n}\n";
+    return true;
+}
+
+
+// every layout runs the same systems and has to end in the same state
+void TestLayoutStorage()
+{
+    const size_t UNIT_COUNT = 1001;
+    const int FRAME_COUNT = 10;
+
+    auto checksum = [](auto& units) {
+        double total = 0.0;
+        for (size_t i = 0; i < units.size(); ++i)
+            total += units.template get<PosX>(i) + units.template get<Health>(i) * 3 + units.template get<Cooldown>(i) * 7;
+        return total;
+    };
+
+    auto run = [&](auto units, string_view name) {
+        FillLayout(units, UNIT_COUNT);
+        for (int frame = 0; frame < FRAME_COUNT; ++frame) {
+            LayoutIntegrate(units);
+            LayoutOneField(units);
+            LayoutAllFields(units);
+        }
+        cout << name << " checksum: " << checksum(units) << endl;
+    };
+
+    run(UnitLayout<Layout::AoS>(), "aos");
+    run(UnitLayout<Layout::SoA>(), "soa");
+    run(UnitLayout<Layout::AoSoA, 8>(), "aosoa8");
+    run(UnitLayout<Layout::AoSoA, 64>(), "aosoa64");
+}
+
+
+// every supported kernel against the scalar loop, the count leaves a tail
+void TestPhysicsKernels()
+{
+    const size_t UNIT_COUNT = 100003;
+    const int STEP_COUNT = 100;
+    const float DT = 1.f / 60.f;
+
+    PhysicsSoA expected(UNIT_COUNT);
+    FillPhysics(expected);
+    for (int step = 0; step < STEP_COUNT; ++step)
+        IntegrateScalar(expected, DT);
+
+    for (const PhysicsKernel& kernel : SupportedPhysicsKernels()) {
+        PhysicsSoA units(UNIT_COUNT);
+        FillPhysics(units);
+
+        for (int step = 0; step < STEP_COUNT; ++step)
+            kernel.integrate(units, DT);
+
+        bool identical = memcmp(units.posX.get(), expected.posX.get(), UNIT_COUNT * sizeof(float)) == 0
+                      && memcmp(units.posY.get(), expected.posY.get(), UNIT_COUNT * sizeof(float)) == 0;
+
+        cout << "kernel: " << kernel.name << ", bit identical to scalar: " << (identical ? "yes" : "no") << endl;
+    }
+
+    cout << "selected kernel: " << SelectPhysicsKernel().name << endl;
+}
+
+
+void BenchDataLocality(Bench& bench)
 {
     World world;
     Graphics graphics;
 
-    AIComponent aiComps[MAX_UNIT_COUNT];
-    PhysicsComponent physicsComps[MAX_UNIT_COUNT];
-    RenderComponent renderComps[MAX_UNIT_COUNT];
+    for (int unitCount : { 1000, 10000, 100000 }) {
+        {
+            vector<unique_ptr<Unit>> units;
+            for (int i = 0; i < unitCount; ++i)
+                units.push_back(make_unique<Unit>());
+
+            bench.run("units by pointer", unitCount, [&] {
+                for (auto& unit : units)
+                    unit->update(world, graphics);
+            });
+        }
+        {
+            vector<Unit> units(unitCount);
+
+            bench.run("units by value", unitCount, [&] {
+                for (auto& unit : units)
+                    unit.update(world, graphics);
+            });
+        }
+        {
+            vector<unique_ptr<AIComponent>> aiComps;
+            vector<unique_ptr<PhysicsComponent>> physicsComps;
+            vector<unique_ptr<RenderComponent>> renderComps;
+
+            for (int i = 1; i <= unitCount; ++i) {
+                aiComps.push_back(make_unique<AIComponent>(i));
+                physicsComps.push_back(make_unique<PhysicsComponent>(i));
+                renderComps.push_back(make_unique<RenderComponent>(i));
+            }
+
+            bench.run("components by pointer", unitCount, [&] {
+                for (auto& ac : aiComps)
+                    ac->update(world);
+                for (auto& pc : physicsComps)
+                    pc->update(world);
+                for (auto& rc : renderComps)
+                    rc->render(graphics);
+            });
+        }
+        {
+            // the plain array of test_5 lays out the same as these vectors
+            vector<AIComponent> aiComps;
+            vector<PhysicsComponent> physicsComps;
+            vector<RenderComponent> renderComps;
+
+            for (int i = 1; i <= unitCount; ++i) {
+                aiComps.push_back(AIComponent(i));
+                physicsComps.push_back(PhysicsComponent(i));
+                renderComps.push_back(RenderComponent(i));
+            }
+
+            bench.run("components by value", unitCount, [&] {
+                for (auto& ac : aiComps)
+                    ac.update(world);
+                for (auto& pc : physicsComps)
+                    pc.update(world);
+                for (auto& rc : renderComps)
+                    rc.render(graphics);
+            });
+        }
+        {
+            ArchetypeWorld archetypes;
+            for (int i = 1; i <= unitCount; ++i)
+                archetypes.create(Position{ 100, 130 }, Velocity{ 20, 0 }, Brain{ i, 30 }, Sprite{ i, 0 });
+
+            bench.run("archetype world", unitCount, [&] {
+                archetypes.each<Brain>([](Brain& brain) { ++brain.thinkTimer; });
+                archetypes.each<Position, Velocity>([](Position& position, Velocity& velocity) { position.x += velocity.dx; });
+                archetypes.each<Sprite>([](Sprite& sprite) { ++sprite.frame; });
+            });
+        }
+    }
+}
 
-    for (int i = 0; i < MAX_UNIT_COUNT; ++i) {
-        aiComps[i].setUnitId(i + 1);
-        physicsComps[i].setUnitId(i + 1);
-        renderComps[i].setUnitId(i + 1);
+
+// the aos units move their int positions, the soa kernels the float arrays
+void BenchPhysics(Bench& bench)
+{
+    const float DT = 1.f / 60.f;
+
+    for (int unitCount : { 10000, 100000, 1000000 }) {
+        {
+            vector<Unit> units(unitCount);
+
+            bench.run("physics aos unit", unitCount, [&] {
+                for (auto& unit : units) {
+                    int x = unit.posX + unit.velocity;
+                    unit.posX = min(max(x, 0), 4096);
+                }
+            });
+        }
+
+        PhysicsSoA units(unitCount);
+        FillPhysics(units);
+
+        for (const PhysicsKernel& kernel : SupportedPhysicsKernels())
+            bench.run("physics soa " + string(kernel.name), unitCount, [&] { kernel.integrate(units, DT); });
     }
+}
 
-    int loopCount = 0;
-    steady_clock::time_point begin = steady_clock::now();
 
-    while (loopCount < MAX_LOOP_COUNT) {
-        for (int i = 0; i < MAX_UNIT_COUNT; ++i)
-            aiComps[i].update(world);
+struct LayoutScore
+{
+    string pattern;
+    string layout;
+    double median;
+};
 
-        for (int i = 0; i < MAX_UNIT_COUNT; ++i)
-            physicsComps[i].update(world);
+template <typename Storage>
+void BenchLayoutPatterns(Bench& bench, const string& layoutName, int unitCount, const vector<uint32_t>& order, vector<LayoutScore>& scores)
+{
+    auto units = make_unique<Storage>();
+    FillLayout(*units, unitCount);
+
+    auto measure = [&](const string& pattern, auto f) {
+        bench.run(layoutName + " " + pattern, unitCount, f);
+        scores.push_back({ pattern, layoutName, bench.lastResult().median });
+    };
+
+    measure("integrate", [&] { LayoutIntegrate(*units); });
+    measure("one field", [&] { LayoutOneField(*units); });
+    measure("all fields", [&] { LayoutAllFields(*units); });
+    measure("random gather", [&] { DoNotOptimize(LayoutGather(*units, order)); });
+}
 
-        for (int i = 0; i < MAX_UNIT_COUNT; ++i)
-            renderComps[i].render(graphics);
+// unit indices in a fixed pseudo random order, for the random gather pattern
+vector<uint32_t> GatherOrder(int unitCount)
+{
+    vector<uint32_t> order(unitCount);
+    uint32_t seed = 3;
+    for (auto& i : order) {
+        seed = seed * 1664525u + 1013904223u;
+        i = (seed >> 8) % unitCount;
+    }
+    return order;
+}
 
-        ++loopCount;
+// which layout wins each access pattern at each unit count on this machine
+void BenchLayouts(Bench& bench)
+{
+    for (int unitCount : { 1000, 100000, 1000000 }) {
+        vector<uint32_t> order = GatherOrder(unitCount);
+
+        vector<LayoutScore> scores;
+
+        BenchLayoutPatterns<UnitLayout<Layout::AoS>>(bench, "aos", unitCount, order, scores);
+        BenchLayoutPatterns<UnitLayout<Layout::SoA>>(bench, "soa", unitCount, order, scores);
+        BenchLayoutPatterns<UnitLayout<Layout::AoSoA, 4>>(bench, "aosoa4", unitCount, order, scores);
+        BenchLayoutPatterns<UnitLayout<Layout::AoSoA, 8>>(bench, "aosoa8", unitCount, order, scores);
+        BenchLayoutPatterns<UnitLayout<Layout::AoSoA, 16>>(bench, "aosoa16", unitCount, order, scores);
+        BenchLayoutPatterns<UnitLayout<Layout::AoSoA, 64>>(bench, "aosoa64", unitCount, order, scores);
+
+        for (const string pattern : { "integrate", "one field", "all fields", "random gather" }) {
+            const LayoutScore* best = nullptr;
+            for (const LayoutScore& score : scores) {
+                if (score.pattern == pattern && (best == nullptr || score.median < best->median))
+                    best = &score;
+            }
+            cout << "units: " << unitCount << ", " << pattern << " winner: " << best->layout << " (" << best->median << " ns)" << endl;
+        }
     }
+}
 
-    steady_clock::time_point end = steady_clock::now();
-    nanoseconds elapsed = end - begin;
-    milliseconds elapsed2 = duration_cast<milliseconds>(elapsed);
+void BenchHandleChurn(Bench& bench)
+{
+    const int perFrame = CHURN_PER_SECOND / CHURN_FRAME_RATE;
+
+    for (int unitCount : { 10000, 100000, 1000000 }) {
+        ArchetypeWorld world;
+        vector<Entity> live, stale;
+        mt19937 random(7);
+
+        for (int i = 0; i < unitCount; ++i)
+            live.push_back(world.create(Position{ 100, 130 }, Velocity{ 20, 0 }, Brain{ i, 30 }, Sprite{ i, 0 }));
+
+        bench.run("churn_frame", unitCount, [&] {
+            ChurnFrame(world, live, stale, random, perFrame);
+            stale.clear();
+        });
+
+        SparseSet<Position> positions;
+        vector<Handle> handles;
+
+        for (int i = 0; i < unitCount; ++i)
+            handles.push_back(positions.create(Position{ i, 0 }));
+
+        bench.run("sparse_set_churn_frame", unitCount, [&] {
+            for (int i = 0; i < perFrame; ++i) {
+                size_t victim = random() % handles.size();
+                positions.destroy(handles[victim]);
+                handles[victim] = positions.create(Position{ i, 0 });
+            }
+        });
+
+        bench.run("sparse_set_lookup", unitCount, [&] {
+            long long sum = 0;
+            for (int i = 0; i < perFrame; ++i) {
+                Position* position = positions.get(handles[random() % handles.size()]);
+                sum += position ? position->x : 0;
+            }
+            DoNotOptimize(sum);
+        });
+    }
+}
 
-    cout << "test_5 elapsed time: " << elapsed << ", " << elapsed2 << endl;
+void BenchReorder(Bench& bench)
+{
+    for (int unitCount : { 10000, 100000 }) {
+        ArchetypeWorld world;
+        vector<Entity> live;
+        vector<vector<Entity>> cells;
+        mt19937 random(11);
+
+        for (int i = 0; i < unitCount; ++i)
+            SpawnWanderer(world, live, random, i);
+
+        BuildCells(world, cells);
+        bench.run("neighbor_pass_spawn_order", unitCount, [&] {
+            DoNotOptimize(NeighborPass(world, cells, nullptr));
+        });
+
+        world.planReorder<Position>(CellMorton);
+        while (world.reordering())
+            world.reorderStep(SIZE_MAX);
+
+        BuildCells(world, cells);
+        bench.run("neighbor_pass_morton_order", unitCount, [&] {
+            DoNotOptimize(NeighborPass(world, cells, nullptr));
+        });
+
+        // REORDER_STEPS_PER_FRAME steps, wandering keeps the order drifting
+        bench.run("reorder_step", unitCount, [&] {
+            WanderFrame(world);
+            if (!world.reordering())
+                world.planReorder<Position>(CellMorton);
+            DoNotOptimize(world.reorderStep(REORDER_STEPS_PER_FRAME));
+        });
+    }
+}
+
+
+struct CacheSizes
+{
+    size_t l1 = 32 * 1024;
+    size_t l2 = 1024 * 1024;
+    size_t l3 = 32 * 1024 * 1024;
+};
+
+// data cache sizes of the host, the defaults stay where it cannot tell
+CacheSizes DetectCacheSizes()
+{
+    CacheSizes sizes;
+
+#if defined(_WIN32)
+    DWORD bytes = 0;
+    GetLogicalProcessorInformation(nullptr, &bytes);
+
+    vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> infos(bytes / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if (!infos.empty() && GetLogicalProcessorInformation(infos.data(), &bytes)) {
+        for (const auto& info : infos) {
+            if (info.Relationship != RelationCache || info.Cache.Type == CacheInstruction)
+                continue;
+
+            switch (info.Cache.Level) {
+            case 1: sizes.l1 = info.Cache.Size; break;
+            case 2: sizes.l2 = info.Cache.Size; break;
+            case 3: sizes.l3 = info.Cache.Size; break;
+            }
+        }
+    }
+#elif defined(__linux__)
+    for (int index = 0; index < 8; ++index) {
+        string dir = "/sys/devices/system/cpu/cpu0/cache/index" + to_string(index) + "/";
+        ifstream levelFile(dir + "level"), typeFile(dir + "type"), sizeFile(dir + "size");
+
+        int level = 0;
+        string type, size;
+        if (!(levelFile >> level) || !(typeFile >> type) || !(sizeFile >> size) || type == "Instruction")
+            continue;
+
+        // "48K", "2048K", "105M"
+        size_t value = stoul(size);
+        if (size.back() == 'K')
+            value *= 1024;
+        else if (size.back() == 'M')
+            value *= 1024 * 1024;
+
+        switch (level) {
+        case 1: sizes.l1 = value; break;
+        case 2: sizes.l2 = value; break;
+        case 3: sizes.l3 = value; break;
+        }
+    }
+#endif
+
+    return sizes;
+}
+
+string ByteSize(size_t bytes)
+{
+    if (bytes >= 1024 * 1024)
+        return to_string(bytes / (1024 * 1024)) + " MB";
+    if (bytes >= 1024)
+        return to_string(bytes / 1024) + " KB";
+    return to_string(bytes) + " B";
+}
+
+const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+// backs allocations of a huge page or more with huge page aligned memory and
+// asks linux for transparent huge pages, smaller ones go to upstream. arrays
+// that all start on a 2MB boundary map to the same cache sets, so each one is
+// staggered by a different number of cache lines into its block. elsewhere it
+// only aligns, large pages on windows need a privilege.
+class HugePageResource : public pmr::memory_resource
+{
+public:
+    explicit HugePageResource(pmr::memory_resource* upstream = pmr::new_delete_resource())
+        : upstream(upstream) {}
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        if (bytes < HUGE_PAGE_SIZE)
+            return upstream->allocate(bytes, alignment);
+
+        size_t stagger = STAGGER_LINE * (1 + 17 * (allocationCount++ % 31));
+        stagger = (stagger + alignment - 1) & ~(alignment - 1);
+
+        size_t rounded = (stagger + bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        auto* block = static_cast<unsigned char*>(::operator new(rounded, align_val_t(HUGE_PAGE_SIZE)));
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        madvise(block, rounded, MADV_HUGEPAGE);
+#endif
+
+        // the block start sits right before the memory handed out
+        unsigned char* p = block + stagger;
+        memcpy(p - sizeof(block), &block, sizeof(block));
+        return p;
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        if (bytes < HUGE_PAGE_SIZE) {
+            upstream->deallocate(p, bytes, alignment);
+            return;
+        }
+
+        unsigned char* block = nullptr;
+        memcpy(&block, static_cast<unsigned char*>(p) - sizeof(block), sizeof(block));
+        ::operator delete(block, align_val_t(HUGE_PAGE_SIZE));
+    }
+
+    bool do_is_equal(const pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    static const size_t STAGGER_LINE = 64;
+
+    pmr::memory_resource* upstream;
+    size_t allocationCount = 0;
+};
+
+// kB of anonymous memory backed by huge pages, -1 where it cannot tell
+long long AnonHugePagesKb()
+{
+#if defined(__linux__)
+    ifstream rollup("/proc/self/smaps_rollup");
+    string key;
+    long long value = 0;
+
+    while (rollup >> key) {
+        if (key == "AnonHugePages:" && rollup >> value)
+            return value;
+        rollup.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+#endif
+    return -1;
+}
+
+const char* const SWEEP_PATTERNS[] = { "integrate", "all fields", "random gather" };
+
+struct SweepColumn
+{
+    string layout;
+    string pattern;
+    vector<double> nsPerUnit;
+};
+
+template <typename Storage>
+void SweepLayout(Bench& bench, const string& layoutName, const vector<int>& unitCounts, vector<SweepColumn>& columns)
+{
+    vector<SweepColumn> patterns;
+    for (const char* pattern : SWEEP_PATTERNS)
+        patterns.push_back({ layoutName, pattern, {} });
+
+    for (int unitCount : unitCounts) {
+        auto units = make_unique<Storage>();
+        FillLayout(*units, unitCount);
+        vector<uint32_t> order = GatherOrder(unitCount);
+
+        auto measure = [&](SweepColumn& column, auto f) {
+            bench.run(layoutName + " " + column.pattern, unitCount, f);
+            column.nsPerUnit.push_back(bench.lastResult().median / unitCount);
+        };
+
+        measure(patterns[0], [&] { LayoutIntegrate(*units); });
+        measure(patterns[1], [&] { LayoutAllFields(*units); });
+        measure(patterns[2], [&] { DoNotOptimize(LayoutGather(*units, order)); });
+    }
+
+    for (SweepColumn& column : patterns)
+        columns.push_back(move(column));
+}
+
+// one frame over every unit for every layout and sweep pattern from 1k to 10M
+// units, in ns per unit. the working set of each row says which level of the
+// host's caches it fits in, a line marks where it spills into the next one.
+void SweepLayouts(Bench& bench, bool hugePages)
+{
+    const vector<int> unitCounts = { 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000,
+                                     1000000, 2000000, 5000000, 10000000 };
+    const size_t unitBytes = sizeof(tuple<float, float, float, float, float, float, int, int>);
+
+    CacheSizes caches = DetectCacheSizes();
+    cout << "caches l1d: " << ByteSize(caches.l1) << ", l2: " << ByteSize(caches.l2) << ", l3: " << ByteSize(caches.l3)
+         << ", unit: " << unitBytes << " bytes, huge pages: " << (hugePages ? "on" : "off") << endl;
+
+    // the layout storages take their arrays from the default resource
+    HugePageResource hugePageResource;
+    pmr::memory_resource* previous = pmr::set_default_resource(hugePages ? &hugePageResource : pmr::new_delete_resource());
+
+    vector<SweepColumn> columns;
+    SweepLayout<UnitLayout<Layout::AoS>>(bench, "aos", unitCounts, columns);
+    SweepLayout<UnitLayout<Layout::SoA>>(bench, "soa", unitCounts, columns);
+    SweepLayout<UnitLayout<Layout::AoSoA, 4>>(bench, "aosoa4", unitCounts, columns);
+    SweepLayout<UnitLayout<Layout::AoSoA, 8>>(bench, "aosoa8", unitCounts, columns);
+    SweepLayout<UnitLayout<Layout::AoSoA, 16>>(bench, "aosoa16", unitCounts, columns);
+    SweepLayout<UnitLayout<Layout::AoSoA, 64>>(bench, "aosoa64", unitCounts, columns);
+
+    if (hugePages) {
+        UnitLayout<Layout::SoA> probe;
+        FillLayout(probe, unitCounts.back());
+        cout << "anon huge pages with " << unitCounts.back() << " soa units: " << AnonHugePagesKb() << " kB" << endl;
+    }
+
+    pmr::set_default_resource(previous);
+
+    ios_base::fmtflags flags = cout.flags();
+    streamsize precision = cout.precision();
+
+    for (const char* pattern : SWEEP_PATTERNS) {
+        cout << endl << setw(10) << "units" << setw(12) << "working set";
+        for (const SweepColumn& column : columns) {
+            if (column.pattern == pattern)
+                cout << setw(10) << column.layout;
+        }
+        cout << "   (" << pattern << ", ns per unit per frame)" << endl;
+
+        const char* level = "";
+        for (size_t row = 0; row < unitCounts.size(); ++row) {
+            size_t workingSet = unitCounts[row] * unitBytes;
+            const char* fits = workingSet <= caches.l1 ? "l1" : workingSet <= caches.l2 ? "l2" : workingSet <= caches.l3 ? "l3" : "dram";
+
+            if (strcmp(fits, level) != 0) {
+                cout << "---- " << fits << " ----" << endl;
+                level = fits;
+            }
+
+            cout << setw(10) << unitCounts[row] << setw(12) << ByteSize(workingSet) << fixed << setprecision(3);
+            for (const SweepColumn& column : columns) {
+                if (column.pattern == pattern)
+                    cout << setw(10) << column.nsPerUnit[row];
+            }
+            cout << endl;
+
+            cout.flags(flags);
+            cout.precision(precision);
+        }
+    }
 }
 
 
-int main()
+int main(int argc, char* argv[])
 {
+    if (argc > 1 && string_view(argv[1]) == "--bench") {
+        Bench bench("data-locality");
+        bench.attach(SharedPerfCounters());
+        BenchDataLocality(bench);
+        BenchPhysics(bench);
+        BenchLayouts(bench);
+        BenchHandleChurn(bench);
+        BenchReorder(bench);
+
+        if (argc > 2 && !bench.writeJson(argv[2]))
+            cout << "cannot write: " << argv[2] << endl;
+        return 0;
+    }
+
+    // "--sweep [--thp] [out.json]"
+    if (argc > 1 && string_view(argv[1]) == "--sweep") {
+        bool hugePages = false;
+        string jsonPath;
+        for (int i = 2; i < argc; ++i) {
+            if (string_view(argv[i]) == "--thp")
+                hugePages = true;
+            else
+                jsonPath = argv[i];
+        }
+
+        ostream quiet(nullptr);
+        Bench bench(hugePages ? "data-locality-sweep-thp" : "data-locality-sweep", quiet);
+        bench.attach(SharedPerfCounters());
+        SweepLayouts(bench, hugePages);
+
+        if (!jsonPath.empty() && !bench.writeJson(jsonPath))
+            cout << "cannot write: " << jsonPath << endl;
+        return 0;
+    }
+
     cout << "test environment" << endl;
     cout << "unit count: " << MAX_UNIT_COUNT << endl;
     cout << "loop count: " << MAX_LOOP_COUNT << endl;
+    cout << "hardware counters: " << (SharedPerfCounters().available() ? "on" : "off, time only") << endl;
 
     TestDataLocality1();
     TestDataLocality2();
@@ -320,6 +3588,37 @@ int main()
     TestDataLocality4();
     TestDataLocality5();
 
+    cout << endl << "arenas =======" << endl;
+
+    TestArenaFrames();
+    TestPooledUnits();
+
+    cout << endl << "archetype world, unit count: " << MAX_ECS_UNIT_COUNT << endl;
+
+    TestArchetypeWorld();
+
+    cout << endl << "handle churn =======" << endl;
+
+    TestHandleChurn(MAX_UNIT_COUNT, 1);
+    TestHandleChurn(MAX_ECS_UNIT_COUNT, 1);
+
+    cout << endl << "churn day, unit count: " << MAX_ECS_UNIT_COUNT / 10 << " =======" << endl;
+
+    TestChurnDay(MAX_ECS_UNIT_COUNT / 10);
+
+    cout << endl << "system scheduler =======" << endl;
+
+    TestSystemScheduler(MAX_UNIT_COUNT, MAX_LOOP_COUNT);
+    TestSystemScheduler(MAX_ECS_UNIT_COUNT, MAX_ECS_FRAME_COUNT / 5);
+
+    cout << endl << "physics kernels =======" << endl;
+
+    TestPhysicsKernels();
+
+    cout << endl << "layouts =======" << endl;
+
+    TestLayoutStorage();
+
     return 0;
 }
 
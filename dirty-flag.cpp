@@ -1,6 +1,8 @@
 ﻿#include <iostream>
 #include <vector>
 #include <array>
+#include <algorithm>
+#include <cstdint>
 
 
 // tested x64, c++17
@@ -32,25 +34,149 @@ public:
 };
 
 
+// an index into a sparse set plus the generation of its slot when the handle
+// was made. destroying bumps the generation, so older handles stop matching.
+struct Handle
+{
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+
+    bool operator==(const Handle& other) const {
+        return index == other.index && generation == other.generation;
+    }
+
+    bool operator!=(const Handle& other) const {
+        return !(*this == other);
+    }
+};
+
+ostream& operator<<(ostream& os, const Handle& handle)
+{
+    if (handle.index == UINT32_MAX)
+        return os << "none";
+
+    return os << handle.index << ":" << handle.generation;
+}
+
+// the sparse array maps a handle's index to a slot of the dense arrays.
+// destroy moves the last element into the hole, so iteration has no holes,
+// and freed indices are reused through a free list threaded through sparse.
+template <typename T>
+class SparseSet
+{
+public:
+    template <typename... Args>
+    Handle create(Args&&... args);
+
+    // false for a stale handle
+    bool destroy(Handle handle);
+
+    // nullptr for a stale handle
+    T* get(Handle handle) {
+        return contains(handle) ? &dense[sparse[handle.index].dense] : nullptr;
+    }
+
+    bool contains(Handle handle) const {
+        if (handle.index >= sparse.size())
+            return false;
+
+        uint32_t slot = sparse[handle.index].dense;
+        return slot < denseHandles.size() && denseHandles[slot] == handle;
+    }
+
+    size_t size() const {
+        return dense.size();
+    }
+
+    // dense order, destroy moves the last element
+    typename vector<T>::iterator begin() { return dense.begin(); }
+    typename vector<T>::iterator end() { return dense.end(); }
+
+    Handle handleAt(size_t denseIndex) const {
+        return denseHandles[denseIndex];
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t dense = 0; // next free index while the slot is free
+        uint32_t generation = 0;
+    };
+
+    static const uint32_t NO_SLOT = UINT32_MAX;
+
+    vector<Slot> sparse;
+    vector<T> dense;
+    vector<Handle> denseHandles;
+
+    uint32_t freeHead = NO_SLOT;
+};
+
+template <typename T>
+template <typename... Args>
+Handle SparseSet<T>::create(Args&&... args)
+{
+    uint32_t index = freeHead;
+
+    if (index != NO_SLOT) {
+        freeHead = sparse[index].dense;
+    }
+    else {
+        index = static_cast<uint32_t>(sparse.size());
+        sparse.push_back(Slot());
+    }
+
+    Slot& slot = sparse[index];
+    slot.dense = static_cast<uint32_t>(dense.size());
+
+    Handle handle{ index, slot.generation };
+    dense.emplace_back(forward<Args>(args)...);
+    denseHandles.push_back(handle);
+
+    return handle;
+}
+
+template <typename T>
+bool SparseSet<T>::destroy(Handle handle)
+{
+    if (!contains(handle))
+        return false;
+
+    Slot& slot = sparse[handle.index];
+    uint32_t hole = slot.dense;
+    uint32_t last = static_cast<uint32_t>(dense.size() - 1);
+
+    if (hole != last) {
+        dense[hole] = move(dense[last]);
+        denseHandles[hole] = denseHandles[last];
+        sparse[denseHandles[hole].index].dense = hole;
+    }
+
+    dense.pop_back();
+    denseHandles.pop_back();
+
+    ++slot.generation;
+    slot.dense = freeHead;
+    freeHead = handle.index;
+
+    return true;
+}
+
+
 class GraphNode
 {
 public:
-    GraphNode(int parentId) { create(parentId); }
+    GraphNode(Handle nodeId, Handle parentId);
     virtual ~GraphNode() = default;
 
-    void create(int parentId);
-    GraphNode& addChild();
     void setMatrix(Matrix& localPos);
     void setMesh(Mesh* mesh);
-    void update(Matrix& worldPos, bool dirty);
-    void render();
-    void viewStatus();
 
-private:
-    int nodeId;
+public:
+    Handle nodeId;
 
-    int parentId;
-    vector<GraphNode> children;
+    Handle parentId;
+    vector<Handle> children;
 
     bool dirty;
     Matrix world;
@@ -59,25 +185,11 @@ private:
     Mesh* mesh;
 };
 
-void GraphNode::create(int parentId)
+GraphNode::GraphNode(Handle nodeId, Handle parentId)
+    : nodeId(nodeId), parentId(parentId), dirty(false), mesh(nullptr)
 {
-    static int genId = 1;
-    nodeId = genId;
-    ++genId;
-
-    this->parentId = parentId;
-
-    dirty = false;
     world.elements.fill(0);
     local.elements.fill(0);
-
-    mesh = nullptr;
-}
-
-GraphNode& GraphNode::addChild()
-{
-    children.push_back(GraphNode(nodeId));
-    return children.back();
 }
 
 void GraphNode::setMatrix(Matrix& localPos)
@@ -93,35 +205,146 @@ void GraphNode::setMesh(Mesh* mesh)
     this->mesh = mesh;
 }
 
-void GraphNode::update(Matrix& worldPos, bool isDirty)
+
+using node_set = SparseSet<GraphNode>;
+
+// nodes live in one sparse set and point at each other by handle, so removing
+// a subtree leaves stale handles behind instead of dangling references
+class SceneGraph
+{
+public:
+    SceneGraph();
+
+    Handle root() const {
+        return rootId;
+    }
+
+    Handle addChild(Handle parentId);
+    void remove(Handle nodeId); // with its subtree
+
+    bool contains(Handle nodeId) const {
+        return nodes.contains(nodeId);
+    }
+
+    void setMatrix(Handle nodeId, Matrix& localPos);
+    void setMesh(Handle nodeId, Mesh* mesh);
+
+    void update(Matrix& worldPos, bool dirty) {
+        update(rootId, worldPos, dirty);
+    }
+
+    void render() {
+        render(rootId);
+    }
+
+    void viewStatus() {
+        viewStatus(rootId);
+    }
+
+private:
+    void destroy(Handle nodeId);
+    void update(Handle nodeId, Matrix& worldPos, bool dirty);
+    void render(Handle nodeId);
+    void viewStatus(Handle nodeId);
+
+    node_set nodes;
+    Handle rootId;
+};
+
+SceneGraph::SceneGraph()
+{
+    rootId = nodes.create(Handle(), Handle());
+    nodes.get(rootId)->nodeId = rootId;
+}
+
+Handle SceneGraph::addChild(Handle parentId)
+{
+    if (!nodes.contains(parentId))
+        return Handle();
+
+    // create may grow the dense array, look the parent up again afterwards
+    Handle childId = nodes.create(Handle(), parentId);
+    nodes.get(childId)->nodeId = childId;
+    nodes.get(parentId)->children.push_back(childId);
+
+    return childId;
+}
+
+void SceneGraph::remove(Handle nodeId)
+{
+    GraphNode* node = nodes.get(nodeId);
+    if (node == nullptr || nodeId == rootId)
+        return;
+
+    GraphNode* parent = nodes.get(node->parentId);
+    if (parent != nullptr) {
+        auto& siblings = parent->children;
+        siblings.erase(std::remove(siblings.begin(), siblings.end(), nodeId), siblings.end());
+    }
+
+    destroy(nodeId);
+}
+
+void SceneGraph::destroy(Handle nodeId)
 {
-    bool dirtyOn = dirty | isDirty;
+    // destroy moves another node into this slot, copy the children first
+    vector<Handle> children = nodes.get(nodeId)->children;
+    nodes.destroy(nodeId);
+
+    for (auto& childId : children)
+        destroy(childId);
+}
+
+void SceneGraph::setMatrix(Handle nodeId, Matrix& localPos)
+{
+    GraphNode* node = nodes.get(nodeId);
+    if (node == nullptr) {
+        cout << "stale node id: " << nodeId << endl;
+        return;
+    }
+
+    node->setMatrix(localPos);
+}
+
+void SceneGraph::setMesh(Handle nodeId, Mesh* mesh)
+{
+    GraphNode* node = nodes.get(nodeId);
+    if (node != nullptr)
+        node->setMesh(mesh);
+}
+
+void SceneGraph::update(Handle nodeId, Matrix& worldPos, bool isDirty)
+{
+    GraphNode& node = *nodes.get(nodeId);
+    bool dirtyOn = node.dirty | isDirty;
 
     if (dirtyOn) {
-        world = local.transform(worldPos);
-        dirty = false;
+        node.world = node.local.transform(worldPos);
+        node.dirty = false;
 
-        cout << "update node id: " << nodeId << endl;
+        cout << "update node id: " << node.nodeId << endl;
     }
 
-    for (auto& child : children)
-        child.update(world, dirtyOn);
+    for (auto& childId : node.children)
+        update(childId, node.world, dirtyOn);
 }
 
-void GraphNode::render()
+void SceneGraph::render(Handle nodeId)
 {
-    cout << "render node id: " << nodeId << endl;
+    GraphNode& node = *nodes.get(nodeId);
+    cout << "render node id: " << node.nodeId << endl;
 
-    for (auto& child : children)
-        child.render();
+    for (auto& childId : node.children)
+        render(childId);
 }
 
-void GraphNode::viewStatus()
+void SceneGraph::viewStatus(Handle nodeId)
 {
-    cout << "(" << parentId << ", " << nodeId << ") : dirty on " << dirty << endl;
+    GraphNode& node = *nodes.get(nodeId);
+    cout << "(" << node.parentId << ", " << node.nodeId << ") : dirty on " << node.dirty << endl;
 
-    for (auto& child : children)
-        child.viewStatus();
+    for (auto& childId : node.children)
+        viewStatus(childId);
 }
 
 
@@ -129,16 +352,16 @@ int main()
 {
     Matrix move;
 
-    GraphNode scene{ 0 };
-    scene.addChild();
+    SceneGraph scene;
+    scene.addChild(scene.root());
 
-    GraphNode& child1 = scene.addChild();
-    child1.setMatrix(move);
-    child1.addChild();
-    child1.addChild();
-    child1.addChild();
+    Handle child1 = scene.addChild(scene.root());
+    scene.setMatrix(child1, move);
+    scene.addChild(child1);
+    scene.addChild(child1);
+    scene.addChild(child1);
 
-    scene.addChild().addChild();
+    scene.addChild(scene.addChild(scene.root()));
 
     scene.viewStatus();
 
@@ -150,6 +373,16 @@ int main()
     scene.update(move, true);
     scene.render();
 
+    cout << endl << "remove subtree" << endl;
+    scene.remove(child1);
+    scene.setMatrix(child1, move);
+
+    Handle reused = scene.addChild(scene.root());
+    cout << "removed: " << child1 << ", added: " << reused
+         << ", stale id found: " << (scene.contains(child1) ? "yes" : "no") << endl;
+
+    scene.viewStatus();
+
     return 0;
 }
 
@@ -1,19 +1,939 @@
 ﻿#include <iostream>
 #include <array>
+#include <vector>
+#include <memory>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <random>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <type_traits>
+#include <fstream>
+#include <string>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 
 // tested x64, c++17
 
-using namespace std;
+using namespace std;
+using namespace std::chrono;
+
+enum class SoundLane {
+    Critical,
+    Ambient
+};
+
+struct SoundMessage
+{
+    int soundId = 0;
+    int volume = 0;
+    steady_clock::time_point queuedAt;
+    int priority = 0;
+    steady_clock::time_point deadline = steady_clock::time_point::max();
+    SoundLane lane = SoundLane::Ambient;
+};
+
+
+enum class OverflowPolicy {
+    DropNewest,
+    DropOldest,
+    Block
+};
+
+enum class PushResult {
+    Queued,
+    Evicted, // queued after dropping the oldest messages
+    Spilled, // queued in the growable overflow segments
+    Dropped
+};
+
+// bounded multi producer, single consumer ring buffer.
+// every slot carries a sequence number, so producers only contend on tail.
+// head is advanced with cas too, which lets a producer evict the oldest
+// message when the queue is full and the policy is DropOldest.
+template <typename T, size_t Capacity>
+class MpscQueue
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    MpscQueue();
+
+    bool tryPush(const T& item);
+    bool tryPop(T& item);
+
+    // pops up to maxCount ready messages into out, head moves once per batch
+    size_t drain(T* out, size_t maxCount);
+
+    template <typename OnEvict>
+    PushResult push(const T& item, OverflowPolicy policy, nanoseconds timeout, OnEvict onEvict);
+    PushResult push(const T& item, OverflowPolicy policy, nanoseconds timeout = 0ns) {
+        return push(item, policy, timeout, [](const T&) {});
+    }
+
+    size_t size() const {
+        size_t h = head.load(memory_order_acquire);
+        size_t t = tail.load(memory_order_acquire);
+        return min(t - h, Capacity);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+private:
+    static const size_t CACHE_LINE = 64;
+    static const size_t MASK = Capacity - 1;
+
+    struct Slot
+    {
+        atomic<size_t> sequence;
+        T data;
+    };
+
+    array<Slot, Capacity> slots;
+
+    // producers hammer tail, the consumer owns head, keep them on separate lines
+    alignas(CACHE_LINE) atomic<size_t> head = 0;
+    alignas(CACHE_LINE) atomic<size_t> tail = 0;
+    char padding[CACHE_LINE - sizeof(atomic<size_t>)];
+};
+
+template <typename T, size_t Capacity>
+MpscQueue<T, Capacity>::MpscQueue()
+{
+    for (size_t i = 0; i < Capacity; ++i)
+        slots[i].sequence.store(i, memory_order_relaxed);
+}
+
+template <typename T, size_t Capacity>
+bool MpscQueue<T, Capacity>::tryPush(const T& item)
+{
+    size_t pos = tail.load(memory_order_relaxed);
+
+    while (true) {
+        size_t seq = slots[pos & MASK].sequence.load(memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+        if (diff == 0) {
+            if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0) {
+            return false; // full
+        }
+        else {
+            pos = tail.load(memory_order_relaxed);
+        }
+    }
+
+    Slot& slot = slots[pos & MASK];
+    slot.data = item;
+    slot.sequence.store(pos + 1, memory_order_release);
+
+    return true;
+}
+
+template <typename T, size_t Capacity>
+bool MpscQueue<T, Capacity>::tryPop(T& item)
+{
+    size_t pos = head.load(memory_order_relaxed);
+
+    while (true) {
+        size_t seq = slots[pos & MASK].sequence.load(memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+
+        if (diff == 0) {
+            if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0) {
+            return false; // empty
+        }
+        else {
+            pos = head.load(memory_order_relaxed);
+        }
+    }
+
+    Slot& slot = slots[pos & MASK];
+    item = slot.data;
+    slot.sequence.store(pos + Capacity, memory_order_release);
+
+    return true;
+}
+
+template <typename T, size_t Capacity>
+size_t MpscQueue<T, Capacity>::drain(T* out, size_t maxCount)
+{
+    size_t pos = head.load(memory_order_relaxed);
+    size_t count = 0;
+
+    while (true) {
+        count = 0;
+        maxCount = min(maxCount, Capacity);
+
+        while (count < maxCount && slots[(pos + count) & MASK].sequence.load(memory_order_acquire) == pos + count + 1)
+            ++count;
+
+        if (count == 0)
+            return 0;
+
+        // a DropOldest producer may have evicted from the front, then recount
+        if (head.compare_exchange_weak(pos, pos + count, memory_order_relaxed))
+            break;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        Slot& slot = slots[(pos + i) & MASK];
+        out[i] = slot.data;
+        slot.sequence.store(pos + i + Capacity, memory_order_release);
+    }
+
+    return count;
+}
+
+template <typename T, size_t Capacity>
+template <typename OnEvict>
+PushResult MpscQueue<T, Capacity>::push(const T& item, OverflowPolicy policy, nanoseconds timeout, OnEvict onEvict)
+{
+    PushResult result = PushResult::Queued;
+    steady_clock::time_point deadline = steady_clock::now() + timeout;
+
+    while (!tryPush(item)) {
+        switch (policy) {
+        case OverflowPolicy::DropNewest:
+            return PushResult::Dropped;
+
+        case OverflowPolicy::DropOldest: {
+            T oldest;
+            if (tryPop(oldest)) {
+                onEvict(oldest);
+                result = PushResult::Evicted;
+            }
+            break;
+        }
+
+        case OverflowPolicy::Block:
+            if (steady_clock::now() >= deadline)
+                return PushResult::Dropped;
+            this_thread::yield();
+            break;
+        }
+    }
+
+    return result;
+}
+
+
+// chunked spill storage for growable queues, emptied segments are reused
+template <typename T, size_t SegmentSize>
+class SegmentList
+{
+public:
+    void push(const T& item);
+    size_t pop(T* out, size_t maxCount);
+
+private:
+    struct Segment
+    {
+        array<T, SegmentSize> items;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    deque<unique_ptr<Segment>> segments;
+    vector<unique_ptr<Segment>> spares;
+};
+
+template <typename T, size_t SegmentSize>
+void SegmentList<T, SegmentSize>::push(const T& item)
+{
+    if (segments.empty() || segments.back()->end == SegmentSize) {
+        if (spares.empty()) {
+            segments.push_back(make_unique<Segment>());
+        }
+        else {
+            segments.push_back(move(spares.back()));
+            spares.pop_back();
+        }
+    }
+
+    Segment& segment = *segments.back();
+    segment.items[segment.end++] = item;
+}
+
+template <typename T, size_t SegmentSize>
+size_t SegmentList<T, SegmentSize>::pop(T* out, size_t maxCount)
+{
+    size_t count = 0;
+
+    while (count < maxCount && !segments.empty()) {
+        Segment& segment = *segments.front();
+        size_t n = min(segment.end - segment.begin, maxCount - count);
+
+        copy_n(segment.items.begin() + segment.begin, n, out + count);
+        segment.begin += n;
+        count += n;
+
+        if (segment.begin == segment.end) {
+            segment.begin = segment.end = 0;
+            spares.push_back(move(segments.front()));
+            segments.pop_front();
+        }
+    }
+
+    return count;
+}
+
+
+// generic event queue for any trivially copyable message.
+// lane 0 has the highest priority, drain empties it before looking at the next lane.
+// a growable queue spills into chunked segments instead of dropping, the lock-free
+// ring stays the fast path and the segments are only locked while a lane is spilled.
+template <typename T, size_t Capacity, size_t LaneCount = 1>
+class EventQueue
+{
+    static_assert(is_trivially_copyable_v<T>, "event must be trivially copyable");
+    static_assert(LaneCount >= 1, "event queue needs a lane");
+
+public:
+    explicit EventQueue(bool growable = false) : growable(growable) {}
+
+    template <typename OnEvict>
+    PushResult push(const T& item, size_t lane, OverflowPolicy policy, nanoseconds timeout, OnEvict onEvict);
+    PushResult push(const T& item, size_t lane = 0, OverflowPolicy policy = OverflowPolicy::DropNewest, nanoseconds timeout = 0ns) {
+        return push(item, lane, policy, timeout, [](const T&) {});
+    }
+
+    // pops up to maxCount messages into out, highest priority lane first
+    size_t drain(T* out, size_t maxCount);
+
+    size_t size() const;
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+private:
+    struct Lane
+    {
+        MpscQueue<T, Capacity> ring;
+
+        mutex spillLock;
+        SegmentList<T, Capacity> spill;
+        atomic<size_t> spilled = 0;
+    };
+
+    array<Lane, LaneCount> lanes;
+    const bool growable;
+};
+
+template <typename T, size_t Capacity, size_t LaneCount>
+template <typename OnEvict>
+PushResult EventQueue<T, Capacity, LaneCount>::push(const T& item, size_t laneIndex, OverflowPolicy policy, nanoseconds timeout, OnEvict onEvict)
+{
+    Lane& lane = lanes[laneIndex];
+
+    if (!growable)
+        return lane.ring.push(item, policy, timeout, onEvict);
+
+    // while a lane is spilled new messages go behind the spilled ones to keep order
+    if (lane.spilled.load(memory_order_acquire) == 0 && lane.ring.tryPush(item))
+        return PushResult::Queued;
+
+    lock_guard<mutex> guard(lane.spillLock);
+    lane.spill.push(item);
+    lane.spilled.fetch_add(1, memory_order_release);
+
+    return PushResult::Spilled;
+}
+
+template <typename T, size_t Capacity, size_t LaneCount>
+size_t EventQueue<T, Capacity, LaneCount>::drain(T* out, size_t maxCount)
+{
+    size_t count = 0;
+
+    for (auto& lane : lanes) {
+        while (count < maxCount) {
+            size_t n = lane.ring.drain(out + count, maxCount - count);
+            if (n == 0)
+                break;
+            count += n;
+        }
+
+        if (count < maxCount && lane.spilled.load(memory_order_acquire) > 0) {
+            lock_guard<mutex> guard(lane.spillLock);
+            size_t n = lane.spill.pop(out + count, maxCount - count);
+            lane.spilled.fetch_sub(n, memory_order_release);
+            count += n;
+        }
+
+        if (count == maxCount)
+            break;
+    }
+
+    return count;
+}
+
+template <typename T, size_t Capacity, size_t LaneCount>
+size_t EventQueue<T, Capacity, LaneCount>::size() const
+{
+    size_t total = 0;
+
+    for (auto& lane : lanes)
+        total += lane.ring.size() + lane.spilled.load(memory_order_acquire);
+
+    return total;
+}
+
+
+// open addressing table from sound id to the volume of its queued request.
+// keys are never removed, an entry just goes back to NOT_PENDING once the
+// consumer takes it, so lookups and merges stay lock-free. probes stop after
+// MAX_PROBE slots: once the neighbourhood of an id is taken by other ids,
+// that id is queued without merging, and a lookup never costs more than
+// MAX_PROBE slots however many ids were seen.
+template <size_t Capacity>
+class CoalescingIndex
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    // true when merged into a queued request, false when the caller has to queue it.
+    // a merge raises the priority and pulls the deadline in, deadlines are steady clock ticks
+    bool merge(int soundId, int volume, int priority = NO_PRIORITY, int64_t deadline = NO_DEADLINE);
+    void release(int soundId);
+    int take(int soundId, int queuedVolume);
+
+    // also the highest priority and earliest deadline merged into the request
+    int take(int soundId, int queuedVolume, int& priority, int64_t& deadline);
+
+    static constexpr int NO_PRIORITY = INT_MIN;
+    static constexpr int64_t NO_DEADLINE = INT64_MAX;
+
+private:
+    struct Entry
+    {
+        atomic<int> soundId = EMPTY_ID;
+        atomic<int> volume = NOT_PENDING;
+        atomic<int> priority = NO_PRIORITY;
+        atomic<int64_t> deadline = NO_DEADLINE;
+    };
+
+    void raise(Entry& entry, int priority, int64_t deadline);
+
+    Entry* find(int soundId, bool insert);
+
+    static size_t hash(int soundId) {
+        uint32_t h = static_cast<uint32_t>(soundId) * 0x9E3779B1u;
+        return (h ^ (h >> 16)) & MASK;
+    }
+
+    static constexpr int EMPTY_ID = INT_MIN;
+    static constexpr int NOT_PENDING = INT_MIN;
+    static constexpr size_t MASK = Capacity - 1;
+    static constexpr size_t MAX_PROBE = min<size_t>(16, Capacity);
+
+    array<Entry, Capacity> entries;
+};
+
+template <size_t Capacity>
+typename CoalescingIndex<Capacity>::Entry* CoalescingIndex<Capacity>::find(int soundId, bool insert)
+{
+    size_t index = hash(soundId);
+
+    for (size_t probe = 0; probe < MAX_PROBE; ++probe, index = (index + 1) & MASK) {
+        Entry& entry = entries[index];
+        int id = entry.soundId.load(memory_order_acquire);
+
+        if (id == EMPTY_ID) {
+            if (!insert)
+                return nullptr;
+
+            if (entry.soundId.compare_exchange_strong(id, soundId, memory_order_acq_rel))
+                return &entry;
+        }
+
+        if (id == soundId)
+            return &entry;
+    }
+
+    return nullptr; // neighbourhood full, sound is queued without merging
+}
+
+template <size_t Capacity>
+void CoalescingIndex<Capacity>::raise(Entry& entry, int priority, int64_t deadline)
+{
+    int currentPriority = entry.priority.load(memory_order_relaxed);
+    while (currentPriority < priority && !entry.priority.compare_exchange_weak(currentPriority, priority, memory_order_relaxed)) {}
+
+    int64_t currentDeadline = entry.deadline.load(memory_order_relaxed);
+    while (currentDeadline > deadline && !entry.deadline.compare_exchange_weak(currentDeadline, deadline, memory_order_relaxed)) {}
+}
+
+template <size_t Capacity>
+bool CoalescingIndex<Capacity>::merge(int soundId, int volume, int priority, int64_t deadline)
+{
+    Entry* entry = find(soundId, true);
+    if (entry == nullptr)
+        return false;
+
+    // raised before the volume cas publishes the merge, so a take that sees
+    // the merged volume sees these too. if the request was taken meanwhile,
+    // the caller queues its own message and carries the same values.
+    if (priority != NO_PRIORITY || deadline != NO_DEADLINE)
+        raise(*entry, priority, deadline);
+
+    int current = entry->volume.load(memory_order_acquire);
+
+    while (true) {
+        if (current == NOT_PENDING) {
+            if (entry->volume.compare_exchange_weak(current, volume, memory_order_acq_rel))
+                return false;
+        }
+        else if (current >= volume) {
+            return true;
+        }
+        else if (entry->volume.compare_exchange_weak(current, volume, memory_order_acq_rel)) {
+            return true;
+        }
+    }
+}
+
+template <size_t Capacity>
+void CoalescingIndex<Capacity>::release(int soundId)
+{
+    Entry* entry = find(soundId, false);
+    if (entry == nullptr)
+        return;
+
+    entry->volume.store(NOT_PENDING, memory_order_release);
+    entry->priority.store(NO_PRIORITY, memory_order_relaxed);
+    entry->deadline.store(NO_DEADLINE, memory_order_relaxed);
+}
+
+template <size_t Capacity>
+int CoalescingIndex<Capacity>::take(int soundId, int queuedVolume)
+{
+    int priority = NO_PRIORITY;
+    int64_t deadline = NO_DEADLINE;
+    return take(soundId, queuedVolume, priority, deadline);
+}
+
+template <size_t Capacity>
+int CoalescingIndex<Capacity>::take(int soundId, int queuedVolume, int& priority, int64_t& deadline)
+{
+    Entry* entry = find(soundId, false);
+    if (entry == nullptr)
+        return queuedVolume;
+
+    int volume = entry->volume.exchange(NOT_PENDING, memory_order_acq_rel);
+
+    // most requests never raise these, skip the writes then
+    if (entry->priority.load(memory_order_relaxed) != NO_PRIORITY)
+        priority = max(priority, entry->priority.exchange(NO_PRIORITY, memory_order_relaxed));
+    if (entry->deadline.load(memory_order_relaxed) != NO_DEADLINE)
+        deadline = min(deadline, entry->deadline.exchange(NO_DEADLINE, memory_order_relaxed));
+
+    return (volume == NOT_PENDING) ? queuedVolume : volume;
+}
+
+
+// the consumer parks here while its queue is empty.
+// producers only touch the mutex when the consumer is really asleep,
+// so the common enqueue path stays a load and a fence.
+class WakeEvent
+{
+public:
+    void notify();
+
+    template <typename Ready>
+    void wait(Ready ready, int spinCount);
+
+private:
+    mutex lock;
+    condition_variable cv;
+    atomic<bool> sleeping = false;
+};
+
+void WakeEvent::notify()
+{
+    // pairs with the fence in wait, either we see sleeping or the consumer sees our item
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!sleeping.load(memory_order_relaxed))
+        return;
+
+    lock_guard<mutex> guard(lock);
+    cv.notify_one();
+}
+
+template <typename Ready>
+void WakeEvent::wait(Ready ready, int spinCount)
+{
+    for (int i = 0; i < spinCount; ++i) {
+        if (ready())
+            return;
+    }
+
+    unique_lock<mutex> guard(lock);
+    sleeping.store(true, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    while (!ready())
+        cv.wait(guard);
+
+    sleeping.store(false, memory_order_relaxed);
+}
+
+
+// recording threads pick a shard round robin, so producers rarely share a cache line
+const size_t TELEMETRY_SHARDS = 8;
+
+size_t TelemetryShard()
+{
+    static atomic<size_t> nextShard = 0;
+    thread_local size_t shard = nextShard.fetch_add(1, memory_order_relaxed) % TELEMETRY_SHARDS;
+    return shard;
+}
+
+class ShardedCounter
+{
+public:
+    void add(uint64_t n = 1) {
+        shards[TelemetryShard()].value.fetch_add(n, memory_order_relaxed);
+    }
+
+    uint64_t load() const;
+
+private:
+    struct alignas(64) Shard
+    {
+        atomic<uint64_t> value = 0;
+    };
+
+    array<Shard, TELEMETRY_SHARDS> shards;
+};
+
+uint64_t ShardedCounter::load() const
+{
+    uint64_t total = 0;
+
+    for (auto& shard : shards)
+        total += shard.value.load(memory_order_relaxed);
+
+    return total;
+}
+
+// hdr style log-linear buckets. values below 16 are exact, above that every
+// power of two is split into 16 sub buckets, so a bucket is off by at most 1/16.
+class LatencyHistogram
+{
+public:
+    static const int SUB_BUCKET_BITS = 4;
+    static const int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    static const int MAX_MAGNITUDE = 40; // larger values land in the last bucket
+    static const int BUCKET_COUNT = (MAX_MAGNITUDE - SUB_BUCKET_BITS + 2) * SUB_BUCKET_COUNT;
+
+    struct Snapshot
+    {
+        array<uint64_t, BUCKET_COUNT> counts{};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+
+        // the highest value of the bucket holding the given rank
+        uint64_t percentile(double ratio) const;
+        uint64_t max() const;
+
+        double mean() const {
+            return (count == 0) ? 0.0 : double(sum) / count;
+        }
+    };
+
+    void record(uint64_t value) {
+        Shard& shard = shards[TelemetryShard()];
+        shard.counts[bucketOf(value)].fetch_add(1, memory_order_relaxed);
+        shard.sum.fetch_add(value, memory_order_relaxed);
+    }
+
+    Snapshot snapshot() const;
+
+    static int bucketOf(uint64_t value);
+    static uint64_t bucketHigh(int bucket);
+
+private:
+    struct alignas(64) Shard
+    {
+        array<atomic<uint64_t>, BUCKET_COUNT> counts{};
+        atomic<uint64_t> sum = 0;
+    };
+
+    array<Shard, TELEMETRY_SHARDS> shards;
+};
+
+int LatencyHistogram::bucketOf(uint64_t value)
+{
+    if (value < SUB_BUCKET_COUNT)
+        return static_cast<int>(value);
+
+    // index of the highest set bit, by binary search
+    int magnitude = 0;
+    for (int step = 32; step > 0; step >>= 1) {
+        if ((value >> (magnitude + step)) != 0)
+            magnitude += step;
+    }
+
+    if (magnitude > MAX_MAGNITUDE)
+        return BUCKET_COUNT - 1;
+
+    int sub = static_cast<int>(value >> (magnitude - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1);
+    return (magnitude - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT + sub;
+}
+
+uint64_t LatencyHistogram::bucketHigh(int bucket)
+{
+    if (bucket < SUB_BUCKET_COUNT)
+        return bucket;
+
+    int shift = bucket / SUB_BUCKET_COUNT - 1;
+    uint64_t low = uint64_t(SUB_BUCKET_COUNT + bucket % SUB_BUCKET_COUNT) << shift;
+    return low + (uint64_t(1) << shift) - 1;
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+{
+    Snapshot result;
+
+    for (auto& shard : shards) {
+        for (int i = 0; i < BUCKET_COUNT; ++i)
+            result.counts[i] += shard.counts[i].load(memory_order_relaxed);
+        result.sum += shard.sum.load(memory_order_relaxed);
+    }
+
+    for (uint64_t c : result.counts)
+        result.count += c;
+
+    return result;
+}
+
+uint64_t LatencyHistogram::Snapshot::percentile(double ratio) const
+{
+    if (count == 0)
+        return 0;
+
+    uint64_t rank = static_cast<uint64_t>(ratio * (count - 1));
+    uint64_t seen = 0;
+
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        seen += counts[i];
+        if (seen > rank)
+            return bucketHigh(i);
+    }
+
+    return bucketHigh(BUCKET_COUNT - 1);
+}
+
+uint64_t LatencyHistogram::Snapshot::max() const
+{
+    for (int i = BUCKET_COUNT - 1; i >= 0; --i) {
+        if (counts[i] != 0)
+            return bucketHigh(i);
+    }
+
+    return 0;
+}
+
+
+struct AudioTelemetrySnapshot
+{
+    uint64_t requested = 0;
+    uint64_t coalesced = 0; // merged into an already queued request
+    uint64_t dropped = 0;   // queue full, the request was lost
+    uint64_t evicted = 0;   // queue full, an older request was lost for it
+    uint64_t started = 0;
+    uint64_t frames = 0;
+    uint64_t budgetCuts = 0; // frames that left a backlog for the next one
+
+    LatencyHistogram::Snapshot queueDepth;   // messages ahead of a request when it was queued
+    LatencyHistogram::Snapshot startLatency; // playSound to start sound, in ns
+
+    double coalesceRate() const {
+        return (requested == 0) ? 0.0 : double(coalesced) / requested;
+    }
+};
+
+// counters are only ever added to with relaxed atomics, a snapshot may be a
+// few events out of step between fields but never blocks the audio threads.
+class AudioTelemetry
+{
+public:
+    void recordRequest() { requested.add(); }
+    void recordCoalesced() { coalesced.add(); }
+    void recordDropped() { dropped.add(); }
+    void recordEvicted() { evicted.add(); }
+
+    void recordQueued(size_t depth) {
+        queueDepth.record(depth);
+    }
+
+    void recordStarted(nanoseconds latency) {
+        started.add();
+        startLatency.record(static_cast<uint64_t>(latency.count()));
+    }
+
+    void recordFrame(bool cut) {
+        frames.add();
+        if (cut)
+            budgetCuts.add();
+    }
+
+    AudioTelemetrySnapshot snapshot() const;
+
+private:
+    ShardedCounter requested;
+    ShardedCounter coalesced;
+    ShardedCounter dropped;
+    ShardedCounter evicted;
+    ShardedCounter started;
+    ShardedCounter frames;
+    ShardedCounter budgetCuts;
+
+    LatencyHistogram queueDepth;
+    LatencyHistogram startLatency;
+};
+
+AudioTelemetrySnapshot AudioTelemetry::snapshot() const
+{
+    AudioTelemetrySnapshot result;
+    result.requested = requested.load();
+    result.coalesced = coalesced.load();
+    result.dropped = dropped.load();
+    result.evicted = evicted.load();
+    result.started = started.load();
+    result.frames = frames.load();
+    result.budgetCuts = budgetCuts.load();
+    result.queueDepth = queueDepth.snapshot();
+    result.startLatency = startLatency.snapshot();
+    return result;
+}
+
+void PrintTelemetry(ostream& out, const AudioTelemetrySnapshot& t)
+{
+    out << "requests: " << t.requested << ", coalesced: " << int(t.coalesceRate() * 100) << "%"
+        << ", dropped: " << t.dropped << ", evicted: " << t.evicted << ", started: " << t.started << endl;
+    out << "  frames: " << t.frames << ", budget cuts: " << t.budgetCuts << endl;
+    out << "  queue depth p50: " << t.queueDepth.percentile(0.5) << ", p99: " << t.queueDepth.percentile(0.99)
+        << ", max: " << t.queueDepth.max() << endl;
+    out << "  start latency p50: " << t.startLatency.percentile(0.5) / 1000 << "us"
+        << ", p99: " << t.startLatency.percentile(0.99) / 1000 << "us"
+        << ", p999: " << t.startLatency.percentile(0.999) / 1000 << "us"
+        << ", max: " << t.startLatency.max() / 1000 << "us" << endl;
+}
 
-struct SoundMessage
+
+struct VoiceStats
 {
-    int soundId = 0;
-    int volume = 0;
+    uint64_t started = 0;
+    uint64_t expired = 0;  // too late when dequeued, never played
+    uint64_t stolen = 0;   // a playing voice cut for a higher priority sound
+    uint64_t rejected = 0; // every channel busy with an equal or higher priority
+};
+
+// fixed set of channels. a new sound takes an idle channel, otherwise it
+// steals the lowest priority voice when that one is strictly lower.
+template <size_t ChannelCount>
+class VoiceManager
+{
+public:
+    explicit VoiceManager(nanoseconds voiceLength) : voiceLength(voiceLength) {}
+
+    // returns the channel, or -1 when the sound expired or found no channel
+    int startSound(const SoundMessage& msg, steady_clock::time_point now);
+
+    VoiceStats stats() const;
+
+private:
+    struct Voice
+    {
+        int soundId = 0;
+        int priority = 0;
+        steady_clock::time_point startedAt;
+        steady_clock::time_point endsAt; // idle once passed
+    };
+
+    int findOpenChannel(int priority, steady_clock::time_point now);
+
+    array<Voice, ChannelCount> voices;
+    nanoseconds voiceLength;
+
+    // written by the consumer, read by anyone tuning the channel count
+    atomic<uint64_t> started = 0;
+    atomic<uint64_t> expired = 0;
+    atomic<uint64_t> stolen = 0;
+    atomic<uint64_t> rejected = 0;
 };
 
+template <size_t ChannelCount>
+int VoiceManager<ChannelCount>::findOpenChannel(int priority, steady_clock::time_point now)
+{
+    int victim = 0;
+
+    for (int i = 0; i < static_cast<int>(ChannelCount); ++i) {
+        if (voices[i].endsAt <= now)
+            return i;
+
+        // lowest priority first, the oldest of those
+        const Voice& v = voices[i];
+        const Voice& best = voices[victim];
+        if (v.priority < best.priority || (v.priority == best.priority && v.startedAt < best.startedAt))
+            victim = i;
+    }
+
+    if (voices[victim].priority >= priority)
+        return -1;
+
+    stolen.fetch_add(1, memory_order_relaxed);
+    return victim;
+}
+
+template <size_t ChannelCount>
+int VoiceManager<ChannelCount>::startSound(const SoundMessage& msg, steady_clock::time_point now)
+{
+    if (now > msg.deadline) {
+        expired.fetch_add(1, memory_order_relaxed);
+        return -1;
+    }
+
+    int channel = findOpenChannel(msg.priority, now);
+    if (channel == -1) {
+        rejected.fetch_add(1, memory_order_relaxed);
+        return -1;
+    }
+
+    voices[channel] = { msg.soundId, msg.priority, now, now + voiceLength };
+    started.fetch_add(1, memory_order_relaxed);
+
+    return channel;
+}
+
+template <size_t ChannelCount>
+VoiceStats VoiceManager<ChannelCount>::stats() const
+{
+    VoiceStats result;
+    result.started = started.load(memory_order_relaxed);
+    result.expired = expired.load(memory_order_relaxed);
+    result.stolen = stolen.load(memory_order_relaxed);
+    result.rejected = rejected.load(memory_order_relaxed);
+    return result;
+}
+
 
 class Audio
 {
@@ -23,66 +943,692 @@ public:
         return instance;
     }
 
-    void playSound(int soundId, int volume);
+    // set before producers start
+    void setOverflowPolicy(OverflowPolicy policy, nanoseconds timeout = 0ns) {
+        overflowPolicy = policy;
+        blockTimeout = timeout;
+    }
+
+    // spin on the queue before sleeping, for latency critical builds
+    void setSpinCount(int count) {
+        spinCount = count;
+    }
+
+    // bounds the work the audio thread does per frame, a cut frame leaves
+    // the rest of the backlog to the next frame tick
+    void setFrameBudget(size_t maxCount, nanoseconds maxTime, nanoseconds length = 16ms) {
+        frameMaxCount = maxCount;
+        frameMaxTime = maxTime;
+        frameLength = length;
+    }
+
+    // a sound still queued after maxDelay is dropped, 0 never expires
+    void playSound(int soundId, int volume, SoundLane lane = SoundLane::Ambient,
+                   int priority = 0, milliseconds maxDelay = 0ms);
     void update();
+    void reportLatency();
+
+    VoiceStats voiceStats() const {
+        return voices.stats();
+    }
+
+    const AudioTelemetry& telemetry() const {
+        return metrics;
+    }
 
 private:
     Audio() = default;
     ~Audio() = default;
 
     static const int MAX_SIZE = 16;
-    array<SoundMessage, MAX_SIZE> queue;
+    static const int MAX_SOUND_IDS = 1024;
 
-    atomic<int> head = 0;
-    atomic<int> tail = 0;
+    static const int MAX_LANES = 2;
+    static const int MAX_CHANNELS = 8;
+
+    EventQueue<SoundMessage, MAX_SIZE, MAX_LANES> queue;
+    array<CoalescingIndex<MAX_SOUND_IDS>, MAX_LANES> pending; // one per lane, lanes never merge
+    VoiceManager<MAX_CHANNELS> voices{ 300ms };
+
+    WakeEvent wakeEvent;
+    int spinCount = 0;
+
+    size_t frameMaxCount = 64;
+    nanoseconds frameMaxTime = 1ms;
+    nanoseconds frameLength = 16ms;
+
+    OverflowPolicy overflowPolicy = OverflowPolicy::DropOldest;
+    nanoseconds blockTimeout = 0ns;
+
+    AudioTelemetry metrics;
 };
 
-void Audio::playSound(int soundId, int volume)
+void Audio::playSound(int soundId, int volume, SoundLane lane, int priority, milliseconds maxDelay)
 {
-    for (int i = head; i != tail; i = (i + 1) % MAX_SIZE) {
-        if (queue[i].soundId != soundId)
-            continue;
+    metrics.recordRequest();
 
-        // skip same sound, use the larger of the two volumes
-        queue[i].volume = max(volume, queue[i].volume);
+    steady_clock::time_point now = steady_clock::now();
+    steady_clock::time_point deadline = (maxDelay > 0ms) ? now + maxDelay : steady_clock::time_point::max();
+
+    CoalescingIndex<MAX_SOUND_IDS>& lanePending = pending[static_cast<size_t>(lane)];
+
+    // skip same sound in the same lane, the queued one gets the larger volume,
+    // the higher priority and the earlier deadline. the shutdown message is
+    // never merged, the consumer does not take it from the index
+    if (soundId != -1 && lanePending.merge(soundId, volume, priority, deadline.time_since_epoch().count())) {
+        metrics.recordCoalesced();
         return;
     }
 
     cout << "queueing sound: " << soundId << ", " << volume << endl;
 
-    queue[tail].soundId = soundId;
-    queue[tail].volume = volume;
+    metrics.recordQueued(queue.size());
+
+    PushResult result = queue.push({ soundId, volume, now, priority, deadline, lane }, static_cast<size_t>(lane), overflowPolicy, blockTimeout,
+        [this](const SoundMessage& oldest) {
+            cout << "queue full, drop oldest sound: " << oldest.soundId << endl;
+            metrics.recordEvicted();
+            pending[static_cast<size_t>(oldest.lane)].release(oldest.soundId);
+        });
+
+    if (result == PushResult::Dropped) {
+        cout << "queue full, drop sound: " << soundId << endl;
+        metrics.recordDropped();
+        lanePending.release(soundId);
+        return;
+    }
 
-    tail = (tail + 1) % MAX_SIZE;
+    wakeEvent.notify();
 }
 
 void Audio::update()
 {
-    int soundId = 0;
+    array<SoundMessage, MAX_SIZE> batch;
+    bool stop = false;
+
+    while (!stop) {
+        wakeEvent.wait([this] { return !queue.empty(); }, spinCount);
+
+        steady_clock::time_point frameBegin = steady_clock::now();
+        size_t started = 0;
+        bool cut = false;
+
+        // the time budget is checked between batches, a batch is always finished
+        while (!stop) {
+            if (started == frameMaxCount || steady_clock::now() - frameBegin >= frameMaxTime) {
+                cut = true;
+                break;
+            }
+
+            size_t count = queue.drain(batch.data(), min(batch.size(), frameMaxCount - started));
+            if (count == 0)
+                break;
+
+            steady_clock::time_point now = steady_clock::now();
+
+            for (size_t i = 0; i < count; ++i) {
+                SoundMessage msg = batch[i];
+
+                // shutdown, whatever was queued behind it is dropped
+                if (msg.soundId == -1) {
+                    stop = true;
+                    break;
+                }
+
+                int soundId = msg.soundId;
+                int64_t deadline = msg.deadline.time_since_epoch().count();
+                int volume = pending[static_cast<size_t>(msg.lane)].take(msg.soundId, msg.volume, msg.priority, deadline);
+                msg.deadline = steady_clock::time_point(steady_clock::duration(deadline));
+
+                // ResourceId resource = loadSound(msg.soundId);
+                int channel = voices.startSound(msg, now);
+                if (channel == -1) {
+                    cout << "skip sound: " << soundId << endl;
+                    continue;
+                }
+                // startSound(resource, channel, volume);
+                metrics.recordStarted(now - msg.queuedAt);
+
+                cout << "start sound: " << soundId << ", " << volume << ", channel: " << channel << endl;
+            }
+
+            started += count;
+        }
+
+        metrics.recordFrame(cut);
+
+        // the queue is not empty after a cut, so wait would return at once
+        if (cut && !stop)
+            this_thread::sleep_until(frameBegin + frameLength);
+    }
+}
+
+nanoseconds Percentile(vector<nanoseconds> samples, double ratio)
+{
+    if (samples.empty())
+        return 0ns;
+
+    size_t rank = static_cast<size_t>(ratio * (samples.size() - 1));
+    nth_element(samples.begin(), samples.begin() + rank, samples.end());
+    return samples[rank];
+}
+
+void Audio::reportLatency()
+{
+    LatencyHistogram::Snapshot latency = metrics.snapshot().startLatency;
+
+    cout << "enqueue to start, count: " << latency.count
+         << ", p50: " << latency.percentile(0.5) / 1000 << "us"
+         << ", p99: " << latency.percentile(0.99) / 1000 << "us" << endl;
+}
+
+
+void PrintVoiceStats(const VoiceStats& stats)
+{
+    cout << "voices started: " << stats.started << ", expired: " << stats.expired
+         << ", stolen: " << stats.stolen << ", rejected: " << stats.rejected << endl;
+}
+
+template <size_t ChannelCount>
+void TestVoiceAllocation()
+{
+    const int MAX_FRAME_COUNT = 1000;
+    const int MAX_REQUEST_PER_FRAME = 8;
+    const int MAX_BURST_REQUEST = 120;
+    const int BURST_INTERVAL = 50;
+    const int MAX_START_PER_FRAME = 16;
+    const milliseconds FRAME_TIME = 10ms;
+
+    VoiceManager<ChannelCount> voices(300ms);
+    deque<SoundMessage> backlog;
+    mt19937 rng(7);
+
+    // simulated clock, bursts exceed the frame budget and leave a backlog
+    steady_clock::time_point now;
+
+    for (int frame = 0; frame < MAX_FRAME_COUNT; ++frame) {
+        int requestCount = (frame % BURST_INTERVAL == 0) ? MAX_BURST_REQUEST : MAX_REQUEST_PER_FRAME;
+
+        for (int i = 0; i < requestCount; ++i) {
+            int priority = static_cast<int>(rng() % 4);
+            backlog.push_back({ static_cast<int>(rng() % 64), 100, now, priority, now + 50ms });
+        }
+
+        for (int i = 0; i < MAX_START_PER_FRAME && !backlog.empty(); ++i) {
+            voices.startSound(backlog.front(), now);
+            backlog.pop_front();
+        }
+
+        now += FRAME_TIME;
+    }
+
+    cout << "channels: " << ChannelCount << ", ";
+    PrintVoiceStats(voices.stats());
+}
+
+
+struct ParticleSpawn
+{
+    float x = 0.f;
+    float y = 0.f;
+    int lifeTime = 0;
+};
+
+void TestParticleSpawnQueue()
+{
+    const int MAX_EMITTER_COUNT = 4;
+    const int MAX_SPAWN_COUNT = 100;
+
+    // a burst bigger than the ring spills into segments instead of dropping
+    EventQueue<ParticleSpawn, 16> spawns(true);
+    atomic<int> spilled = 0;
+
+    vector<thread> emitters;
+    for (int e = 0; e < MAX_EMITTER_COUNT; ++e) {
+        emitters.emplace_back([&, e] {
+            for (int i = 0; i < MAX_SPAWN_COUNT; ++i) {
+                if (spawns.push({ float(e), float(i), 3 }) == PushResult::Spilled)
+                    ++spilled;
+            }
+        });
+    }
+
+    for (auto& t : emitters)
+        t.join();
+
+    array<ParticleSpawn, 32> batch;
+    int spawned = 0;
+
+    while (size_t count = spawns.drain(batch.data(), batch.size()))
+        spawned += static_cast<int>(count);
+
+    cout << "particle spawns: " << spawned << ", spilled: " << spilled.load() << endl;
+}
+
+
+void TestQueueContention(OverflowPolicy policy, string_view policyName)
+{
+    const int MAX_MESSAGE_COUNT = 1 << 18;
+    const int MAX_PRODUCER_COUNT = 32;
+
+    for (int producerCount = 1; producerCount <= MAX_PRODUCER_COUNT; producerCount *= 2) {
+        auto queue = make_unique<MpscQueue<SoundMessage, 1024>>();
+
+        atomic<bool> producing = true;
+        atomic<int> dropped = 0;
+        int consumed = 0;
+
+        steady_clock::time_point begin = steady_clock::now();
+
+        thread consumer{ [&] {
+            array<SoundMessage, 64> batch;
+            while (producing || !queue->empty()) {
+                size_t count = queue->drain(batch.data(), batch.size());
+                consumed += static_cast<int>(count);
+                if (count == 0)
+                    this_thread::yield();
+            }
+        } };
+
+        vector<thread> producers;
+        for (int p = 0; p < producerCount; ++p) {
+            producers.emplace_back([&, p] {
+                int localDropped = 0;
+                for (int i = p; i < MAX_MESSAGE_COUNT; i += producerCount) {
+                    PushResult result = queue->push({ i, p, steady_clock::now() }, policy, 1ms, [&](const SoundMessage&) { ++localDropped; });
+                    localDropped += (result == PushResult::Dropped ? 1 : 0);
+                }
+                dropped += localDropped;
+            });
+        }
+
+        for (auto& t : producers)
+            t.join();
+
+        producing = false;
+        consumer.join();
+
+        steady_clock::time_point end = steady_clock::now();
+        double seconds = duration<double>(end - begin).count();
+
+        cout << policyName << " producers: " << producerCount
+             << ", consumed: " << consumed << ", dropped: " << dropped
+             << ", throughput: " << (MAX_MESSAGE_COUNT / seconds / 1e6) << " Mmsg/s" << endl;
+    }
+}
+
+
+void TestTelemetryCost()
+{
+    const int MAX_RECORD_COUNT = 1 << 20;
+    const int MAX_THREAD_COUNT = 4;
+
+    ShardedCounter sharded;
+    LatencyHistogram histogram;
+    alignas(64) atomic<uint64_t> shared = 0;
+
+    auto measure = [&](string_view name, auto record) {
+        steady_clock::time_point begin = steady_clock::now();
+
+        vector<thread> threads;
+        for (int t = 0; t < MAX_THREAD_COUNT; ++t) {
+            threads.emplace_back([&, t] {
+                for (int i = 0; i < MAX_RECORD_COUNT; ++i)
+                    record(static_cast<uint64_t>(i * (t + 1)));
+            });
+        }
+
+        for (auto& t : threads)
+            t.join();
 
-    while (soundId != -1) {
-        this_thread::sleep_for(100ms);
+        nanoseconds elapsed = steady_clock::now() - begin;
+        cout << name << ": " << double(elapsed.count()) / (MAX_RECORD_COUNT * MAX_THREAD_COUNT) << " ns/record" << endl;
+    };
 
-        if (head == tail)
+    measure("shared atomic", [&](uint64_t) { shared.fetch_add(1, memory_order_relaxed); });
+    measure("sharded counter", [&](uint64_t) { sharded.add(); });
+    measure("sharded histogram", [&](uint64_t value) { histogram.record(value & 0xFFFFF); });
+
+    LatencyHistogram::Snapshot snapshot = histogram.snapshot();
+    cout << "counts: " << shared.load() << ", " << sharded.load() << ", " << snapshot.count
+         << ", histogram p50: " << snapshot.percentile(0.5) << ", p99: " << snapshot.percentile(0.99) << endl;
+}
+
+
+// the old playSound loop, kept as the baseline for the coalescing index
+bool LinearMerge(vector<SoundMessage>& queue, int head, int tail, int soundId, int volume)
+{
+    int size = static_cast<int>(queue.size());
+
+    for (int i = head; i != tail; i = (i + 1) % size) {
+        if (queue[i].soundId != soundId)
             continue;
 
-        // ResourceId resource = loadSound(queue[head].soundId);
-        // int channel = findOpenChannel();
-        // if (channel == -1) return;
-        // startSound(resource, channel, queue[head].volume);
+        queue[i].volume = max(volume, queue[i].volume);
+        return true;
+    }
+
+    return false;
+}
+
+void TestCoalescing(int depth)
+{
+    const int MAX_MERGE_COUNT = 1 << 16;
+
+    vector<SoundMessage> queue(depth + 1);
+    auto index = make_unique<CoalescingIndex<8192>>();
+
+    for (int i = 0; i < depth; ++i) {
+        queue[i] = { i * 7, 0, {} };
+        index->merge(i * 7, 0);
+    }
+
+    // every request hits a random pending sound
+    mt19937 rng(1);
+    vector<int> soundIds(MAX_MERGE_COUNT);
+    for (auto& id : soundIds)
+        id = static_cast<int>(rng() % depth) * 7;
+
+    int merged = 0;
+
+    steady_clock::time_point begin = steady_clock::now();
+    for (int i = 0; i < MAX_MERGE_COUNT; ++i)
+        merged += LinearMerge(queue, 0, depth, soundIds[i], i & 127) ? 1 : 0;
+    nanoseconds linearElapsed = steady_clock::now() - begin;
+
+    begin = steady_clock::now();
+    for (int i = 0; i < MAX_MERGE_COUNT; ++i)
+        merged += index->merge(soundIds[i], i & 127) ? 1 : 0;
+    nanoseconds indexElapsed = steady_clock::now() - begin;
+
+    cout << "depth: " << depth
+         << ", linear: " << linearElapsed.count() / MAX_MERGE_COUNT << " ns/merge"
+         << ", index: " << indexElapsed.count() / MAX_MERGE_COUNT << " ns/merge"
+         << ", merged: " << merged << endl;
+}
+
+
+// a backlog larger than the frame budget is started over several frames
+void TestFrameBudget()
+{
+    const int MAX_BACKLOG = 12;
+    const size_t MAX_PER_FRAME = 4;
+    const nanoseconds FRAME_LENGTH = 10ms;
+
+    Audio& audio = Audio::instance();
+    audio.setFrameBudget(MAX_PER_FRAME, 1ms, FRAME_LENGTH);
+
+    AudioTelemetrySnapshot before = audio.telemetry().snapshot();
+
+    for (int i = 0; i < MAX_BACKLOG; ++i)
+        audio.playSound(300 + i, 1);
+
+    audio.playSound(-1, 0);
+
+    steady_clock::time_point begin = steady_clock::now();
+
+    thread t{ &Audio::update, ref(audio) };
+    t.join();
+
+    milliseconds elapsed = duration_cast<milliseconds>(steady_clock::now() - begin);
+    AudioTelemetrySnapshot after = audio.telemetry().snapshot();
+
+    cout << "backlog: " << MAX_BACKLOG << ", budget: " << MAX_PER_FRAME << "/frame"
+         << ", frames: " << after.frames - before.frames
+         << ", budget cuts: " << after.budgetCuts - before.budgetCuts
+         << ", elapsed: " << elapsed.count() << "ms" << endl;
+
+    audio.setFrameBudget(64, 1ms);
+}
+
+// a merge keeps the most urgent of the requests it folds together
+void TestCoalescedPriority()
+{
+    auto index = make_unique<CoalescingIndex<64>>();
+
+    index->merge(5, 10, 0, 9000);
+    bool merged = index->merge(5, 20, 7, 4000);
+
+    int priority = 0;
+    int64_t deadline = 9000;
+    int volume = index->take(5, 10, priority, deadline);
+
+    cout << "merged: " << merged << ", volume: " << volume << ", priority: " << priority << ", deadline: " << deadline << endl;
+}
+
+// more distinct ids than the table holds, lookups of ids it never indexed
+// still stop after a few probes
+void TestSaturatedCoalescing()
+{
+    const int MAX_SOUND_COUNT = 1 << 14;
+
+    auto index = make_unique<CoalescingIndex<1024>>();
+
+    int indexed = 0;
+    for (int id = 0; id < MAX_SOUND_COUNT; ++id) {
+        index->merge(id, 1);
+        indexed += (index->take(id, 0) == 1) ? 1 : 0;
+    }
+
+    int missed = 0;
+
+    steady_clock::time_point begin = steady_clock::now();
+    for (int id = MAX_SOUND_COUNT; id < 2 * MAX_SOUND_COUNT; ++id)
+        missed += index->merge(id, 1) ? 0 : 1;
+    nanoseconds elapsed = steady_clock::now() - begin;
+
+    cout << "saturated, indexed: " << indexed << " of " << MAX_SOUND_COUNT
+         << ", new ids queued unmerged: " << missed
+         << ", " << elapsed.count() / MAX_SOUND_COUNT << " ns/merge" << endl;
+}
+
+void TestWakeupLatency(string_view modeName, milliseconds pollInterval, int spinCount)
+{
+    const int MAX_MESSAGE_COUNT = 30;
+
+    MpscQueue<SoundMessage, 16> queue;
+    WakeEvent wakeEvent;
+    vector<nanoseconds> latencies;
+
+    thread consumer{ [&] {
+        SoundMessage msg;
+        while (msg.soundId != -1) {
+            if (pollInterval > 0ms) {
+                this_thread::sleep_for(pollInterval);
+                if (!queue.tryPop(msg))
+                    continue;
+            }
+            else {
+                wakeEvent.wait([&] { return queue.tryPop(msg); }, spinCount);
+            }
+
+            latencies.push_back(steady_clock::now() - msg.queuedAt);
+        }
+    } };
+
+    for (int i = 1; i <= MAX_MESSAGE_COUNT; ++i) {
+        this_thread::sleep_for(5ms);
 
-        soundId = queue[head].soundId;
-        int volume = queue[head].volume;
+        int soundId = (i == MAX_MESSAGE_COUNT) ? -1 : i;
+        queue.push({ soundId, 0, steady_clock::now() }, OverflowPolicy::Block, 1s);
+        wakeEvent.notify();
+    }
+
+    consumer.join();
+
+    cout << modeName << " count: " << latencies.size()
+         << ", p50: " << duration_cast<microseconds>(Percentile(latencies, 0.5)).count() << "us"
+         << ", p99: " << duration_cast<microseconds>(Percentile(latencies, 0.99)).count() << "us" << endl;
+}
+
+
+// benchmark harness, "--bench [out.json]" runs it instead of the demo.
+// the batch size doubles until a batch takes minBatch, which also warms up
+// caches and branch predictors, then every repetition times one batch.
+#if defined(_MSC_VER)
+volatile const void* benchSink = nullptr;
+#endif
+
+// the optimizer has to assume the value is read
+template <typename T>
+void DoNotOptimize(const T& value)
+{
+#if defined(_MSC_VER)
+    benchSink = &value;
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+// and that any memory may have been read or written
+void ClobberMemory()
+{
+#if defined(_MSC_VER)
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : : "memory");
+#endif
+}
+
+struct BenchResult
+{
+    string name;
+    long long param;      // the sweep point, unit count, batch size...
+    long long iterations; // operations per repetition
+    double median;        // ns per operation
+    double p10;
+    double p90;
+    double fastest;
+};
+
+class Bench
+{
+public:
+    explicit Bench(string_view suite, ostream& report = cout, int repetitions = 11, nanoseconds minBatch = 5ms)
+        : suite(suite), report(report), repetitions(repetitions), minBatch(minBatch) {}
+
+    // f runs one operation
+    template <typename F>
+    void run(string_view name, long long param, F f);
+
+    bool writeJson(const string& path) const;
+
+private:
+    string suite;
+    ostream& report;
+    int repetitions;
+    nanoseconds minBatch;
+
+    vector<BenchResult> results;
+};
+
+template <typename F>
+void Bench::run(string_view name, long long param, F f)
+{
+    auto timeBatch = [&](long long iterations) {
+        steady_clock::time_point begin = steady_clock::now();
+        for (long long i = 0; i < iterations; ++i) {
+            f();
+            ClobberMemory();
+        }
+        return nanoseconds(steady_clock::now() - begin);
+    };
+
+    long long iterations = 1;
+    while (timeBatch(iterations) < minBatch)
+        iterations *= 2;
+
+    vector<double> samples;
+    for (int r = 0; r < repetitions; ++r)
+        samples.push_back(double(timeBatch(iterations).count()) / iterations);
+
+    sort(samples.begin(), samples.end());
+    auto at = [&](double ratio) { return samples[static_cast<size_t>(ratio * (samples.size() - 1) + 0.5)]; };
+
+    BenchResult result{ string(name), param, iterations, at(0.5), at(0.1), at(0.9), samples.front() };
+    results.push_back(result);
+
+    report << name << " [" << param << "]: median " << result.median << " ns"
+           << ", p10: " << result.p10 << ", p90: " << result.p90 << ", iterations: " << iterations << endl;
+}
 
-        cout << "start sound: " << soundId << ", " << volume << endl;
+bool Bench::writeJson(const string& path) const
+{
+    ofstream out(path);
+    if (!out)
+        return false;
+
+    out << "{\n  \"suite\": \"" << suite << "\",\n  \"results\": [\n";
 
-        head = (head + 1) % MAX_SIZE;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        out << "    { \"name\": \"" << r.name << "\", \"param\": " << r.param << ", \"iterations\": " << r.iterations
+            << ", \"median_ns\": " << r.median << ", \"p10_ns\": " << r.p10 << ", \"p90_ns\": " << r.p90
+            << ", \"min_ns\": " << r.fastest << " }" << (i + 1 < results.size() ? "," : "") << "\n";
     }
+
+    out << "  ]\n}\n";
+    return true;
 }
 
 
-int main()
+// single threaded cost of the audio queue building blocks, the param is the
+// messages per operation
+void BenchAudioQueue(Bench& bench)
+{
+    SoundMessage msg{ 0, 100, steady_clock::time_point(), 0, steady_clock::time_point::max() };
+    array<SoundMessage, 64> batch;
+
+    for (int batchSize : { 1, 16, 64 }) {
+        auto ring = make_unique<MpscQueue<SoundMessage, 1024>>();
+        bench.run("mpsc push and drain", batchSize, [&] {
+            for (int i = 0; i < batchSize; ++i) {
+                msg.soundId = i;
+                ring->tryPush(msg);
+            }
+            DoNotOptimize(ring->drain(batch.data(), batchSize));
+        });
+
+        auto queue = make_unique<EventQueue<SoundMessage, 1024, 2>>();
+        bench.run("event queue push and drain", batchSize, [&] {
+            for (int i = 0; i < batchSize; ++i) {
+                msg.soundId = i;
+                queue->push(msg, i & 1);
+            }
+            DoNotOptimize(queue->drain(batch.data(), batchSize));
+        });
+
+        // every sound is queued once and merged once before the consumer takes it
+        auto index = make_unique<CoalescingIndex<1024>>();
+        bench.run("coalescing merge and take", batchSize, [&] {
+            for (int i = 0; i < batchSize; ++i) {
+                index->merge(i, 10);
+                index->merge(i, 20);
+            }
+            for (int i = 0; i < batchSize; ++i)
+                DoNotOptimize(index->take(i, 10));
+        });
+    }
+
+    auto telemetry = make_unique<AudioTelemetry>();
+    bench.run("telemetry record", 1, [&] {
+        telemetry->recordRequest();
+        telemetry->recordQueued(3);
+    });
+}
+
+int main(int argc, char* argv[])
 {
+    if (argc > 1 && string_view(argv[1]) == "--bench") {
+        Bench bench("event-queue");
+        BenchAudioQueue(bench);
+
+        if (argc > 2 && !bench.writeJson(argv[2]))
+            cout << "cannot write: " << argv[2] << endl;
+        return 0;
+    }
+
     for (int i = 1; i < 10; ++i)
         Audio::instance().playSound(i, i + 1);
 
@@ -93,10 +1639,57 @@ int main()
     for (int i = 100; i < 105; ++i)
         Audio::instance().playSound(i, i + 1);
 
+    Audio::instance().playSound(200, 100, SoundLane::Critical, 10);
+
+    // same id in the critical lane, queued on its own instead of merged into the ambient one
+    Audio::instance().playSound(104, 50, SoundLane::Critical, 10);
+
     Audio::instance().playSound(-1, 0); // for end
 
     t1.join();
 
+    Audio::instance().reportLatency();
+    PrintVoiceStats(Audio::instance().voiceStats());
+    PrintTelemetry(cout, Audio::instance().telemetry().snapshot());
+
+    cout << endl << "frame budget =======" << endl;
+
+    TestFrameBudget();
+
+    cout << endl << "voice allocation =======" << endl;
+
+    TestVoiceAllocation<8>();
+    TestVoiceAllocation<16>();
+    TestVoiceAllocation<32>();
+    TestVoiceAllocation<64>();
+
+    cout << endl << "particle spawn queue =======" << endl;
+
+    TestParticleSpawnQueue();
+
+    cout << endl << "wakeup latency =======" << endl;
+
+    TestWakeupLatency("poll 100ms", 100ms, 0);
+    TestWakeupLatency("blocking", 0ms, 0);
+    TestWakeupLatency("spin then block", 0ms, 1000);
+
+    cout << endl << "queue contention =======" << endl;
+
+    TestQueueContention(OverflowPolicy::DropNewest, "drop newest");
+    TestQueueContention(OverflowPolicy::DropOldest, "drop oldest");
+    TestQueueContention(OverflowPolicy::Block, "block");
+
+    cout << endl << "coalescing =======" << endl;
+
+    TestCoalescing(16);
+    TestCoalescing(256);
+    TestCoalescing(4096);
+    TestSaturatedCoalescing();
+    TestCoalescedPriority();
+
+    cout << endl << "telemetry =======" << endl;
+
+    TestTelemetryCost();
+
     return 0;
 }
-
@@ -1,13 +1,226 @@
 ﻿#include <iostream>
+#include <string>
+#include <vector>
+#include <array>
+#include <algorithm>
 #include <chrono>
 #include <thread>
 
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 
 // tested x64, c++17
 
 using namespace std;
 using namespace std::chrono;
 
+// hardware counters through perf_event_open, opened as one group on the
+// calling thread so they all count over the same interval. a counter the
+// host refuses is left out, and where perf_event_open is missing or blocked
+// (containers, vms, other platforms) only the time is measured.
+const int PERF_EVENT_COUNT = 6;
+const char* const PERF_EVENT_NAMES[PERF_EVENT_COUNT] = {
+    "cycles", "instructions", "l1d misses", "llc misses", "branch misses", "dtlb misses"
+};
+
+enum PerfEvent {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_DTLB_MISSES
+};
+
+// counts of a measured interval, -1 for a counter that is not available
+struct PerfSample
+{
+    nanoseconds elapsed{ 0 };
+    array<long long, PERF_EVENT_COUNT> counts{};
+
+    PerfSample() {
+        counts.fill(-1);
+    }
+
+    bool has(PerfEvent event) const {
+        return counts[event] >= 0;
+    }
+
+    PerfSample& operator+=(const PerfSample& other);
+};
+
+PerfSample& PerfSample::operator+=(const PerfSample& other)
+{
+    elapsed += other.elapsed;
+
+    for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+        if (other.counts[i] >= 0)
+            counts[i] = max(counts[i], 0LL) + other.counts[i];
+    }
+
+    return *this;
+}
+
+class PerfCounters
+{
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available() const {
+        return leader >= 0;
+    }
+
+    // running totals, scaled up when the kernel had to multiplex the group
+    array<long long, PERF_EVENT_COUNT> read() const;
+
+private:
+    int leader = -1;
+    vector<int> fds;
+    array<int, PERF_EVENT_COUNT> slot; // place in the group read, -1 if not open
+};
+
+PerfCounters::PerfCounters()
+{
+    slot.fill(-1);
+
+#if defined(__linux__)
+    const pair<uint32_t, uint64_t> configs[PERF_EVENT_COUNT] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    };
+
+    for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = configs[i].first;
+        attr.config = configs[i].second;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        int fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0));
+        if (fd < 0) {
+            // without cycles there is no group to join
+            if (i == PERF_CYCLES)
+                return;
+            continue;
+        }
+
+        if (leader < 0)
+            leader = fd;
+
+        slot[i] = static_cast<int>(fds.size());
+        fds.push_back(fd);
+    }
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#if defined(__linux__)
+    for (int fd : fds)
+        close(fd);
+#endif
+}
+
+array<long long, PERF_EVENT_COUNT> PerfCounters::read() const
+{
+    array<long long, PERF_EVENT_COUNT> counts;
+    counts.fill(-1);
+
+#if defined(__linux__)
+    if (leader < 0)
+        return counts;
+
+    // nr, time enabled, time running, then a value per counter in open order
+    uint64_t data[3 + PERF_EVENT_COUNT] = {};
+    if (::read(leader, data, sizeof(data)) < ssize_t(3 * sizeof(uint64_t)) || data[2] == 0)
+        return counts;
+
+    double scale = double(data[1]) / double(data[2]);
+
+    for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+        if (slot[i] >= 0 && uint64_t(slot[i]) < data[0])
+            counts[i] = static_cast<long long>(double(data[3 + slot[i]]) * scale);
+    }
+#endif
+
+    return counts;
+}
+
+// adds the time and counts of its own lifetime, or up to stop, to total
+class PerfScope
+{
+public:
+    PerfScope(const PerfCounters& counters, PerfSample& total)
+        : counters(counters), total(total), begin(counters.read()), beginTime(steady_clock::now()) {}
+
+    ~PerfScope() {
+        if (!stopped)
+            stop();
+    }
+
+    void stop();
+
+private:
+    const PerfCounters& counters;
+    PerfSample& total;
+
+    array<long long, PERF_EVENT_COUNT> begin;
+    steady_clock::time_point beginTime;
+    bool stopped = false;
+};
+
+void PerfScope::stop()
+{
+    stopped = true;
+
+    PerfSample sample;
+    sample.elapsed = steady_clock::now() - beginTime;
+
+    array<long long, PERF_EVENT_COUNT> end = counters.read();
+    for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+        if (begin[i] >= 0 && end[i] >= 0)
+            sample.counts[i] = max(end[i] - begin[i], 0LL);
+    }
+
+    total += sample;
+}
+
+// time and counts divided by per, the number of units, frames or operations measured
+void PrintPerf(ostream& os, const string& label, const PerfSample& sample, double per = 1.)
+{
+    os << label << " time: " << double(sample.elapsed.count()) / per << "ns";
+
+    if (!sample.has(PERF_CYCLES)) {
+        os << ", counters unavailable" << endl;
+        return;
+    }
+
+    if (sample.has(PERF_INSTRUCTIONS) && sample.counts[PERF_CYCLES] > 0)
+        os << ", ipc: " << double(sample.counts[PERF_INSTRUCTIONS]) / double(sample.counts[PERF_CYCLES]);
+
+    for (int i = 0; i < PERF_EVENT_COUNT; ++i) {
+        if (sample.counts[i] >= 0)
+            os << ", " << PERF_EVENT_NAMES[i] << ": " << double(sample.counts[i]) / per;
+    }
+
+    os << endl;
+}
+
+
 class GameLogic
 {
 public:
@@ -19,12 +232,23 @@ public:
     void runLoop3();
     void runLoop4();
 
+    bool hasCounters() const {
+        return counters.available();
+    }
+
 private:
     void processInput() {}
     void update() {}
     void update(nanoseconds& elapsed) {}
     void render() {}
 
+    // every phase of every frame runs inside a PerfScope
+    void resetPhases();
+    void printPhases(int frameCount) const;
+
+    PerfCounters counters;
+    PerfSample inputPhase, updatePhase, renderPhase;
+
 public:
     static const int FPS = 60;
     static constexpr milliseconds MS_PER_FRAME = 1000ms / FPS;
@@ -33,6 +257,19 @@ public:
 };
 
 
+void GameLogic::resetPhases()
+{
+    inputPhase = updatePhase = renderPhase = PerfSample();
+}
+
+void GameLogic::printPhases(int frameCount) const
+{
+    PrintPerf(cout, "per frame input", inputPhase, frameCount);
+    PrintPerf(cout, "per frame update", updatePhase, frameCount);
+    PrintPerf(cout, "per frame render", renderPhase, frameCount);
+}
+
+
 void GameLogic::runLoop1()
 {
     cout << "fast as possible loop for " << LOOP_TIME << endl;
@@ -40,12 +277,13 @@ void GameLogic::runLoop1()
     int loopCount{ 0 };
     nanoseconds run_time{ 0 };
 
+    resetPhases();
     steady_clock::time_point begin = steady_clock::now();
 
     while (run_time < LOOP_TIME) {
-        processInput();
-        update();
-        render();
+        { PerfScope scope(counters, inputPhase); processInput(); }
+        { PerfScope scope(counters, updatePhase); update(); }
+        { PerfScope scope(counters, renderPhase); render(); }
 
         ++loopCount;
 
@@ -54,6 +292,7 @@ void GameLogic::runLoop1()
     }
 
     cout << "loop count: " << loopCount << endl;
+    printPhases(loopCount);
 }
 
 void GameLogic::runLoop2()
@@ -63,14 +302,15 @@ void GameLogic::runLoop2()
     int loopCount{ 0 };
     nanoseconds run_time{ 0 };
 
+    resetPhases();
     steady_clock::time_point begin = steady_clock::now();
 
     while (run_time < LOOP_TIME) {
         steady_clock::time_point begin_frame = steady_clock::now();
 
-        processInput();
-        update();
-        render();
+        { PerfScope scope(counters, inputPhase); processInput(); }
+        { PerfScope scope(counters, updatePhase); update(); }
+        { PerfScope scope(counters, renderPhase); render(); }
 
         ++loopCount;
 
@@ -84,7 +324,7 @@ void GameLogic::runLoop2()
     }
 
     cout << "loop count: " << loopCount << endl;
-
+    printPhases(loopCount);
 }
 
 void GameLogic::runLoop3()
@@ -94,6 +334,7 @@ void GameLogic::runLoop3()
     int loopCount{ 0 };
     nanoseconds run_time{ 0 };
 
+    resetPhases();
     steady_clock::time_point begin = steady_clock::now();
     steady_clock::time_point previous = steady_clock::now();
 
@@ -103,9 +344,9 @@ void GameLogic::runLoop3()
         auto elapsed = current - previous;
         previous = current;
 
-        processInput();
-        update(elapsed);
-        render();
+        { PerfScope scope(counters, inputPhase); processInput(); }
+        { PerfScope scope(counters, updatePhase); update(elapsed); }
+        { PerfScope scope(counters, renderPhase); render(); }
 
         ++loopCount;
 
@@ -114,6 +355,7 @@ void GameLogic::runLoop3()
     }
 
     cout << "loop count: " << loopCount << endl;
+    printPhases(loopCount);
 }
 
 
@@ -127,6 +369,7 @@ void GameLogic::runLoop4()
     nanoseconds run_time{ 0 };
     nanoseconds lag{ 0 };
 
+    resetPhases();
     steady_clock::time_point begin = steady_clock::now();
     steady_clock::time_point previous = steady_clock::now();
 
@@ -138,16 +381,20 @@ void GameLogic::runLoop4()
 
         lag += elapsed;
 
-        processInput();
+        { PerfScope scope(counters, inputPhase); processInput(); }
 
-        while (lag >= MS_PER_UPDATE) {
-            update();
+        {
+            PerfScope scope(counters, updatePhase);
 
-            ++updateCount;
-            lag -= MS_PER_UPDATE;
+            while (lag >= MS_PER_UPDATE) {
+                update();
+
+                ++updateCount;
+                lag -= MS_PER_UPDATE;
+            }
         }
 
-        render();
+        { PerfScope scope(counters, renderPhase); render(); }
 
         ++loopCount;
 
@@ -157,6 +404,7 @@ void GameLogic::runLoop4()
 
     cout << "loop count: " << loopCount << endl;
     cout << "update count: " << updateCount << endl;
+    printPhases(loopCount);
 }
 
 
@@ -164,6 +412,8 @@ int main()
 {
     GameLogic game;
 
+    cout << "hardware counters: " << (game.hasCounters() ? "on" : "off, time only") << endl;
+
     game.runLoop1();
     game.runLoop2();
     game.runLoop3();
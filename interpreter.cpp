@@ -1,13 +1,223 @@
 ﻿#include <iostream>
+#include <fstream>
 #include <vector>
 #include <string>
 #include <regex>
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 
 // tested x64, c++17
 
 using namespace std;
+using namespace std::chrono;
+
+// heap accounting, a copy of the one in data-locality.cpp
+atomic<long long> heapAllocations{ 0 };
+
+void* operator new(size_t size)
+{
+    heapAllocations.fetch_add(1, memory_order_relaxed);
+
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
+
+void* operator new(size_t size, align_val_t align)
+{
+    heapAllocations.fetch_add(1, memory_order_relaxed);
+
+    size_t alignment = static_cast<size_t>(align);
+#if defined(_MSC_VER)
+    void* p = _aligned_malloc(size ? size : 1, alignment);
+#else
+    void* p = aligned_alloc(alignment, (max<size_t>(size, 1) + alignment - 1) & ~(alignment - 1));
+#endif
+    if (p)
+        return p;
+    throw bad_alloc();
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+#if defined(_MSC_VER)
+void operator delete(void* p, align_val_t) noexcept { _aligned_free(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { _aligned_free(p); }
+#else
+void operator delete(void* p, align_val_t) noexcept { free(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { free(p); }
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// heap allocations since the previous take
+class AllocationCounter
+{
+public:
+    long long take() {
+        long long now = heapAllocations.load(memory_order_relaxed);
+        long long count = now - mark;
+        mark = now;
+        return count;
+    }
+
+private:
+    long long mark = heapAllocations.load(memory_order_relaxed);
+};
+
+
+// a linear arena: allocation bumps an offset, deallocation does nothing and
+// reset drops everything at once. used as a frame arena reset every frame and
+// as a level arena reset on level change. when the block runs out it bumps
+// through overflow blocks from upstream, the next reset folds them into one
+// bigger block, so after the first frames the arena stops touching the heap.
+class LinearArena : public pmr::memory_resource
+{
+public:
+    explicit LinearArena(size_t capacity, pmr::memory_resource* upstream = pmr::new_delete_resource());
+    ~LinearArena();
+
+    LinearArena(const LinearArena&) = delete;
+    LinearArena& operator=(const LinearArena&) = delete;
+
+    void reset();
+
+    // bytes handed out since the last reset, overflow blocks included
+    size_t used() const;
+
+    // the block, grown by the resets so far
+    size_t capacity() const {
+        return size;
+    }
+
+    // the block and the overflow blocks taken from upstream since the last reset
+    size_t reserved() const {
+        return size + overflowBytes;
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void*, size_t, size_t) override {}
+
+    bool do_is_equal(const pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    // overflow blocks are chained through a header at their start
+    struct Overflow
+    {
+        Overflow* next;
+        size_t bytes;
+        size_t alignment;
+        size_t offset;
+    };
+
+    static void* bump(unsigned char* base, size_t& offset, size_t limit, size_t bytes, size_t alignment);
+
+    pmr::memory_resource* upstream;
+    unsigned char* block;
+    size_t size;
+    size_t offset = 0;
+
+    Overflow* overflow = nullptr;
+    size_t overflowBytes = 0;
+};
+
+LinearArena::LinearArena(size_t capacity, pmr::memory_resource* upstream)
+    : upstream(upstream), size(capacity)
+{
+    block = static_cast<unsigned char*>(upstream->allocate(size, alignof(max_align_t)));
+}
+
+LinearArena::~LinearArena()
+{
+    reset();
+    upstream->deallocate(block, size, alignof(max_align_t));
+}
+
+size_t LinearArena::used() const
+{
+    size_t total = offset;
+
+    for (const Overflow* o = overflow; o != nullptr; o = o->next)
+        total += o->offset - sizeof(Overflow);
+
+    return total;
+}
+
+void* LinearArena::bump(unsigned char* base, size_t& offset, size_t limit, size_t bytes, size_t alignment)
+{
+    uintptr_t start = reinterpret_cast<uintptr_t>(base);
+    uintptr_t aligned = (start + offset + alignment - 1) & ~(alignment - 1);
+
+    if (aligned + bytes > start + limit)
+        return nullptr;
+
+    offset = aligned + bytes - start;
+    return reinterpret_cast<void*>(aligned);
+}
+
+void* LinearArena::do_allocate(size_t bytes, size_t alignment)
+{
+    if (void* p = bump(block, offset, size, bytes, alignment))
+        return p;
+
+    if (overflow != nullptr) {
+        if (void* p = bump(reinterpret_cast<unsigned char*>(overflow), overflow->offset, overflow->bytes, bytes, alignment))
+            return p;
+    }
+
+    // at least as big as the block, so a run of small allocations takes few
+    size_t blockAlignment = max(alignment, alignof(Overflow));
+    size_t total = max(size, sizeof(Overflow) + blockAlignment + bytes);
+    auto* extra = static_cast<Overflow*>(upstream->allocate(total, blockAlignment));
+
+    *extra = { overflow, total, blockAlignment, sizeof(Overflow) };
+    overflow = extra;
+    overflowBytes += total;
+
+    return bump(reinterpret_cast<unsigned char*>(extra), extra->offset, total, bytes, alignment);
+}
+
+void LinearArena::reset()
+{
+    if (overflow != nullptr) {
+        size_t grown = size + overflowBytes;
+
+        while (overflow != nullptr) {
+            Overflow* next = overflow->next;
+            upstream->deallocate(overflow, overflow->bytes, overflow->alignment);
+            overflow = next;
+        }
+
+        upstream->deallocate(block, size, alignof(max_align_t));
+        size = grown;
+        block = static_cast<unsigned char*>(upstream->allocate(size, alignof(max_align_t)));
+        overflowBytes = 0;
+    }
+
+    offset = 0;
+}
+
 
 struct Token
 {
@@ -106,11 +316,15 @@ int formulaValue(const string& str)
     return 0;
 }
 
-shared_ptr<Element> parse(const vector<Token>& tokens)
+// parses tokens [begin, end), the nodes come from resource
+shared_ptr<Element> parse(const vector<Token>& tokens, size_t begin, size_t end, pmr::memory_resource* resource)
 {
-    auto result = make_shared<Operation>();
+    pmr::polymorphic_allocator<Operation> operations(resource);
+    pmr::polymorphic_allocator<Integer> integers(resource);
+
+    auto result = allocate_shared<Operation>(operations);
 
-    for (int i = 0; i < tokens.size(); ++i) {
+    for (size_t i = begin; i < end; ++i) {
         auto& token = tokens[i];
 
         switch (token.type) {
@@ -120,7 +334,7 @@ shared_ptr<Element> parse(const vector<Token>& tokens)
             int value = (token.type == Token::Type::num)
                 ? stoi(token.text) : formulaValue(token.text);
 
-            auto integer = make_shared<Integer>(value);
+            auto integer = allocate_shared<Integer>(integers, value);
 
             if (result->lhs == nullptr)
                 result->lhs = integer;
@@ -133,7 +347,7 @@ shared_ptr<Element> parse(const vector<Token>& tokens)
         {
             // complete lhs, rhs
             if (result->rhs != nullptr) {
-                auto newNode = make_shared<Operation>();
+                auto newNode = allocate_shared<Operation>(operations);
                 swap(newNode, result);
                 result->lhs = newNode;
             }
@@ -144,14 +358,13 @@ shared_ptr<Element> parse(const vector<Token>& tokens)
         break;
         case Token::Type::lparen:
         {
-            int j = i;
-            for (; j < tokens.size(); ++j) {
+            size_t j = i;
+            for (; j < end; ++j) {
                 if (tokens[j].type == Token::Type::rparen)
                     break;
             }
 
-            vector<Token> subexpression(&tokens[i + 1], &tokens[j]);
-            auto element = parse(subexpression);
+            auto element = parse(tokens, i + 1, j, resource);
 
             if (result->lhs == nullptr)
                 result->lhs = element;
@@ -166,9 +379,203 @@ shared_ptr<Element> parse(const vector<Token>& tokens)
     return result;
 }
 
+shared_ptr<Element> parse(const vector<Token>& tokens, pmr::memory_resource* resource = pmr::get_default_resource())
+{
+    return parse(tokens, 0, tokens.size(), resource);
+}
+
 
-int main()
+const int FORMULA_FRAME_COUNT = 1000;
+
+// formulas are lexed once when the data loads and parsed again every frame,
+// the trees live in the frame arena and die with its reset
+void TestFormulaFrames(const map<string, string>& formulas)
 {
+    vector<vector<Token>> lexed;
+    for (const auto& formula : formulas)
+        lexed.push_back(lex(formula.second));
+
+    LinearArena frameArena(4 * 1024);
+    AllocationCounter counter;
+
+    for (pmr::memory_resource* resource : { pmr::get_default_resource(), static_cast<pmr::memory_resource*>(&frameArena) }) {
+        long long total = 0, first = 0, steady = 0;
+        counter.take();
+
+        for (int frame = 1; frame <= FORMULA_FRAME_COUNT; ++frame) {
+            for (const auto& tokens : lexed)
+                total += parse(tokens, resource)->eval();
+
+            frameArena.reset();
+
+            long long allocations = counter.take();
+            if (frame == 1)
+                first = allocations;
+            else
+                steady += allocations;
+        }
+
+        cout << (resource == &frameArena ? "frame arena" : "heap") << " parse, frame 1 heap allocations: " << first
+             << ", frames 2-" << FORMULA_FRAME_COUNT << ": " << steady << ", sum: " << total << endl;
+    }
+}
+
+
+// benchmark harness, "--bench [out.json]" runs it instead of the demo.
+// the batch size doubles until a batch takes minBatch, which also warms up
+// caches and branch predictors, then every repetition times one batch.
+#if defined(_MSC_VER)
+volatile const void* benchSink = nullptr;
+#endif
+
+// the optimizer has to assume the value is read
+template <typename T>
+void DoNotOptimize(const T& value)
+{
+#if defined(_MSC_VER)
+    benchSink = &value;
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+// and that any memory may have been read or written
+void ClobberMemory()
+{
+#if defined(_MSC_VER)
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : : "memory");
+#endif
+}
+
+struct BenchResult
+{
+    string name;
+    long long param;      // the sweep point, unit count, batch size...
+    long long iterations; // operations per repetition
+    double median;        // ns per operation
+    double p10;
+    double p90;
+    double fastest;
+};
+
+class Bench
+{
+public:
+    explicit Bench(string_view suite, ostream& report = cout, int repetitions = 11, nanoseconds minBatch = 5ms)
+        : suite(suite), report(report), repetitions(repetitions), minBatch(minBatch) {}
+
+    // f runs one operation
+    template <typename F>
+    void run(string_view name, long long param, F f);
+
+    bool writeJson(const string& path) const;
+
+private:
+    string suite;
+    ostream& report;
+    int repetitions;
+    nanoseconds minBatch;
+
+    vector<BenchResult> results;
+};
+
+template <typename F>
+void Bench::run(string_view name, long long param, F f)
+{
+    auto timeBatch = [&](long long iterations) {
+        steady_clock::time_point begin = steady_clock::now();
+        for (long long i = 0; i < iterations; ++i) {
+            f();
+            ClobberMemory();
+        }
+        return nanoseconds(steady_clock::now() - begin);
+    };
+
+    long long iterations = 1;
+    while (timeBatch(iterations) < minBatch)
+        iterations *= 2;
+
+    vector<double> samples;
+    for (int r = 0; r < repetitions; ++r)
+        samples.push_back(double(timeBatch(iterations).count()) / iterations);
+
+    sort(samples.begin(), samples.end());
+    auto at = [&](double ratio) { return samples[static_cast<size_t>(ratio * (samples.size() - 1) + 0.5)]; };
+
+    BenchResult result{ string(name), param, iterations, at(0.5), at(0.1), at(0.9), samples.front() };
+    results.push_back(result);
+
+    report << name << " [" << param << "]: median " << result.median << " ns"
+           << ", p10: " << result.p10 << ", p90: " << result.p90 << ", iterations: " << iterations << endl;
+}
+
+bool Bench::writeJson(const string& path) const
+{
+    ofstream out(path);
+    if (!out)
+        return false;
+
+    out << "{\n  \"suite\": \"" << suite << "\",\n  \"results\": [\n";
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        out << "    { \"name\": \"" << r.name << "\", \"param\": " << r.param << ", \"iterations\": " << r.iterations
+            << ", \"median_ns\": " << r.median << ", \"p10_ns\": " << r.p10 << ", \"p90_ns\": " << r.p90
+            << ", \"min_ns\": " << r.fastest << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n}\n";
+    return true;
+}
+
+
+// termCount terms over the known stats and numbers, every fourth one in parens
+string MakeFormula(int termCount)
+{
+    const char* terms[] = { "basic_dmg", "my_str", "15", "(my_wis + 20)" };
+    string formula = terms[0];
+
+    for (int i = 1; i < termCount; ++i) {
+        formula += (i % 2 == 0) ? " - " : " + ";
+        formula += terms[i % 4];
+    }
+
+    return formula;
+}
+
+void BenchFormula(Bench& bench)
+{
+    LinearArena frameArena(64 * 1024);
+
+    for (int termCount : { 2, 8, 32 }) {
+        string formula = MakeFormula(termCount);
+        vector<Token> tokens = lex(formula);
+        shared_ptr<Element> parsed = parse(tokens);
+
+        bench.run("formula lex", termCount, [&] { DoNotOptimize(lex(formula)); });
+        bench.run("formula parse", termCount, [&] { DoNotOptimize(parse(tokens)); });
+        bench.run("formula parse arena", termCount, [&] {
+            DoNotOptimize(parse(tokens, &frameArena)->eval());
+            frameArena.reset();
+        });
+        bench.run("formula eval", termCount, [&] { DoNotOptimize(parsed->eval()); });
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && string_view(argv[1]) == "--bench") {
+        Bench bench("interpreter");
+        BenchFormula(bench);
+
+        if (argc > 2 && !bench.writeJson(argv[2]))
+            cout << "cannot write: " << argv[2] << endl;
+        return 0;
+    }
+
     map<string, string> formulas = {
         { "item_cure", "basic_heal + 50" },
         { "magic_cure", "basic_heal + my_wis + 20" },
@@ -188,6 +595,10 @@ int main()
         cout << formula.first << ": " << parsed->eval() << endl << endl;
     }
 
+    cout << "arena =======" << endl;
+
+    TestFormulaFrames(formulas);
+
     return 0;
 }
 
@@ -1,11 +1,21 @@
 ﻿#include <iostream>
+#include <fstream>
 #include <variant>
 #include <array>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 
 // tested x64, c++17
 
 using namespace std;
+using namespace std::chrono;
 
 struct ParticleNub
 {
@@ -42,7 +52,7 @@ public:
     bool update();
 
 private:
-    int frameOn;
+    int frameOn = 0;
     variant<Particle*, ParticleNub> unionNub;
 };
 
@@ -124,10 +134,146 @@ void ParticlePool::viewStatus()
 }
 
 
-int main()
+// benchmark harness, "--bench [out.json]" runs it instead of the demo.
+// the batch size doubles until a batch takes minBatch, which also warms up
+// caches and branch predictors, then every repetition times one batch.
+#if defined(_MSC_VER)
+volatile const void* benchSink = nullptr;
+#endif
+
+// the optimizer has to assume the value is read
+template <typename T>
+void DoNotOptimize(const T& value)
+{
+#if defined(_MSC_VER)
+    benchSink = &value;
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+// and that any memory may have been read or written
+void ClobberMemory()
+{
+#if defined(_MSC_VER)
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : : "memory");
+#endif
+}
+
+struct BenchResult
+{
+    string name;
+    long long param;      // the sweep point, unit count, batch size...
+    long long iterations; // operations per repetition
+    double median;        // ns per operation
+    double p10;
+    double p90;
+    double fastest;
+};
+
+class Bench
+{
+public:
+    explicit Bench(string_view suite, ostream& report = cout, int repetitions = 11, nanoseconds minBatch = 5ms)
+        : suite(suite), report(report), repetitions(repetitions), minBatch(minBatch) {}
+
+    // f runs one operation
+    template <typename F>
+    void run(string_view name, long long param, F f);
+
+    bool writeJson(const string& path) const;
+
+private:
+    string suite;
+    ostream& report;
+    int repetitions;
+    nanoseconds minBatch;
+
+    vector<BenchResult> results;
+};
+
+template <typename F>
+void Bench::run(string_view name, long long param, F f)
+{
+    auto timeBatch = [&](long long iterations) {
+        steady_clock::time_point begin = steady_clock::now();
+        for (long long i = 0; i < iterations; ++i) {
+            f();
+            ClobberMemory();
+        }
+        return nanoseconds(steady_clock::now() - begin);
+    };
+
+    long long iterations = 1;
+    while (timeBatch(iterations) < minBatch)
+        iterations *= 2;
+
+    vector<double> samples;
+    for (int r = 0; r < repetitions; ++r)
+        samples.push_back(double(timeBatch(iterations).count()) / iterations);
+
+    sort(samples.begin(), samples.end());
+    auto at = [&](double ratio) { return samples[static_cast<size_t>(ratio * (samples.size() - 1) + 0.5)]; };
+
+    BenchResult result{ string(name), param, iterations, at(0.5), at(0.1), at(0.9), samples.front() };
+    results.push_back(result);
+
+    report << name << " [" << param << "]: median " << result.median << " ns"
+           << ", p10: " << result.p10 << ", p90: " << result.p90 << ", iterations: " << iterations << endl;
+}
+
+bool Bench::writeJson(const string& path) const
+{
+    ofstream out(path);
+    if (!out)
+        return false;
+
+    out << "{\n  \"suite\": \"" << suite << "\",\n  \"results\": [\n";
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        out << "    { \"name\": \"" << r.name << "\", \"param\": " << r.param << ", \"iterations\": " << r.iterations
+            << ", \"median_ns\": " << r.median << ", \"p10_ns\": " << r.p10 << ", \"p90_ns\": " << r.p90
+            << ", \"min_ns\": " << r.fastest << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n}\n";
+    return true;
+}
+
+
+// one create per frame, the lifetime decides how many of the 8 particles are alive
+void BenchParticlePool(Bench& bench)
 {
     ParticleNub nub{ 1.f, 2.f, 0.1f, 0.2f };
 
+    for (int lifeTime : { 1, 4, 8, 64 }) {
+        ParticlePool pool;
+
+        bench.run("particle pool update", lifeTime, [&] {
+            pool.create(lifeTime, nub);
+            pool.update();
+            DoNotOptimize(pool);
+        });
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && string_view(argv[1]) == "--bench") {
+        Bench bench("object-pool");
+        BenchParticlePool(bench);
+
+        if (argc > 2 && !bench.writeJson(argv[2]))
+            cout << "cannot write: " << argv[2] << endl;
+        return 0;
+    }
+
+    ParticleNub nub{ 1.f, 2.f, 0.1f, 0.2f };
+
     ParticlePool pool;
     pool.create(3, nub);
     pool.create(2, nub);
@@ -1,12 +1,86 @@
 ﻿#include <iostream>
+#include <fstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 
 // tested x64, c++17
 
 using namespace std;
+using namespace std::chrono;
+
+// heap accounting, a copy of the one in data-locality.cpp
+atomic<long long> heapAllocations{ 0 };
+
+void* operator new(size_t size)
+{
+    heapAllocations.fetch_add(1, memory_order_relaxed);
+
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw bad_alloc();
+}
+
+void* operator new(size_t size, align_val_t align)
+{
+    heapAllocations.fetch_add(1, memory_order_relaxed);
+
+    size_t alignment = static_cast<size_t>(align);
+#if defined(_MSC_VER)
+    void* p = _aligned_malloc(size ? size : 1, alignment);
+#else
+    void* p = aligned_alloc(alignment, (max<size_t>(size, 1) + alignment - 1) & ~(alignment - 1));
+#endif
+    if (p)
+        return p;
+    throw bad_alloc();
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+#if defined(_MSC_VER)
+void operator delete(void* p, align_val_t) noexcept { _aligned_free(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { _aligned_free(p); }
+#else
+void operator delete(void* p, align_val_t) noexcept { free(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { free(p); }
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// heap allocations since the previous take
+class AllocationCounter
+{
+public:
+    long long take() {
+        long long now = heapAllocations.load(memory_order_relaxed);
+        long long count = now - mark;
+        mark = now;
+        return count;
+    }
+
+private:
+    long long mark = heapAllocations.load(memory_order_relaxed);
+};
+
 
 class Unit;
 
@@ -15,13 +89,13 @@ class Observer
 {
 public:
     virtual ~Observer() = default;
-    virtual void onNotify(const Unit&, const string&) = 0;
+    virtual void onNotify(const Unit&, string_view) = 0;
 };
 
 class Quests : public Observer
 {
 public:
-    void onNotify(const Unit& unit, const string& event) override {
+    void onNotify(const Unit& unit, string_view event) override {
         cout << "quest noti: " << event << endl;
     }
 };
@@ -29,7 +103,7 @@ public:
 class Achievements : public Observer
 {
 public:
-    void onNotify(const Unit& unit, const string& event) override {
+    void onNotify(const Unit& unit, string_view event) override {
         cout << "achievement noti: " << event << endl;
     }
 };
@@ -42,7 +116,7 @@ public:
 
     void addObserver(Observer* obs);
     void removeObserver(Observer* obs);
-    void notify(const Unit& unit, const string& event);
+    void notify(const Unit& unit, string_view event);
 
 private:
     vector<Observer*> observers;
@@ -65,7 +139,7 @@ void Observable::removeObserver(Observer* obs)
     cout << "remove observer" << endl;
 }
 
-void Observable::notify(const Unit& unit, const string& event)
+void Observable::notify(const Unit& unit, string_view event)
 {
     for (auto* obs : observers)
         obs->onNotify(unit, event);
@@ -135,13 +209,13 @@ class Observer2
 {
 public:
     virtual ~Observer2() = default;
-    virtual void onNotify(const T&, const string&) = 0;
+    virtual void onNotify(const T&, string_view) = 0;
 };
 
 class Quests2 : public Observer2<Unit2>
 {
 public:
-    void onNotify(const Unit2& unit, const string& event) override {
+    void onNotify(const Unit2& unit, string_view event) override {
         cout << "quest noti: " << event << endl;
     }
 };
@@ -149,7 +223,7 @@ public:
 class Achievements2 : public Observer2<Unit2>
 {
 public:
-    void onNotify(const Unit2& unit, const string& event) override {
+    void onNotify(const Unit2& unit, string_view event) override {
         cout << "achievement noti: " << event << endl;
     }
 };
@@ -163,7 +237,7 @@ public:
 
     void addObserver(Observer2<T>* obs);
     void removeObserver(Observer2<T>* obs);
-    void notify(const T& obj, const string& event);
+    void notify(const T& obj, string_view event);
 
 private:
     vector <Observer2<T>*> observers;
@@ -189,7 +263,7 @@ void Observable2<T>::removeObserver(Observer2<T>* obs)
 }
 
 template<typename T>
-void Observable2<T>::notify(const T& obj, const string& event)
+void Observable2<T>::notify(const T& obj, string_view event)
 {
     for (auto* obs : observers)
         obs->onNotify(obj, event);
@@ -250,15 +324,215 @@ void TestObserverTemplate()
 }
 
 
+// events are string_views, so notifying with a literal builds no string
+// even when the name is too long for the small string buffer.
+// counts the event chars it sees, here and in the benchmarks
+class CountingObserver : public Observer
+{
+public:
+    void onNotify(const Unit&, string_view event) override {
+        count += event.size();
+    }
+
+    size_t count = 0;
+};
+
+const int NOTIFY_FRAME_COUNT = 1000;
+
+void TestNotifyAllocations()
+{
+    Unit unit;
+    CountingObserver quest, achievement;
+
+    streambuf* console = cout.rdbuf(nullptr);
+    unit.addObserver(&quest);
+    unit.addObserver(&achievement);
+    cout.rdbuf(console);
+
+    const char* events[] = { "jump", "swapWeapon", "useSkill", "moveTo", "enterDungeonEntrance", "questItemPickedUp" };
+    AllocationCounter counter;
+
+    for (int frame = 0; frame < NOTIFY_FRAME_COUNT; ++frame) {
+        for (const char* event : events)
+            unit.notify(unit, event);
+    }
+
+    cout << "notify frames: " << NOTIFY_FRAME_COUNT << ", heap allocations: " << counter.take()
+         << ", event chars: " << quest.count + achievement.count << endl;
+}
+
+
+
+// benchmark harness, "--bench [out.json]" runs it instead of the demo.
+// the batch size doubles until a batch takes minBatch, which also warms up
+// caches and branch predictors, then every repetition times one batch.
+#if defined(_MSC_VER)
+volatile const void* benchSink = nullptr;
+#endif
+
+// the optimizer has to assume the value is read
+template <typename T>
+void DoNotOptimize(const T& value)
+{
+#if defined(_MSC_VER)
+    benchSink = &value;
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+// and that any memory may have been read or written
+void ClobberMemory()
+{
+#if defined(_MSC_VER)
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : : "memory");
+#endif
+}
+
+struct BenchResult
+{
+    string name;
+    long long param;      // the sweep point, unit count, batch size...
+    long long iterations; // operations per repetition
+    double median;        // ns per operation
+    double p10;
+    double p90;
+    double fastest;
+};
 
-int main()
+class Bench
 {
+public:
+    explicit Bench(string_view suite, ostream& report = cout, int repetitions = 11, nanoseconds minBatch = 5ms)
+        : suite(suite), report(report), repetitions(repetitions), minBatch(minBatch) {}
+
+    // f runs one operation
+    template <typename F>
+    void run(string_view name, long long param, F f);
+
+    bool writeJson(const string& path) const;
+
+private:
+    string suite;
+    ostream& report;
+    int repetitions;
+    nanoseconds minBatch;
+
+    vector<BenchResult> results;
+};
+
+template <typename F>
+void Bench::run(string_view name, long long param, F f)
+{
+    auto timeBatch = [&](long long iterations) {
+        steady_clock::time_point begin = steady_clock::now();
+        for (long long i = 0; i < iterations; ++i) {
+            f();
+            ClobberMemory();
+        }
+        return nanoseconds(steady_clock::now() - begin);
+    };
+
+    long long iterations = 1;
+    while (timeBatch(iterations) < minBatch)
+        iterations *= 2;
+
+    vector<double> samples;
+    for (int r = 0; r < repetitions; ++r)
+        samples.push_back(double(timeBatch(iterations).count()) / iterations);
+
+    sort(samples.begin(), samples.end());
+    auto at = [&](double ratio) { return samples[static_cast<size_t>(ratio * (samples.size() - 1) + 0.5)]; };
+
+    BenchResult result{ string(name), param, iterations, at(0.5), at(0.1), at(0.9), samples.front() };
+    results.push_back(result);
+
+    report << name << " [" << param << "]: median " << result.median << " ns"
+           << ", p10: " << result.p10 << ", p90: " << result.p90 << ", iterations: " << iterations << endl;
+}
+
+bool Bench::writeJson(const string& path) const
+{
+    ofstream out(path);
+    if (!out)
+        return false;
+
+    out << "{\n  \"suite\": \"" << suite << "\",\n  \"results\": [\n";
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        out << "    { \"name\": \"" << r.name << "\", \"param\": " << r.param << ", \"iterations\": " << r.iterations
+            << ", \"median_ns\": " << r.median << ", \"p10_ns\": " << r.p10 << ", \"p90_ns\": " << r.p90
+            << ", \"min_ns\": " << r.fastest << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n}\n";
+    return true;
+}
+
+
+class CountingObserver2 : public Observer2<Unit2>
+{
+public:
+    void onNotify(const Unit2&, string_view event) override {
+        count += event.size();
+    }
+
+    size_t count = 0;
+};
+
+void BenchNotify(Bench& bench)
+{
+    const string event = "useSkill";
+
+    for (int observerCount : { 1, 4, 16, 64 }) {
+        vector<CountingObserver> observers(observerCount);
+        vector<CountingObserver2> observers2(observerCount);
+
+        Unit unit;
+        Unit2 unit2;
+
+        // add observer logs every call
+        streambuf* console = cout.rdbuf(nullptr);
+        for (int i = 0; i < observerCount; ++i) {
+            unit.addObserver(&observers[i]);
+            unit2.addObserver(&observers2[i]);
+        }
+        cout.rdbuf(console);
+        cout.clear();
+
+        bench.run("notify", observerCount, [&] { unit.notify(unit, event); });
+        bench.run("notify string literal", observerCount, [&] { unit.notify(unit, "useSkill"); });
+        bench.run("notify template", observerCount, [&] { unit2.notify(unit2, event); });
+
+        DoNotOptimize(observers[0].count + observers2[0].count);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && string_view(argv[1]) == "--bench") {
+        Bench bench("observer");
+        BenchNotify(bench);
+
+        if (argc > 2 && !bench.writeJson(argv[2]))
+            cout << "cannot write: " << argv[2] << endl;
+        return 0;
+    }
+
     TestObserverPattern();
 
     cout << endl << "using template =======" << endl;
 
     TestObserverTemplate();
 
+    cout << endl << "allocations =======" << endl;
+
+    TestNotifyAllocations();
+
     return 0;
 }
 
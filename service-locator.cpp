@@ -2,19 +2,782 @@
 #include <array>
 #include <thread>
 #include <atomic>
+#include <climits>
+#include <cstdint>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <type_traits>
+#include <memory>
 
 
 // tested x64, c++17
 
 using namespace std;
+using namespace std::chrono;
 
 struct SoundMessage
 {
     int soundId = 0;
     int volume = 0;
+    steady_clock::time_point queuedAt;
 };
 
 
+enum class OverflowPolicy {
+    DropNewest,
+    DropOldest,
+    Block
+};
+
+enum class PushResult {
+    Queued,
+    Evicted, // queued after dropping the oldest messages
+    Spilled, // queued in the growable overflow segments
+    Dropped
+};
+
+// bounded multi producer, single consumer ring buffer.
+// every slot carries a sequence number, so producers only contend on tail.
+// head is advanced with cas too, which lets a producer evict the oldest
+// message when the queue is full and the policy is DropOldest.
+template <typename T, size_t Capacity>
+class MpscQueue
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    MpscQueue();
+
+    bool tryPush(const T& item);
+    bool tryPop(T& item);
+
+    // pops up to maxCount ready messages into out, head moves once per batch
+    size_t drain(T* out, size_t maxCount);
+
+    template <typename OnEvict>
+    PushResult push(const T& item, OverflowPolicy policy, nanoseconds timeout, OnEvict onEvict);
+    PushResult push(const T& item, OverflowPolicy policy, nanoseconds timeout = 0ns) {
+        return push(item, policy, timeout, [](const T&) {});
+    }
+
+    size_t size() const {
+        size_t h = head.load(memory_order_acquire);
+        size_t t = tail.load(memory_order_acquire);
+        return min(t - h, Capacity);
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+private:
+    static const size_t CACHE_LINE = 64;
+    static const size_t MASK = Capacity - 1;
+
+    struct Slot
+    {
+        atomic<size_t> sequence;
+        T data;
+    };
+
+    array<Slot, Capacity> slots;
+
+    // producers hammer tail, the consumer owns head, keep them on separate lines
+    alignas(CACHE_LINE) atomic<size_t> head = 0;
+    alignas(CACHE_LINE) atomic<size_t> tail = 0;
+    char padding[CACHE_LINE - sizeof(atomic<size_t>)];
+};
+
+template <typename T, size_t Capacity>
+MpscQueue<T, Capacity>::MpscQueue()
+{
+    for (size_t i = 0; i < Capacity; ++i)
+        slots[i].sequence.store(i, memory_order_relaxed);
+}
+
+template <typename T, size_t Capacity>
+bool MpscQueue<T, Capacity>::tryPush(const T& item)
+{
+    size_t pos = tail.load(memory_order_relaxed);
+
+    while (true) {
+        size_t seq = slots[pos & MASK].sequence.load(memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+        if (diff == 0) {
+            if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0) {
+            return false; // full
+        }
+        else {
+            pos = tail.load(memory_order_relaxed);
+        }
+    }
+
+    Slot& slot = slots[pos & MASK];
+    slot.data = item;
+    slot.sequence.store(pos + 1, memory_order_release);
+
+    return true;
+}
+
+template <typename T, size_t Capacity>
+bool MpscQueue<T, Capacity>::tryPop(T& item)
+{
+    size_t pos = head.load(memory_order_relaxed);
+
+    while (true) {
+        size_t seq = slots[pos & MASK].sequence.load(memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+
+        if (diff == 0) {
+            if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0) {
+            return false; // empty
+        }
+        else {
+            pos = head.load(memory_order_relaxed);
+        }
+    }
+
+    Slot& slot = slots[pos & MASK];
+    item = slot.data;
+    slot.sequence.store(pos + Capacity, memory_order_release);
+
+    return true;
+}
+
+template <typename T, size_t Capacity>
+size_t MpscQueue<T, Capacity>::drain(T* out, size_t maxCount)
+{
+    size_t pos = head.load(memory_order_relaxed);
+    size_t count = 0;
+
+    while (true) {
+        count = 0;
+        maxCount = min(maxCount, Capacity);
+
+        while (count < maxCount && slots[(pos + count) & MASK].sequence.load(memory_order_acquire) == pos + count + 1)
+            ++count;
+
+        if (count == 0)
+            return 0;
+
+        // a DropOldest producer may have evicted from the front, then recount
+        if (head.compare_exchange_weak(pos, pos + count, memory_order_relaxed))
+            break;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        Slot& slot = slots[(pos + i) & MASK];
+        out[i] = slot.data;
+        slot.sequence.store(pos + i + Capacity, memory_order_release);
+    }
+
+    return count;
+}
+
+template <typename T, size_t Capacity>
+template <typename OnEvict>
+PushResult MpscQueue<T, Capacity>::push(const T& item, OverflowPolicy policy, nanoseconds timeout, OnEvict onEvict)
+{
+    PushResult result = PushResult::Queued;
+    steady_clock::time_point deadline = steady_clock::now() + timeout;
+
+    while (!tryPush(item)) {
+        switch (policy) {
+        case OverflowPolicy::DropNewest:
+            return PushResult::Dropped;
+
+        case OverflowPolicy::DropOldest: {
+            T oldest;
+            if (tryPop(oldest)) {
+                onEvict(oldest);
+                result = PushResult::Evicted;
+            }
+            break;
+        }
+
+        case OverflowPolicy::Block:
+            if (steady_clock::now() >= deadline)
+                return PushResult::Dropped;
+            this_thread::yield();
+            break;
+        }
+    }
+
+    return result;
+}
+
+
+// chunked spill storage for growable queues, emptied segments are reused
+template <typename T, size_t SegmentSize>
+class SegmentList
+{
+public:
+    void push(const T& item);
+    size_t pop(T* out, size_t maxCount);
+
+private:
+    struct Segment
+    {
+        array<T, SegmentSize> items;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    deque<unique_ptr<Segment>> segments;
+    vector<unique_ptr<Segment>> spares;
+};
+
+template <typename T, size_t SegmentSize>
+void SegmentList<T, SegmentSize>::push(const T& item)
+{
+    if (segments.empty() || segments.back()->end == SegmentSize) {
+        if (spares.empty()) {
+            segments.push_back(make_unique<Segment>());
+        }
+        else {
+            segments.push_back(move(spares.back()));
+            spares.pop_back();
+        }
+    }
+
+    Segment& segment = *segments.back();
+    segment.items[segment.end++] = item;
+}
+
+template <typename T, size_t SegmentSize>
+size_t SegmentList<T, SegmentSize>::pop(T* out, size_t maxCount)
+{
+    size_t count = 0;
+
+    while (count < maxCount && !segments.empty()) {
+        Segment& segment = *segments.front();
+        size_t n = min(segment.end - segment.begin, maxCount - count);
+
+        copy_n(segment.items.begin() + segment.begin, n, out + count);
+        segment.begin += n;
+        count += n;
+
+        if (segment.begin == segment.end) {
+            segment.begin = segment.end = 0;
+            spares.push_back(move(segments.front()));
+            segments.pop_front();
+        }
+    }
+
+    return count;
+}
+
+
+// generic event queue for any trivially copyable message.
+// lane 0 has the highest priority, drain empties it before looking at the next lane.
+// a growable queue spills into chunked segments instead of dropping, the lock-free
+// ring stays the fast path and the segments are only locked while a lane is spilled.
+template <typename T, size_t Capacity, size_t LaneCount = 1>
+class EventQueue
+{
+    static_assert(is_trivially_copyable_v<T>, "event must be trivially copyable");
+    static_assert(LaneCount >= 1, "event queue needs a lane");
+
+public:
+    explicit EventQueue(bool growable = false) : growable(growable) {}
+
+    template <typename OnEvict>
+    PushResult push(const T& item, size_t lane, OverflowPolicy policy, nanoseconds timeout, OnEvict onEvict);
+    PushResult push(const T& item, size_t lane = 0, OverflowPolicy policy = OverflowPolicy::DropNewest, nanoseconds timeout = 0ns) {
+        return push(item, lane, policy, timeout, [](const T&) {});
+    }
+
+    // pops up to maxCount messages into out, highest priority lane first
+    size_t drain(T* out, size_t maxCount);
+
+    size_t size() const;
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+private:
+    struct Lane
+    {
+        MpscQueue<T, Capacity> ring;
+
+        mutex spillLock;
+        SegmentList<T, Capacity> spill;
+        atomic<size_t> spilled = 0;
+    };
+
+    array<Lane, LaneCount> lanes;
+    const bool growable;
+};
+
+template <typename T, size_t Capacity, size_t LaneCount>
+template <typename OnEvict>
+PushResult EventQueue<T, Capacity, LaneCount>::push(const T& item, size_t laneIndex, OverflowPolicy policy, nanoseconds timeout, OnEvict onEvict)
+{
+    Lane& lane = lanes[laneIndex];
+
+    if (!growable)
+        return lane.ring.push(item, policy, timeout, onEvict);
+
+    // while a lane is spilled new messages go behind the spilled ones to keep order
+    if (lane.spilled.load(memory_order_acquire) == 0 && lane.ring.tryPush(item))
+        return PushResult::Queued;
+
+    lock_guard<mutex> guard(lane.spillLock);
+    lane.spill.push(item);
+    lane.spilled.fetch_add(1, memory_order_release);
+
+    return PushResult::Spilled;
+}
+
+template <typename T, size_t Capacity, size_t LaneCount>
+size_t EventQueue<T, Capacity, LaneCount>::drain(T* out, size_t maxCount)
+{
+    size_t count = 0;
+
+    for (auto& lane : lanes) {
+        while (count < maxCount) {
+            size_t n = lane.ring.drain(out + count, maxCount - count);
+            if (n == 0)
+                break;
+            count += n;
+        }
+
+        if (count < maxCount && lane.spilled.load(memory_order_acquire) > 0) {
+            lock_guard<mutex> guard(lane.spillLock);
+            size_t n = lane.spill.pop(out + count, maxCount - count);
+            lane.spilled.fetch_sub(n, memory_order_release);
+            count += n;
+        }
+
+        if (count == maxCount)
+            break;
+    }
+
+    return count;
+}
+
+template <typename T, size_t Capacity, size_t LaneCount>
+size_t EventQueue<T, Capacity, LaneCount>::size() const
+{
+    size_t total = 0;
+
+    for (auto& lane : lanes)
+        total += lane.ring.size() + lane.spilled.load(memory_order_acquire);
+
+    return total;
+}
+
+
+// open addressing table from sound id to the volume of its queued request.
+// keys are never removed, an entry just goes back to NOT_PENDING once the
+// consumer takes it, so lookups and merges stay lock-free. probes stop after
+// MAX_PROBE slots: once the neighbourhood of an id is taken by other ids,
+// that id is queued without merging, and a lookup never costs more than
+// MAX_PROBE slots however many ids were seen.
+template <size_t Capacity>
+class CoalescingIndex
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    // true when merged into a queued request, false when the caller has to queue it
+    bool merge(int soundId, int volume);
+    void release(int soundId);
+    int take(int soundId, int queuedVolume);
+
+private:
+    struct Entry
+    {
+        atomic<int> soundId = EMPTY_ID;
+        atomic<int> volume = NOT_PENDING;
+    };
+
+    Entry* find(int soundId, bool insert);
+
+    static size_t hash(int soundId) {
+        uint32_t h = static_cast<uint32_t>(soundId) * 0x9E3779B1u;
+        return (h ^ (h >> 16)) & MASK;
+    }
+
+    static constexpr int EMPTY_ID = INT_MIN;
+    static constexpr int NOT_PENDING = INT_MIN;
+    static constexpr size_t MASK = Capacity - 1;
+    static constexpr size_t MAX_PROBE = min<size_t>(16, Capacity);
+
+    array<Entry, Capacity> entries;
+};
+
+template <size_t Capacity>
+typename CoalescingIndex<Capacity>::Entry* CoalescingIndex<Capacity>::find(int soundId, bool insert)
+{
+    size_t index = hash(soundId);
+
+    for (size_t probe = 0; probe < MAX_PROBE; ++probe, index = (index + 1) & MASK) {
+        Entry& entry = entries[index];
+        int id = entry.soundId.load(memory_order_acquire);
+
+        if (id == EMPTY_ID) {
+            if (!insert)
+                return nullptr;
+
+            if (entry.soundId.compare_exchange_strong(id, soundId, memory_order_acq_rel))
+                return &entry;
+        }
+
+        if (id == soundId)
+            return &entry;
+    }
+
+    return nullptr; // neighbourhood full, sound is queued without merging
+}
+
+template <size_t Capacity>
+bool CoalescingIndex<Capacity>::merge(int soundId, int volume)
+{
+    Entry* entry = find(soundId, true);
+    if (entry == nullptr)
+        return false;
+
+    int current = entry->volume.load(memory_order_acquire);
+
+    while (true) {
+        if (current == NOT_PENDING) {
+            if (entry->volume.compare_exchange_weak(current, volume, memory_order_acq_rel))
+                return false;
+        }
+        else if (current >= volume) {
+            return true;
+        }
+        else if (entry->volume.compare_exchange_weak(current, volume, memory_order_acq_rel)) {
+            return true;
+        }
+    }
+}
+
+template <size_t Capacity>
+void CoalescingIndex<Capacity>::release(int soundId)
+{
+    Entry* entry = find(soundId, false);
+    if (entry != nullptr)
+        entry->volume.store(NOT_PENDING, memory_order_release);
+}
+
+template <size_t Capacity>
+int CoalescingIndex<Capacity>::take(int soundId, int queuedVolume)
+{
+    Entry* entry = find(soundId, false);
+    if (entry == nullptr)
+        return queuedVolume;
+
+    int volume = entry->volume.exchange(NOT_PENDING, memory_order_acq_rel);
+    return (volume == NOT_PENDING) ? queuedVolume : volume;
+}
+
+
+
+// the consumer parks here while its queue is empty.
+// producers only touch the mutex when the consumer is really asleep,
+// so the common enqueue path stays a load and a fence.
+class WakeEvent
+{
+public:
+    void notify();
+
+    template <typename Ready>
+    void wait(Ready ready, int spinCount);
+
+private:
+    mutex lock;
+    condition_variable cv;
+    atomic<bool> sleeping = false;
+};
+
+void WakeEvent::notify()
+{
+    // pairs with the fence in wait, either we see sleeping or the consumer sees our item
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!sleeping.load(memory_order_relaxed))
+        return;
+
+    lock_guard<mutex> guard(lock);
+    cv.notify_one();
+}
+
+template <typename Ready>
+void WakeEvent::wait(Ready ready, int spinCount)
+{
+    for (int i = 0; i < spinCount; ++i) {
+        if (ready())
+            return;
+    }
+
+    unique_lock<mutex> guard(lock);
+    sleeping.store(true, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    while (!ready())
+        cv.wait(guard);
+
+    sleeping.store(false, memory_order_relaxed);
+}
+
+
+// recording threads pick a shard round robin, so producers rarely share a cache line
+const size_t TELEMETRY_SHARDS = 8;
+
+size_t TelemetryShard()
+{
+    static atomic<size_t> nextShard = 0;
+    thread_local size_t shard = nextShard.fetch_add(1, memory_order_relaxed) % TELEMETRY_SHARDS;
+    return shard;
+}
+
+class ShardedCounter
+{
+public:
+    void add(uint64_t n = 1) {
+        shards[TelemetryShard()].value.fetch_add(n, memory_order_relaxed);
+    }
+
+    uint64_t load() const;
+
+private:
+    struct alignas(64) Shard
+    {
+        atomic<uint64_t> value = 0;
+    };
+
+    array<Shard, TELEMETRY_SHARDS> shards;
+};
+
+uint64_t ShardedCounter::load() const
+{
+    uint64_t total = 0;
+
+    for (auto& shard : shards)
+        total += shard.value.load(memory_order_relaxed);
+
+    return total;
+}
+
+// hdr style log-linear buckets. values below 16 are exact, above that every
+// power of two is split into 16 sub buckets, so a bucket is off by at most 1/16.
+class LatencyHistogram
+{
+public:
+    static const int SUB_BUCKET_BITS = 4;
+    static const int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    static const int MAX_MAGNITUDE = 40; // larger values land in the last bucket
+    static const int BUCKET_COUNT = (MAX_MAGNITUDE - SUB_BUCKET_BITS + 2) * SUB_BUCKET_COUNT;
+
+    struct Snapshot
+    {
+        array<uint64_t, BUCKET_COUNT> counts{};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+
+        // the highest value of the bucket holding the given rank
+        uint64_t percentile(double ratio) const;
+        uint64_t max() const;
+
+        double mean() const {
+            return (count == 0) ? 0.0 : double(sum) / count;
+        }
+    };
+
+    void record(uint64_t value) {
+        Shard& shard = shards[TelemetryShard()];
+        shard.counts[bucketOf(value)].fetch_add(1, memory_order_relaxed);
+        shard.sum.fetch_add(value, memory_order_relaxed);
+    }
+
+    Snapshot snapshot() const;
+
+    static int bucketOf(uint64_t value);
+    static uint64_t bucketHigh(int bucket);
+
+private:
+    struct alignas(64) Shard
+    {
+        array<atomic<uint64_t>, BUCKET_COUNT> counts{};
+        atomic<uint64_t> sum = 0;
+    };
+
+    array<Shard, TELEMETRY_SHARDS> shards;
+};
+
+int LatencyHistogram::bucketOf(uint64_t value)
+{
+    if (value < SUB_BUCKET_COUNT)
+        return static_cast<int>(value);
+
+    // index of the highest set bit, by binary search
+    int magnitude = 0;
+    for (int step = 32; step > 0; step >>= 1) {
+        if ((value >> (magnitude + step)) != 0)
+            magnitude += step;
+    }
+
+    if (magnitude > MAX_MAGNITUDE)
+        return BUCKET_COUNT - 1;
+
+    int sub = static_cast<int>(value >> (magnitude - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1);
+    return (magnitude - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT + sub;
+}
+
+uint64_t LatencyHistogram::bucketHigh(int bucket)
+{
+    if (bucket < SUB_BUCKET_COUNT)
+        return bucket;
+
+    int shift = bucket / SUB_BUCKET_COUNT - 1;
+    uint64_t low = uint64_t(SUB_BUCKET_COUNT + bucket % SUB_BUCKET_COUNT) << shift;
+    return low + (uint64_t(1) << shift) - 1;
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+{
+    Snapshot result;
+
+    for (auto& shard : shards) {
+        for (int i = 0; i < BUCKET_COUNT; ++i)
+            result.counts[i] += shard.counts[i].load(memory_order_relaxed);
+        result.sum += shard.sum.load(memory_order_relaxed);
+    }
+
+    for (uint64_t c : result.counts)
+        result.count += c;
+
+    return result;
+}
+
+uint64_t LatencyHistogram::Snapshot::percentile(double ratio) const
+{
+    if (count == 0)
+        return 0;
+
+    uint64_t rank = static_cast<uint64_t>(ratio * (count - 1));
+    uint64_t seen = 0;
+
+    for (int i = 0; i < BUCKET_COUNT; ++i) {
+        seen += counts[i];
+        if (seen > rank)
+            return bucketHigh(i);
+    }
+
+    return bucketHigh(BUCKET_COUNT - 1);
+}
+
+uint64_t LatencyHistogram::Snapshot::max() const
+{
+    for (int i = BUCKET_COUNT - 1; i >= 0; --i) {
+        if (counts[i] != 0)
+            return bucketHigh(i);
+    }
+
+    return 0;
+}
+
+
+struct AudioTelemetrySnapshot
+{
+    uint64_t requested = 0;
+    uint64_t coalesced = 0; // merged into an already queued request
+    uint64_t dropped = 0;   // queue full, the request was lost
+    uint64_t evicted = 0;   // queue full, an older request was lost for it
+    uint64_t started = 0;
+    uint64_t frames = 0;
+    uint64_t budgetCuts = 0; // frames that left a backlog for the next one
+
+    LatencyHistogram::Snapshot queueDepth;   // messages ahead of a request when it was queued
+    LatencyHistogram::Snapshot startLatency; // playSound to start sound, in ns
+
+    double coalesceRate() const {
+        return (requested == 0) ? 0.0 : double(coalesced) / requested;
+    }
+};
+
+// counters are only ever added to with relaxed atomics, a snapshot may be a
+// few events out of step between fields but never blocks the audio threads.
+class AudioTelemetry
+{
+public:
+    void recordRequest() { requested.add(); }
+    void recordCoalesced() { coalesced.add(); }
+    void recordDropped() { dropped.add(); }
+    void recordEvicted() { evicted.add(); }
+
+    void recordQueued(size_t depth) {
+        queueDepth.record(depth);
+    }
+
+    void recordStarted(nanoseconds latency) {
+        started.add();
+        startLatency.record(static_cast<uint64_t>(latency.count()));
+    }
+
+    void recordFrame(bool cut) {
+        frames.add();
+        if (cut)
+            budgetCuts.add();
+    }
+
+    AudioTelemetrySnapshot snapshot() const;
+
+private:
+    ShardedCounter requested;
+    ShardedCounter coalesced;
+    ShardedCounter dropped;
+    ShardedCounter evicted;
+    ShardedCounter started;
+    ShardedCounter frames;
+    ShardedCounter budgetCuts;
+
+    LatencyHistogram queueDepth;
+    LatencyHistogram startLatency;
+};
+
+AudioTelemetrySnapshot AudioTelemetry::snapshot() const
+{
+    AudioTelemetrySnapshot result;
+    result.requested = requested.load();
+    result.coalesced = coalesced.load();
+    result.dropped = dropped.load();
+    result.evicted = evicted.load();
+    result.started = started.load();
+    result.frames = frames.load();
+    result.budgetCuts = budgetCuts.load();
+    result.queueDepth = queueDepth.snapshot();
+    result.startLatency = startLatency.snapshot();
+    return result;
+}
+
+void PrintTelemetry(ostream& out, const AudioTelemetrySnapshot& t)
+{
+    out << "requests: " << t.requested << ", coalesced: " << int(t.coalesceRate() * 100) << "%"
+        << ", dropped: " << t.dropped << ", evicted: " << t.evicted << ", started: " << t.started << endl;
+    out << "  frames: " << t.frames << ", budget cuts: " << t.budgetCuts << endl;
+    out << "  queue depth p50: " << t.queueDepth.percentile(0.5) << ", p99: " << t.queueDepth.percentile(0.99)
+        << ", max: " << t.queueDepth.max() << endl;
+    out << "  start latency p50: " << t.startLatency.percentile(0.5) / 1000 << "us"
+        << ", p99: " << t.startLatency.percentile(0.99) / 1000 << "us"
+        << ", p999: " << t.startLatency.percentile(0.999) / 1000 << "us"
+        << ", max: " << t.startLatency.max() / 1000 << "us" << endl;
+}
+
+
 class Audio
 {
 public:
@@ -41,119 +804,648 @@ public:
 class ConsoleAudio : public Audio
 {
 public:
+    ConsoleAudio(int spinCount = 0) : spinCount(spinCount) {}
     virtual ~ConsoleAudio() = default;
 
     virtual void playSound(int soundId, int volume) override;
     virtual void update() override;
 
+    // bounds the work the audio thread does per frame, a cut frame leaves
+    // the rest of the backlog to the next frame tick
+    void setFrameBudget(size_t maxCount, nanoseconds maxTime, nanoseconds length = 16ms) {
+        frameMaxCount = maxCount;
+        frameMaxTime = maxTime;
+        frameLength = length;
+    }
+
+    void reportLatency();
+
+    // handed to the locator so dashboards can poll it
+    AudioTelemetry& telemetry() {
+        return metrics;
+    }
+
 private:
     static const int MAX_SIZE = 16;
-    array<SoundMessage, MAX_SIZE> queue;
+    static const int MAX_SOUND_IDS = 1024;
+
+    EventQueue<SoundMessage, MAX_SIZE> queue;
+    CoalescingIndex<MAX_SOUND_IDS> pending;
+
+    WakeEvent wakeEvent;
+    int spinCount;
 
-    atomic<int> head = 0;
-    atomic<int> tail = 0;
+    size_t frameMaxCount = 64;
+    nanoseconds frameMaxTime = 1ms;
+    nanoseconds frameLength = 16ms;
+
+    AudioTelemetry metrics;
 };
 
 void ConsoleAudio::playSound(int soundId, int volume)
 {
-    for (int i = head; i != tail; i = (i + 1) % MAX_SIZE) {
-        if (queue[i].soundId != soundId)
-            continue;
+    metrics.recordRequest();
 
-        // skip same sound, use the larger of the two volumes
-        queue[i].volume = max(volume, queue[i].volume);
+    // skip same sound, use the larger of the two volumes. the shutdown
+    // message is never merged, the consumer does not take it from the index
+    if (soundId != -1 && pending.merge(soundId, volume)) {
+        metrics.recordCoalesced();
         return;
     }
 
     cout << "queueing sound: " << soundId << ", " << volume << endl;
 
-    queue[tail].soundId = soundId;
-    queue[tail].volume = volume;
+    metrics.recordQueued(queue.size());
+
+    if (queue.push({ soundId, volume, steady_clock::now() }) == PushResult::Dropped) {
+        cout << "queue full, drop sound: " << soundId << endl;
+        metrics.recordDropped();
+        pending.release(soundId);
+        return;
+    }
 
-    tail = (tail + 1) % MAX_SIZE;
+    wakeEvent.notify();
 }
 
 void ConsoleAudio::update()
 {
-    int soundId = 0;
+    array<SoundMessage, MAX_SIZE> batch;
+    bool stop = false;
+
+    while (!stop) {
+        wakeEvent.wait([this] { return !queue.empty(); }, spinCount);
+
+        steady_clock::time_point frameBegin = steady_clock::now();
+        size_t started = 0;
+        bool cut = false;
+
+        // the time budget is checked between batches, a batch is always finished
+        while (!stop) {
+            if (started == frameMaxCount || steady_clock::now() - frameBegin >= frameMaxTime) {
+                cut = true;
+                break;
+            }
+
+            size_t count = queue.drain(batch.data(), min(batch.size(), frameMaxCount - started));
+            if (count == 0)
+                break;
+
+            steady_clock::time_point now = steady_clock::now();
+
+            for (size_t i = 0; i < count; ++i) {
+                int soundId = batch[i].soundId;
 
-    while (soundId != -1) {
-        this_thread::sleep_for(100ms);
+                // shutdown, whatever was queued behind it is dropped
+                if (soundId == -1) {
+                    stop = true;
+                    break;
+                }
 
-        if (head == tail)
-            continue;
+                metrics.recordStarted(now - batch[i].queuedAt);
 
-        soundId = queue[head].soundId;
-        int volume = queue[head].volume;
+                int volume = pending.take(soundId, batch[i].volume);
 
-        cout << "start sound: " << soundId << ", " << volume << endl;
+                cout << "start sound: " << soundId << ", " << volume << endl;
+            }
 
-        head = (head + 1) % MAX_SIZE;
+            started += count;
+        }
+
+        metrics.recordFrame(cut);
+
+        // the queue is not empty after a cut, so wait would return at once
+        if (cut && !stop)
+            this_thread::sleep_until(frameBegin + frameLength);
     }
 }
 
-// decorator pattern
-class LoggedAudio : public Audio
+void ConsoleAudio::reportLatency()
+{
+    LatencyHistogram::Snapshot latency = metrics.snapshot().startLatency;
+
+    cout << "enqueue to start, count: " << latency.count
+         << ", p50: " << latency.percentile(0.5) / 1000 << "us"
+         << ", p99: " << latency.percentile(0.99) / 1000 << "us" << endl;
+}
+
+// samplers decide which calls a logging layer reports
+template <uint32_t N>
+struct EveryNth
+{
+    static bool sample() {
+        thread_local uint32_t calls = 0;
+        return calls++ % N == 0;
+    }
+};
+
+template <int64_t WindowMs>
+struct PerWindow
+{
+    static bool sample() {
+        static atomic<int64_t> nextLog = 0;
+
+        int64_t now = duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+        int64_t next = nextLog.load(memory_order_relaxed);
+
+        return now >= next && nextLog.compare_exchange_strong(next, now + WindowMs, memory_order_relaxed);
+    }
+};
+
+
+// decorator pattern, resolved at compile time.
+// every layer holds the next one by value and calls it directly,
+// so a whole stack inlines into a single call.
+template <typename Next, typename Sampler = EveryNth<16>>
+class SampledLogAudio
 {
 public:
-    LoggedAudio(Audio& wrapped) : wrapped(wrapped) {}
-    virtual ~LoggedAudio() = default;
+    template <typename... Args>
+    explicit SampledLogAudio(Args&&... args) : next(forward<Args>(args)...) {}
 
-    virtual void playSound(int soundId, int volume) override {
-        cout << "log audio play sound: " << soundId << ", " << volume << endl;
-        wrapped.playSound(soundId, volume);
+    void playSound(int soundId, int volume) {
+        if (Sampler::sample())
+            cout << "log audio play sound: " << soundId << ", " << volume << endl;
+        next.playSound(soundId, volume);
     }
 
-    virtual void update() override {
+    void update() {
         cout << "log audio update begin" << endl;
-        wrapped.update();
+        next.update();
         cout << "log audio update end" << endl;
     }
 
 private:
-    Audio& wrapped;
+    Next next;
+};
+
+template <typename Next>
+class MeteredAudio
+{
+public:
+    template <typename... Args>
+    explicit MeteredAudio(Args&&... args) : next(forward<Args>(args)...) {}
+
+    // relaxed, callers on any thread are counted but nothing is ordered by it
+    void playSound(int soundId, int volume) {
+        plays.fetch_add(1, memory_order_relaxed);
+        next.playSound(soundId, volume);
+    }
+
+    void update() {
+        next.update();
+    }
+
+    uint64_t playCount() const {
+        return plays.load(memory_order_relaxed);
+    }
+
+private:
+    Next next;
+    atomic<uint64_t> plays = 0;
+};
+
+// end of a layer stack that continues through a virtual call
+class AudioRef
+{
+public:
+    AudioRef(Audio& audio) : audio(audio) {}
+
+    void playSound(int soundId, int volume) { audio.playSound(soundId, volume); }
+    void update() { audio.update(); }
+
+private:
+    Audio& audio;
+};
+
+// a layer wrapped around any Audio at runtime, one virtual call per layer
+template <typename Layer>
+class DynamicDecorator : public Audio
+{
+public:
+    DynamicDecorator(Audio& wrapped) : layer(wrapped) {}
+    virtual ~DynamicDecorator() = default;
+
+    virtual void playSound(int soundId, int volume) override {
+        layer.playSound(soundId, volume);
+    }
+
+    virtual void update() override {
+        layer.update();
+    }
+
+private:
+    Layer layer;
+};
+
+// a compile time stack behind one virtual call
+template <typename Stack>
+class ComposedAudio final : public Audio
+{
+public:
+    template <typename... Args>
+    explicit ComposedAudio(Args&&... args) : stack(forward<Args>(args)...) {}
+
+    virtual void playSound(int soundId, int volume) override {
+        stack.playSound(soundId, volume);
+    }
+
+    virtual void update() override {
+        stack.update();
+    }
+
+private:
+    Stack stack;
+};
+
+using LoggedAudio = DynamicDecorator<SampledLogAudio<AudioRef>>;
+
+
+// does next to nothing, isolates the decorator cost
+class SilentAudio final : public Audio
+{
+public:
+    virtual void playSound(int, int volume) override {
+        volumeSum += volume;
+    }
+
+    virtual void update() override {}
+
+    long long volumeSum = 0;
+};
+
+
+// epoch based reclamation. a reader publishes the epoch it entered in,
+// a writer bumps the epoch and waits until no reader is left in an older one.
+class EpochDomain
+{
+public:
+    static void enter();
+    static void leave();
+
+    // returns once every reader that could see a replaced pointer has left
+    static void synchronize();
+
+private:
+    struct Reader
+    {
+        Reader();
+        ~Reader();
+
+        atomic<uint64_t> epoch = 0; // 0 while outside a read section
+        int depth = 0;
+    };
+
+    static Reader& local() {
+        thread_local Reader reader;
+        return reader;
+    }
+
+    static inline atomic<uint64_t> globalEpoch = 1;
+    static inline mutex readersLock;
+    static inline vector<Reader*> readers;
+};
+
+EpochDomain::Reader::Reader()
+{
+    lock_guard<mutex> guard(readersLock);
+    readers.push_back(this);
+}
+
+EpochDomain::Reader::~Reader()
+{
+    lock_guard<mutex> guard(readersLock);
+    readers.erase(find(readers.begin(), readers.end(), this));
+}
+
+void EpochDomain::enter()
+{
+    Reader& reader = local();
+    if (reader.depth++ > 0)
+        return;
+
+    reader.epoch.store(globalEpoch.load(memory_order_relaxed), memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst); // publish the epoch before loading any service
+}
+
+void EpochDomain::leave()
+{
+    Reader& reader = local();
+    if (--reader.depth == 0)
+        reader.epoch.store(0, memory_order_release);
+}
+
+void EpochDomain::synchronize()
+{
+    uint64_t target = globalEpoch.fetch_add(1, memory_order_seq_cst) + 1;
+
+    lock_guard<mutex> guard(readersLock);
+
+    for (auto* reader : readers) {
+        while (true) {
+            uint64_t epoch = reader->epoch.load(memory_order_acquire);
+            if (epoch == 0 || epoch >= target)
+                break;
+            this_thread::yield();
+        }
+    }
+}
+
+
+// keeps the service alive until the end of the full expression
+template <typename T>
+class ServiceRef
+{
+public:
+    explicit ServiceRef(T* service) : service(service) {}
+    ~ServiceRef() { EpochDomain::leave(); }
+
+    ServiceRef(const ServiceRef&) = delete;
+    ServiceRef& operator=(const ServiceRef&) = delete;
+
+    T* operator->() const { return service; }
+    T& operator*() const { return *service; }
+
+private:
+    T* service;
+};
+
+// the fallback a service type starts with and goes back to on provide(nullptr)
+template <typename T>
+struct NullService;
+
+template <>
+struct NullService<Audio>
+{
+    using type = NullAudio;
+};
+
+// nothing records into it, so dashboards just read zeros
+template <>
+struct NullService<AudioTelemetry>
+{
+    using type = AudioTelemetry;
 };
 
 
+// one slot per service type, lookup is a single atomic load
 class Locator
 {
 public:
-    static Audio& getAudio() {
-        return *service;
+    template <typename T>
+    static ServiceRef<T> get() {
+        EpochDomain::enter();
+        return ServiceRef<T>(Slot<T>::current.load(memory_order_acquire));
     }
 
-    static void provide(Audio* audio) {
-        service = (audio == nullptr) ? &nullService : audio;
+    static ServiceRef<Audio> getAudio() {
+        return get<Audio>();
     }
 
+    // the caller keeps ownership, when this returns no reader sees the old service anymore
+    template <typename T>
+    static void provide(T* service);
+
+    // the locator owns the service, the old owned one is destroyed after the grace period
+    template <typename T>
+    static void provide(unique_ptr<T> service);
+
 private:
-    static inline NullAudio nullService;
-    static inline Audio* service = &nullService;
+    template <typename T>
+    struct Slot
+    {
+        static inline typename NullService<T>::type nullService;
+        static inline atomic<T*> current = &nullService;
+
+        static inline mutex writeLock;
+        static inline unique_ptr<T> owned;
+    };
 };
 
+template <typename T>
+void Locator::provide(T* service)
+{
+    lock_guard<mutex> guard(Slot<T>::writeLock);
+
+    Slot<T>::current.store((service == nullptr) ? &Slot<T>::nullService : service, memory_order_seq_cst);
+    EpochDomain::synchronize();
+
+    Slot<T>::owned.reset();
+}
+
+template <typename T>
+void Locator::provide(unique_ptr<T> service)
+{
+    lock_guard<mutex> guard(Slot<T>::writeLock);
+
+    Slot<T>::current.store((service == nullptr) ? &Slot<T>::nullService : service.get(), memory_order_seq_cst);
+    EpochDomain::synchronize();
+
+    Slot<T>::owned = move(service);
+}
+
+
+void TestHotSwap()
+{
+    const int MAX_READER_COUNT = 4;
+    const milliseconds RUN_TIME = 300ms;
+
+    // services talk to cout on every call, keep the stress run quiet
+    streambuf* console = cout.rdbuf(nullptr);
+
+    ConsoleAudio base;
+    LoggedAudio logged(base);
+
+    atomic<bool> running = true;
+    atomic<long long> callCount = 0;
+
+    vector<thread> readers;
+    for (int r = 0; r < MAX_READER_COUNT; ++r) {
+        readers.emplace_back([&, r] {
+            long long calls = 0;
+            while (running.load(memory_order_relaxed)) {
+                Locator::get<Audio>()->playSound(r, static_cast<int>(calls & 127));
+                ++calls;
+            }
+            callCount += calls;
+        });
+    }
+
+    int swapCount = 0;
+    steady_clock::time_point begin = steady_clock::now();
+
+    while (steady_clock::now() - begin < RUN_TIME) {
+        switch (swapCount % 4) {
+        case 0: Locator::provide<Audio>(make_unique<ConsoleAudio>()); break;
+        case 1: Locator::provide<Audio>(&logged); break;
+        case 2: Locator::provide<Audio>(make_unique<NullAudio>()); break;
+        case 3: Locator::provide<Audio>(nullptr); break;
+        }
+        ++swapCount;
+    }
+
+    running = false;
+    for (auto& t : readers)
+        t.join();
+
+    Locator::provide<Audio>(nullptr);
+
+    cout.rdbuf(console);
+    cout.clear();
+
+    cout << "hot swap, swaps: " << swapCount << ", play calls: " << callCount << endl;
+}
+
+
+void TestDecoratorCost()
+{
+    const int MAX_CALL_COUNT = 10000000;
+
+    using BenchLog = EveryNth<1024>;
+
+    SilentAudio plain;
+
+    SilentAudio dynamicBase;
+    DynamicDecorator<MeteredAudio<AudioRef>> dynamicMetered(dynamicBase);
+    DynamicDecorator<SampledLogAudio<AudioRef, BenchLog>> dynamicLogged(dynamicMetered);
+
+    ComposedAudio<SampledLogAudio<MeteredAudio<SilentAudio>, BenchLog>> composed;
+
+    // samples by time, every call reads the clock
+    ComposedAudio<SampledLogAudio<MeteredAudio<SilentAudio>, PerWindow<100>>> windowed;
+
+    // through a table, so the compiler cannot see the concrete types
+    vector<pair<string_view, Audio*>> paths = {
+        { "plain", &plain },
+        { "virtual decorated", &dynamicLogged },
+        { "static composed", &composed },
+        { "static composed, 100ms window", &windowed },
+    };
+
+    streambuf* console = cout.rdbuf(nullptr);
+    vector<nanoseconds> elapsed;
+
+    for (auto& [name, audio] : paths) {
+        steady_clock::time_point begin = steady_clock::now();
+
+        for (int i = 0; i < MAX_CALL_COUNT; ++i)
+            audio->playSound(i & 255, i & 127);
+
+        elapsed.push_back(steady_clock::now() - begin);
+    }
+
+    cout.rdbuf(console);
+    cout.clear();
+
+    for (size_t i = 0; i < paths.size(); ++i)
+        cout << paths[i].first << ": " << double(elapsed[i].count()) / MAX_CALL_COUNT << " ns/call" << endl;
+
+    cout << "volume sums: " << plain.volumeSum << ", " << dynamicBase.volumeSum << endl;
+}
+
+
+// producers and the audio thread run quietly, a dashboard stand-in polls the
+// telemetry through the locator like an external tool would.
+void TestTelemetryDashboard()
+{
+    const int MAX_PRODUCER_COUNT = 4;
+    const int MAX_POLL_COUNT = 5;
+    const milliseconds POLL_INTERVAL = 100ms;
+
+    streambuf* console = cout.rdbuf(nullptr);
+    ostream dashboard(console);
+
+    ConsoleAudio audio;
+    Locator::provide<Audio>(&audio);
+    Locator::provide<AudioTelemetry>(&audio.telemetry());
+
+    atomic<bool> producing = true;
+    atomic<bool> stopped = false;
+
+    thread consumer{ [&] {
+        audio.update();
+        stopped = true;
+    } };
+
+    vector<thread> producers;
+    for (int p = 0; p < MAX_PRODUCER_COUNT; ++p) {
+        producers.emplace_back([&, p] {
+            uint32_t seed = 12345u + p;
+            while (producing.load(memory_order_relaxed)) {
+                // bursts of a few hot sounds coalesce, the rest are spread out
+                for (int i = 0; i < 8; ++i) {
+                    seed = seed * 1664525u + 1013904223u;
+                    int soundId = ((seed >> 8) % 2 == 0) ? int(seed >> 29) : int((seed >> 12) % 512);
+                    Locator::getAudio()->playSound(soundId, int(seed & 127));
+                }
+                this_thread::sleep_for(200us);
+            }
+        });
+    }
+
+    for (int poll = 0; poll < MAX_POLL_COUNT; ++poll) {
+        this_thread::sleep_for(POLL_INTERVAL);
+        dashboard << "poll " << poll << ", ";
+        PrintTelemetry(dashboard, Locator::get<AudioTelemetry>()->snapshot());
+    }
+
+    producing = false;
+    for (auto& t : producers)
+        t.join();
+
+    while (!stopped) {
+        audio.playSound(-1, 0); // for end
+        this_thread::sleep_for(1ms);
+    }
+    consumer.join();
+
+    Locator::provide<AudioTelemetry>(nullptr);
+    Locator::provide<Audio>(nullptr);
+
+    cout.rdbuf(console);
+    cout.clear();
+
+    cout << "after reset, requests: " << Locator::get<AudioTelemetry>()->snapshot().requested << endl;
+}
+
 
 int main()
 {
     ConsoleAudio csAudio;
-    Locator::provide(&csAudio);
+    Locator::provide<Audio>(&csAudio);
 
-    LoggedAudio logAudio(Locator::getAudio());
-    Locator::provide(&logAudio);
+    LoggedAudio logAudio(csAudio);
+    Locator::provide<Audio>(&logAudio);
 
     for (int i = 1; i < 10; ++i)
-        Locator::getAudio().playSound(i, i + 1);
+        Locator::getAudio()->playSound(i, i + 1);
 
-    thread t1{ &Audio::update, ref(Locator::getAudio()) };
+    thread t1{ &Audio::update, ref(logAudio) };
 
     this_thread::sleep_for(600ms);
 
     for (int i = 100; i < 105; ++i)
-        Locator::getAudio().playSound(i, i + 1);
+        Locator::getAudio()->playSound(i, i + 1);
 
-    Locator::getAudio().playSound(-1, 0); // for end
+    Locator::getAudio()->playSound(-1, 0); // for end
 
     t1.join();
 
+    csAudio.reportLatency();
+
+    // the demo services live on this stack frame
+    Locator::provide<Audio>(nullptr);
+
+    cout << endl << "hot swap =======" << endl;
+
+    TestHotSwap();
+
+    cout << endl << "decorator cost =======" << endl;
+
+    TestDecoratorCost();
+
+    cout << endl << "telemetry =======" << endl;
+
+    TestTelemetryDashboard();
+
     return 0;
 }
-
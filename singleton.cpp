@@ -1,13 +1,424 @@
 ﻿#include <iostream>
 #include <fstream>
+#include <sstream>
 #include <vector>
 #include <string>
 #include <string_view>
+#include <array>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <charconv>
+#include <type_traits>
+#include <new>
+#include <iterator>
+#include <cstddef>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 
 // tested x64, c++17
 
 using namespace std;
+using namespace std::chrono;
+
+// build with -DLOGGER_MAX_LEVEL=0 to compile out every call above Error, 1 for Info
+#ifndef LOGGER_MAX_LEVEL
+#define LOGGER_MAX_LEVEL 2
+#endif
+
+
+// minimal "{}" formatter, c++17 has no std::format
+inline void AppendArg(string& out, string_view value) { out.append(value); }
+inline void AppendArg(string& out, const char* value) { out.append(value); }
+inline void AppendArg(string& out, const string& value) { out.append(value); }
+inline void AppendArg(string& out, char value) { out.push_back(value); }
+inline void AppendArg(string& out, bool value) { out.append(value ? "true" : "false"); }
+
+template <typename T>
+void AppendArg(string& out, T value)
+{
+    static_assert(is_arithmetic_v<T>, "unsupported log argument");
+
+    char buffer[32];
+    to_chars_result result = to_chars(begin(buffer), end(buffer), value);
+    out.append(buffer, result.ptr);
+}
+
+inline void FormatTo(string& out, string_view format)
+{
+    out.append(format);
+}
+
+template <typename T, typename... Rest>
+void FormatTo(string& out, string_view format, const T& first, const Rest&... rest)
+{
+    size_t pos = format.find("{}");
+    if (pos == string_view::npos) {
+        out.append(format);
+        return;
+    }
+
+    out.append(format.substr(0, pos));
+    AppendArg(out, first);
+    FormatTo(out, format.substr(pos + 2), rest...);
+}
+
+
+// file backed shared mapping, the os writes dirty pages back even when the process dies
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        close();
+    }
+
+    bool create(const char* path, size_t size);
+    void close();
+
+    uint8_t* data() const {
+        return base;
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+    uint8_t* base = nullptr;
+    size_t length = 0;
+};
+
+bool MappedFile::create(const char* path, size_t size)
+{
+    close();
+
+#ifdef _WIN32
+    file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE,
+        static_cast<DWORD>(uint64_t(size) >> 32), static_cast<DWORD>(size & 0xffffffff), nullptr);
+    void* view = (mapping != nullptr) ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size) : nullptr;
+#else
+    fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    void* view = (ftruncate(fd, static_cast<off_t>(size)) == 0)
+        ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (view == MAP_FAILED)
+        view = nullptr;
+#endif
+
+    if (view == nullptr) {
+        close();
+        return false;
+    }
+
+    base = static_cast<uint8_t*>(view);
+    length = size;
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (base != nullptr)
+        UnmapViewOfFile(base);
+    if (mapping != nullptr)
+        CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+
+    file = INVALID_HANDLE_VALUE;
+    mapping = nullptr;
+#else
+    if (base != nullptr)
+        munmap(base, length);
+    if (fd >= 0)
+        ::close(fd);
+
+    fd = -1;
+#endif
+    base = nullptr;
+    length = 0;
+}
+
+
+// binary ring file layout: header, format string table, fixed size record slots.
+// a record keeps the format id and the raw arguments, the decoder formats it offline.
+namespace binlog
+{
+    const char MAGIC[8] = { 'P', 'L', 'O', 'G', 'R', 'N', 'G', '1' };
+
+    const size_t MAX_ARGS = 8;
+    const size_t MAX_PAYLOAD = 96;
+    const size_t MAX_FORMATS = 1024;
+    const size_t MAX_FORMAT_TEXT = 128;
+
+    enum class ArgType : uint8_t {
+        Int,
+        Double,
+        String
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t slotCount;
+        atomic<uint32_t> formatCount; // published after the format text is in the table
+        atomic<uint64_t> nextSequence;
+    };
+
+    struct RecordBody
+    {
+        int64_t timestamp;
+        uint32_t formatId;
+        uint8_t level;
+        uint8_t argCount;
+        uint8_t payloadSize;
+        uint8_t reserved;
+        ArgType argTypes[MAX_ARGS];
+        uint8_t payload[MAX_PAYLOAD]; // 8 byte numbers, strings as length and bytes
+    };
+
+    struct Record
+    {
+        atomic<uint64_t> sequence; // 0 while being written, a torn slot is skipped
+        RecordBody body;
+    };
+
+    const size_t HEADER_SIZE = 64;
+    const size_t TABLE_OFFSET = HEADER_SIZE;
+    const size_t SLOT_OFFSET = TABLE_OFFSET + MAX_FORMATS * MAX_FORMAT_TEXT;
+
+    static_assert(sizeof(Header) <= HEADER_SIZE, "header does not fit");
+    static_assert(sizeof(Record) == 128, "record slot is 128 bytes");
+    static_assert(sizeof(atomic<uint64_t>) == sizeof(uint64_t), "sequence is read back as a plain integer");
+
+    inline bool Encode(RecordBody& body, ArgType type, const void* data, size_t size) {
+        if (body.argCount == MAX_ARGS || body.payloadSize + size > MAX_PAYLOAD)
+            return false; // arguments that do not fit are left out
+
+        body.argTypes[body.argCount++] = type;
+        memcpy(body.payload + body.payloadSize, data, size);
+        body.payloadSize += static_cast<uint8_t>(size);
+        return true;
+    }
+
+    inline void EncodeArg(RecordBody& body, string_view value) {
+        size_t room = MAX_PAYLOAD - body.payloadSize;
+        if (room < 2)
+            return;
+
+        uint8_t length = static_cast<uint8_t>(min(value.size(), room - 1));
+        uint8_t buffer[MAX_PAYLOAD];
+        buffer[0] = length;
+        memcpy(buffer + 1, value.data(), length);
+        Encode(body, ArgType::String, buffer, length + 1u);
+    }
+
+    inline void EncodeArg(RecordBody& body, const char* value) { EncodeArg(body, string_view(value)); }
+    inline void EncodeArg(RecordBody& body, const string& value) { EncodeArg(body, string_view(value)); }
+    inline void EncodeArg(RecordBody& body, char value) { EncodeArg(body, string_view(&value, 1)); }
+
+    template <typename T>
+    void EncodeArg(RecordBody& body, T value) {
+        static_assert(is_arithmetic_v<T>, "unsupported log argument");
+
+        if constexpr (is_floating_point_v<T>) {
+            double number = static_cast<double>(value);
+            Encode(body, ArgType::Double, &number, sizeof(number));
+        }
+        else {
+            int64_t number = static_cast<int64_t>(value);
+            Encode(body, ArgType::Int, &number, sizeof(number));
+        }
+    }
+}
+
+// alternate Logger sink: records are copied into a memory mapped ring file,
+// the hot path is a fetch_add and a memcpy, no syscall
+class BinaryRingSink
+{
+public:
+    bool open(const char* path, uint32_t slotCount);
+    void close();
+
+    bool isOpen() const {
+        return header != nullptr;
+    }
+
+    template <typename... Args>
+    void write(uint8_t level, string_view format, const Args&... args);
+
+private:
+    uint32_t formatId(string_view format);
+    uint32_t registerFormat(string_view format);
+
+    bool formatMatches(uint32_t id, string_view text) const {
+        const char* entry = formatTable + id * binlog::MAX_FORMAT_TEXT;
+        return memcmp(entry, text.data(), text.size()) == 0 && entry[text.size()] == '\0';
+    }
+
+    static const size_t MAX_FORMAT_CACHE = 4096;
+
+    MappedFile file;
+    binlog::Header* header = nullptr;
+    char* formatTable = nullptr;
+    binlog::Record* slots = nullptr;
+
+    // formats are looked up by address and checked against the table text,
+    // registration is the cold path
+    array<atomic<const char*>, MAX_FORMAT_CACHE> cacheKeys{};
+    array<atomic<uint32_t>, MAX_FORMAT_CACHE> cacheIds{};
+    mutex registerLock;
+};
+
+bool BinaryRingSink::open(const char* path, uint32_t slotCount)
+{
+    close();
+
+    if (!file.create(path, binlog::SLOT_OFFSET + size_t(slotCount) * sizeof(binlog::Record)))
+        return false;
+
+    uint8_t* base = file.data();
+    header = new (base) binlog::Header{};
+    memcpy(header->magic, binlog::MAGIC, sizeof(binlog::MAGIC));
+    header->slotCount = slotCount;
+
+    formatTable = reinterpret_cast<char*>(base + binlog::TABLE_OFFSET);
+    slots = reinterpret_cast<binlog::Record*>(base + binlog::SLOT_OFFSET);
+
+    for (auto& key : cacheKeys)
+        key.store(nullptr, memory_order_relaxed);
+
+    return true;
+}
+
+void BinaryRingSink::close()
+{
+    header = nullptr;
+    formatTable = nullptr;
+    slots = nullptr;
+    file.close();
+}
+
+// called with registerLock held
+uint32_t BinaryRingSink::registerFormat(string_view format)
+{
+    uint32_t count = header->formatCount.load(memory_order_relaxed);
+    string_view text = format.substr(0, binlog::MAX_FORMAT_TEXT - 1);
+
+    for (uint32_t id = 0; id < count; ++id) {
+        if (text == formatTable + id * binlog::MAX_FORMAT_TEXT)
+            return id;
+    }
+
+    if (count == binlog::MAX_FORMATS)
+        return 0;
+
+    char* entry = formatTable + count * binlog::MAX_FORMAT_TEXT;
+    memcpy(entry, text.data(), text.size());
+    entry[text.size()] = '\0';
+
+    header->formatCount.store(count + 1, memory_order_release);
+    return count;
+}
+
+// the address only finds the slot: a format built at runtime may reuse the
+// buffer of another one, so the cached id counts only if its text matches
+uint32_t BinaryRingSink::formatId(string_view format)
+{
+    string_view text = format.substr(0, binlog::MAX_FORMAT_TEXT - 1);
+
+    size_t first = (reinterpret_cast<uintptr_t>(format.data()) >> 3) % MAX_FORMAT_CACHE;
+    size_t index = first;
+
+    for (size_t probe = 0; probe < MAX_FORMAT_CACHE; ++probe, index = (index + 1) % MAX_FORMAT_CACHE) {
+        const char* key = cacheKeys[index].load(memory_order_acquire);
+
+        if (key == format.data()) {
+            uint32_t id = cacheIds[index].load(memory_order_acquire);
+            if (formatMatches(id, text))
+                return id;
+            break;
+        }
+
+        if (key == nullptr)
+            break;
+    }
+
+    // first use of this format, or its buffer now holds another text.
+    // inserts are serialized by the lock
+    lock_guard<mutex> guard(registerLock);
+    uint32_t id = registerFormat(format);
+
+    // a full table hands out id 0 for a different text, that is not cached
+    if (!formatMatches(id, text))
+        return id;
+
+    index = first;
+    for (size_t probe = 0; probe < MAX_FORMAT_CACHE; ++probe, index = (index + 1) % MAX_FORMAT_CACHE) {
+        const char* key = cacheKeys[index].load(memory_order_relaxed);
+
+        if (key == format.data()) {
+            cacheIds[index].store(id, memory_order_release);
+            break;
+        }
+
+        if (key == nullptr) {
+            cacheIds[index].store(id, memory_order_relaxed);
+            cacheKeys[index].store(format.data(), memory_order_release);
+            break;
+        }
+    }
+
+    return id;
+}
+
+template <typename... Args>
+void BinaryRingSink::write(uint8_t level, string_view format, const Args&... args)
+{
+    binlog::RecordBody body;
+    body.timestamp = steady_clock::now().time_since_epoch().count();
+    body.formatId = formatId(format);
+    body.level = level;
+    body.argCount = 0;
+    body.payloadSize = 0;
+    body.reserved = 0;
+    (binlog::EncodeArg(body, args), ...);
+
+    uint64_t sequence = header->nextSequence.fetch_add(1, memory_order_relaxed) + 1;
+    binlog::Record& slot = slots[(sequence - 1) % header->slotCount];
+
+    slot.sequence.store(0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&slot.body, &body, sizeof(body));
+    slot.sequence.store(sequence, memory_order_release);
+}
+
 
 class Logger final
 {
@@ -29,37 +440,159 @@ public:
     Logger& operator=(const Logger&) = delete;
     Logger& operator=(Logger&&) = delete;
 
+    // the levels may change while the writer thread reads them
     void setFileLevel(Level level) {
-        fileLevel = level;
+        fileLevel.store(level, memory_order_relaxed);
     }
 
     void setConsoleLevel(Level level) {
-        consoleLevel = level;
+        consoleLevel.store(level, memory_order_relaxed);
+    }
+
+    void setBinaryLevel(Level level) {
+        binaryLevel.store(level, memory_order_relaxed);
+    }
+
+    // binary ring sink, records keep their raw arguments and are decoded offline
+    bool openBinaryLog(const char* path, uint32_t slotCount) {
+        return binarySink.open(path, slotCount);
     }
 
+    void closeBinaryLog() {
+        binarySink.close();
+    }
+
+    static bool decodeBinaryLog(const char* path, ostream& out);
+
+    // async mode: callers copy into a per thread buffer and a writer thread
+    // formats and writes the records in batches. turning it off flushes everything.
+    void setAsync(bool enable);
+
+    // buffers made so far, those of exited threads are handed to new ones
+    size_t threadBufferCount();
+
     void log(string_view message, Level logLevel);
     void log(const vector<string>& messages, Level logLevel);
 
+    // levels above COMPILED_LEVEL compile to nothing, the rest check the sinks
+    // before a single argument is formatted
+    template <Level L, typename... Args>
+    void logf(string_view format, const Args&... args);
+
+    template <typename... Args>
+    void error(string_view format, const Args&... args) {
+        logf<Level::Error>(format, args...);
+    }
+
+    template <typename... Args>
+    void info(string_view format, const Args&... args) {
+        logf<Level::Info>(format, args...);
+    }
+
+    template <typename... Args>
+    void debug(string_view format, const Args&... args) {
+        logf<Level::Debug>(format, args...);
+    }
+
+    bool enabled(Level level) const {
+        return consoleLevel.load(memory_order_relaxed) >= level || fileLevel.load(memory_order_relaxed) >= level || binaryEnabled(level);
+    }
+
+    static constexpr Level COMPILED_LEVEL = static_cast<Level>(LOGGER_MAX_LEVEL);
+
 private:
+    static constexpr size_t MAX_TEXT = 112;
+
+    struct Record
+    {
+        int64_t timestamp; // steady clock, orders records across threads
+        Level level;
+        uint16_t length;
+        char text[MAX_TEXT]; // longer messages are cut
+    };
+
+    // written by its owning thread only, read by the writer thread only
+    struct ThreadBuffer
+    {
+        static constexpr size_t CAPACITY = 1024;
+
+        array<Record, CAPACITY> records;
+
+        alignas(64) atomic<size_t> head = 0;
+        alignas(64) atomic<size_t> tail = 0;
+
+        atomic<bool> retired = false; // set when the owning thread exits
+        bool idle = false;            // on the free list, guarded by buffersLock
+    };
+
+    // hands the buffer back when its thread exits, the writer recycles it once drained
+    struct BufferLease
+    {
+        ThreadBuffer* buffer = nullptr;
+
+        ~BufferLease() {
+            if (buffer != nullptr)
+                buffer->retired.store(true, memory_order_release);
+        }
+    };
+
     Logger() {
         fileStream.open(fileName, ios_base::app);
     }
 
     ~Logger() {
+        setAsync(false);
         fileStream.close();
     }
 
-    string_view getLevelString(Level level) const;
+    static string_view getLevelString(Level level);
+
+    bool binaryEnabled(Level level) const {
+        return binaryLevel.load(memory_order_relaxed) >= level && binarySink.isOpen();
+    }
+
+    bool textEnabled(Level level) const {
+        return consoleLevel.load(memory_order_relaxed) >= level || fileLevel.load(memory_order_relaxed) >= level;
+    }
+
+    ThreadBuffer& localBuffer();
+
+    // console, file or the async writer, the binary sink is written by the callers
+    void logText(string_view msg, Level level);
+    void logAsync(string_view msg, Level level);
+
+    void runWriter();
+    bool collect();
+    void writeBatch(int64_t cutoff);
 
     static inline const char* const fileName = "log.txt";
 
+    // records newer than this stay back a round, a late record from another thread can still sort in front
+    static constexpr nanoseconds REORDER_WINDOW = 2ms;
+
     ofstream fileStream;
 
-    Level fileLevel = Level::Error;
-    Level consoleLevel = Level::Error;
+    atomic<Level> fileLevel = Level::Error;
+    atomic<Level> consoleLevel = Level::Error;
+    atomic<Level> binaryLevel = Level::Debug;
+
+    BinaryRingSink binarySink;
+
+    atomic<bool> async = false;
+    atomic<bool> stopping = false;
+    thread writer;
+
+    mutex buffersLock;
+    vector<unique_ptr<ThreadBuffer>> buffers; // every buffer made, drained on stop
+    vector<ThreadBuffer*> freeBuffers;        // drained buffers of exited threads
+
+    // writer thread only
+    vector<Record> pending;
+    string consoleBatch;
+    string fileBatch;
 };
 
-string_view Logger::getLevelString(Level level) const
+string_view Logger::getLevelString(Level level)
 {
     switch (level) {
     case Level::Error:
@@ -73,12 +606,64 @@ string_view Logger::getLevelString(Level level) const
     }
 }
 
+void Logger::setAsync(bool enable)
+{
+    if (enable == async)
+        return;
+
+    if (enable) {
+        async = true;
+        writer = thread{ &Logger::runWriter, this };
+        return;
+    }
+
+    async = false;
+    stopping = true;
+    writer.join();
+    stopping = false;
+}
+
+template <Logger::Level L, typename... Args>
+void Logger::logf(string_view format, const Args&... args)
+{
+    if constexpr (L <= COMPILED_LEVEL) {
+        if (binaryEnabled(L))
+            binarySink.write(static_cast<uint8_t>(L), format, args...);
+
+        if (!textEnabled(L))
+            return;
+
+        thread_local string message;
+        message.clear();
+        FormatTo(message, format, args...);
+
+        // the binary sink already has the structured record
+        logText(message, L);
+    }
+}
+
 void Logger::log(string_view msg, Level level)
 {
-    if (consoleLevel >= level)
+    if (binaryEnabled(level))
+        binarySink.write(static_cast<uint8_t>(level), "{}", msg);
+
+    logText(msg, level);
+}
+
+void Logger::logText(string_view msg, Level level)
+{
+    if (!textEnabled(level))
+        return;
+
+    if (async.load(memory_order_relaxed)) {
+        logAsync(msg, level);
+        return;
+    }
+
+    if (consoleLevel.load(memory_order_relaxed) >= level)
         cout << getLevelString(level).data() << ": " << msg << endl;
 
-    if (fileLevel >= level)
+    if (fileLevel.load(memory_order_relaxed) >= level)
         fileStream << getLevelString(level).data() << ": " << msg << endl;
 }
 
@@ -88,9 +673,384 @@ void Logger::log(const vector<string>& messages, Level level)
         log(msg, level);
 }
 
+size_t Logger::threadBufferCount()
+{
+    lock_guard<mutex> guard(buffersLock);
+    return buffers.size();
+}
+
+Logger::ThreadBuffer& Logger::localBuffer()
+{
+    thread_local BufferLease lease;
+
+    if (lease.buffer == nullptr) {
+        lock_guard<mutex> guard(buffersLock);
+
+        if (!freeBuffers.empty()) {
+            lease.buffer = freeBuffers.back();
+            lease.buffer->idle = false;
+            freeBuffers.pop_back();
+        }
+        else {
+            buffers.push_back(make_unique<ThreadBuffer>());
+            lease.buffer = buffers.back().get();
+        }
+    }
+
+    return *lease.buffer;
+}
+
+void Logger::logAsync(string_view msg, Level level)
+{
+    ThreadBuffer& buffer = localBuffer();
+
+    size_t tail = buffer.tail.load(memory_order_relaxed);
+
+    // only a burst larger than the buffer waits for the writer, nothing is lost
+    while (tail - buffer.head.load(memory_order_acquire) == ThreadBuffer::CAPACITY)
+        this_thread::yield();
+
+    Record& record = buffer.records[tail % ThreadBuffer::CAPACITY];
+    record.timestamp = steady_clock::now().time_since_epoch().count();
+    record.level = level;
+    record.length = static_cast<uint16_t>(min(msg.size(), MAX_TEXT));
+    memcpy(record.text, msg.data(), record.length);
+
+    buffer.tail.store(tail + 1, memory_order_release);
+}
+
+bool Logger::collect()
+{
+    lock_guard<mutex> guard(buffersLock);
+    bool collected = false;
+
+    for (auto& buffer : buffers) {
+        if (buffer->idle)
+            continue;
+
+        // read before the tail, so every record of an exited thread is drained below
+        bool retired = buffer->retired.load(memory_order_acquire);
+
+        size_t head = buffer->head.load(memory_order_relaxed);
+        size_t tail = buffer->tail.load(memory_order_acquire);
+
+        for (size_t i = head; i != tail; ++i)
+            pending.push_back(buffer->records[i % ThreadBuffer::CAPACITY]);
+
+        buffer->head.store(tail, memory_order_release);
+        collected = collected || (head != tail);
+
+        if (retired) {
+            buffer->retired.store(false, memory_order_relaxed);
+            buffer->idle = true;
+            freeBuffers.push_back(buffer.get());
+        }
+    }
+
+    return collected;
+}
+
+void Logger::writeBatch(int64_t cutoff)
+{
+    stable_sort(pending.begin(), pending.end(),
+        [](const Record& a, const Record& b) { return a.timestamp < b.timestamp; });
+
+    auto last = find_if(pending.begin(), pending.end(), [cutoff](const Record& r) { return r.timestamp > cutoff; });
+
+    Level consoleCut = consoleLevel.load(memory_order_relaxed);
+    Level fileCut = fileLevel.load(memory_order_relaxed);
+
+    for (auto it = pending.begin(); it != last; ++it) {
+        string_view level = getLevelString(it->level);
+        string_view text(it->text, it->length);
+
+        if (consoleCut >= it->level)
+            consoleBatch.append(level).append(": ").append(text).append("\n");
+
+        if (fileCut >= it->level)
+            fileBatch.append(level).append(": ").append(text).append("\n");
+    }
+
+    pending.erase(pending.begin(), last);
+
+    // one write per sink and batch instead of a flush per message
+    if (!consoleBatch.empty()) {
+        cout.write(consoleBatch.data(), consoleBatch.size());
+        cout.flush();
+        consoleBatch.clear();
+    }
+
+    if (!fileBatch.empty()) {
+        fileStream.write(fileBatch.data(), fileBatch.size());
+        fileStream.flush();
+        fileBatch.clear();
+    }
+}
+
+void Logger::runWriter()
+{
+    while (true) {
+        bool stop = stopping.load(memory_order_acquire);
+        int64_t now = steady_clock::now().time_since_epoch().count();
+
+        bool collected = collect();
+
+        writeBatch(stop ? INT64_MAX : now - REORDER_WINDOW.count());
+
+        if (stop)
+            break;
+
+        if (!collected)
+            this_thread::sleep_for(1ms);
+        else
+            this_thread::yield();
+    }
+}
+
+
+bool Logger::decodeBinaryLog(const char* path, ostream& out)
+{
+    ifstream in(path, ios_base::binary);
+    vector<uint8_t> image((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+    if (image.size() < binlog::SLOT_OFFSET || memcmp(image.data(), binlog::MAGIC, sizeof(binlog::MAGIC)) != 0)
+        return false;
+
+    uint32_t slotCount = 0;
+    uint32_t formatCount = 0;
+    memcpy(&slotCount, image.data() + offsetof(binlog::Header, slotCount), sizeof(slotCount));
+    memcpy(&formatCount, image.data() + offsetof(binlog::Header, formatCount), sizeof(formatCount));
+
+    if (image.size() < binlog::SLOT_OFFSET + size_t(slotCount) * sizeof(binlog::Record))
+        return false;
+
+    vector<pair<uint64_t, binlog::RecordBody>> records;
+
+    for (uint32_t i = 0; i < slotCount; ++i) {
+        const uint8_t* slot = image.data() + binlog::SLOT_OFFSET + i * sizeof(binlog::Record);
+
+        uint64_t sequence = 0;
+        memcpy(&sequence, slot, sizeof(sequence));
+        if (sequence == 0)
+            continue; // never written, or torn by a crash
+
+        binlog::RecordBody body;
+        memcpy(&body, slot + offsetof(binlog::Record, body), sizeof(body));
+        records.emplace_back(sequence, body);
+    }
+
+    sort(records.begin(), records.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    for (const auto& [sequence, body] : records) {
+        string_view format = "<unknown format>";
+        if (body.formatId < min<size_t>(formatCount, binlog::MAX_FORMATS)) {
+            const char* entry = reinterpret_cast<const char*>(image.data() + binlog::TABLE_OFFSET + body.formatId * binlog::MAX_FORMAT_TEXT);
+            const void* end = memchr(entry, '\0', binlog::MAX_FORMAT_TEXT);
+            format = string_view(entry, end != nullptr ? static_cast<const char*>(end) - entry : binlog::MAX_FORMAT_TEXT);
+        }
+
+        // the file may be corrupt or cut short, nothing is read past the payload
+        bool valid = body.argCount <= binlog::MAX_ARGS && body.payloadSize <= binlog::MAX_PAYLOAD;
+
+        string text;
+        size_t offset = 0;
+
+        for (uint8_t arg = 0; valid && arg < body.argCount; ++arg) {
+            size_t pos = format.find("{}");
+            if (pos == string_view::npos)
+                break;
+
+            text.append(format.substr(0, pos));
+            format = format.substr(pos + 2);
+
+            if (body.argTypes[arg] == binlog::ArgType::String) {
+                if (offset + 1 > body.payloadSize || offset + 1 + body.payload[offset] > body.payloadSize) {
+                    valid = false;
+                    break;
+                }
+
+                uint8_t length = body.payload[offset];
+                text.append(reinterpret_cast<const char*>(body.payload + offset + 1), length);
+                offset += length + 1u;
+            }
+            else if (body.argTypes[arg] == binlog::ArgType::Double || body.argTypes[arg] == binlog::ArgType::Int) {
+                if (offset + 8 > body.payloadSize) {
+                    valid = false;
+                    break;
+                }
+
+                if (body.argTypes[arg] == binlog::ArgType::Double) {
+                    double number = 0.0;
+                    memcpy(&number, body.payload + offset, sizeof(number));
+                    AppendArg(text, number);
+                }
+                else {
+                    int64_t number = 0;
+                    memcpy(&number, body.payload + offset, sizeof(number));
+                    AppendArg(text, number);
+                }
+                offset += 8;
+            }
+            else {
+                valid = false;
+            }
+        }
+
+        if (!valid) {
+            out << "[" << sequence << " " << body.timestamp << "] corrupt record\n";
+            continue;
+        }
+
+        text.append(format);
+
+        Level level = static_cast<Level>(body.level);
+        out << "[" << sequence << " " << body.timestamp << "] " << getLevelString(level) << ": " << text << "\n";
+    }
+
+    return true;
+}
+
+
+void TestAsyncLogger()
+{
+    const int MAX_THREAD_COUNT = 3;
+    const int MAX_ROUND_COUNT = 3;
+
+    Logger::instance().setAsync(true);
+
+    // every round starts new threads, like a pool that recycles its workers
+    for (int round = 0; round < MAX_ROUND_COUNT; ++round) {
+        vector<thread> threads;
+        for (int t = 0; t < MAX_THREAD_COUNT; ++t) {
+            threads.emplace_back([t, round] {
+                for (int i = 0; i < 3; ++i)
+                    Logger::instance().log("async log round " + to_string(round) + " thread " + to_string(t) + " #" + to_string(i), Logger::Level::Info);
+            });
+        }
+
+        for (auto& t : threads)
+            t.join();
+
+        // lets the writer drain and recycle the buffers of the exited threads
+        this_thread::sleep_for(10ms);
+    }
+
+    Logger::instance().setAsync(false);
+
+    cout << "thread buffers after " << MAX_ROUND_COUNT * MAX_THREAD_COUNT << " threads: "
+         << Logger::instance().threadBufferCount() << endl;
+}
 
-int main()
+void TestLoggerCallerCost(bool async)
 {
+    const int MAX_FRAME_COUNT = 20;
+    const int MAX_LOG_PER_FRAME = 500;
+
+    Logger::instance().setConsoleLevel(Logger::Level::Error);
+    Logger::instance().setAsync(async);
+
+    nanoseconds elapsed{ 0 };
+
+    // only the logging calls are timed, the rest of the frame lets the writer catch up
+    for (int frame = 0; frame < MAX_FRAME_COUNT; ++frame) {
+        steady_clock::time_point begin = steady_clock::now();
+
+        for (int i = 0; i < MAX_LOG_PER_FRAME; ++i)
+            Logger::instance().log("frame update", Logger::Level::Info);
+
+        elapsed += steady_clock::now() - begin;
+
+        this_thread::sleep_for(5ms);
+    }
+
+    Logger::instance().setAsync(false);
+
+    cout << (async ? "async" : "sync") << " caller cost: "
+         << elapsed.count() / (MAX_FRAME_COUNT * MAX_LOG_PER_FRAME) << " ns/log" << endl;
+}
+
+void TestFilteredLogCost()
+{
+    const int MAX_LOG_COUNT = 10000000;
+
+    Logger::instance().setConsoleLevel(Logger::Level::Error);
+    Logger::instance().setFileLevel(Logger::Level::Error);
+
+    int posX = 100;
+    int posY = 130;
+
+    // what callers paid before: the message is built, then thrown away
+    steady_clock::time_point begin = steady_clock::now();
+    for (int i = 0; i < MAX_LOG_COUNT / 100; ++i)
+        Logger::instance().log("unit " + to_string(i) + " moved to " + to_string(posX) + ", " + to_string(posY), Logger::Level::Debug);
+    nanoseconds eagerElapsed = (steady_clock::now() - begin) * 100;
+
+    begin = steady_clock::now();
+    for (int i = 0; i < MAX_LOG_COUNT; ++i)
+        Logger::instance().debug("unit {} moved to {}, {}", i, posX, posY);
+    nanoseconds lazyElapsed = steady_clock::now() - begin;
+
+    cout << "filtered debug log, eager format: " << double(eagerElapsed.count()) / MAX_LOG_COUNT << " ns/log"
+         << ", lazy format: " << double(lazyElapsed.count()) / MAX_LOG_COUNT << " ns/log" << endl;
+
+    Logger::instance().setFileLevel(Logger::Level::Info);
+}
+
+
+void TestBinaryLog()
+{
+    const int MAX_LOG_COUNT = 100000;
+
+    if (!Logger::instance().openBinaryLog("log.bin", 4096)) {
+        cout << "binary log unavailable" << endl;
+        return;
+    }
+
+    Logger::instance().setConsoleLevel(Logger::Level::Error);
+    Logger::instance().setFileLevel(Logger::Level::Error);
+
+    steady_clock::time_point begin = steady_clock::now();
+
+    for (int i = 0; i < MAX_LOG_COUNT; ++i)
+        Logger::instance().debug("unit {} moved to {}, {} speed {}", i, 100, 130, 2.5f);
+
+    nanoseconds elapsed = steady_clock::now() - begin;
+
+    // formats built at runtime in the same buffer still get their own ids
+    string format;
+    for (const char* kind : { "spawn", "despawn" }) {
+        format = string(kind) + " unit {}";
+        Logger::instance().info(format, 7);
+    }
+
+    // a formatted call that a text sink also takes is still one binary record
+    Logger::instance().setFileLevel(Logger::Level::Info);
+    Logger::instance().info("binary log {}", "done");
+    Logger::instance().setFileLevel(Logger::Level::Error);
+    Logger::instance().closeBinaryLog();
+
+    cout << "binary log caller cost: " << elapsed.count() / MAX_LOG_COUNT << " ns/log" << endl;
+
+    // the ring keeps the newest 4096 records, decode the tail of it
+    stringstream decoded;
+    Logger::decodeBinaryLog("log.bin", decoded);
+
+    string line;
+    vector<string> lines;
+    while (getline(decoded, line))
+        lines.push_back(line);
+
+    for (size_t i = (lines.size() > 5 ? lines.size() - 5 : 0); i < lines.size(); ++i)
+        cout << lines[i] << endl;
+}
+
+
+// offline decoder: pass --decode <ring file>
+int main(int argc, char* argv[])
+{
+    if (argc == 3 && string_view(argv[1]) == "--decode")
+        return Logger::decodeBinaryLog(argv[2], cout) ? 0 : 1;
+
     Logger::instance().setFileLevel(Logger::Level::Info);
     Logger::instance().setConsoleLevel(Logger::Level::Debug);
 
@@ -101,6 +1061,16 @@ int main()
     vector<string> strVec = { "vec log4", "vec log5" };
     Logger::instance().log(strVec, Logger::Level::Debug);
 
+    Logger::instance().info("formatted log {} of {}, ratio {}", 6, 7, 0.5);
+
+    TestAsyncLogger();
+
+    TestLoggerCallerCost(false);
+    TestLoggerCallerCost(true);
+
+    TestFilteredLogCost();
+
+    TestBinaryLog();
+
     return 0;
 }
-
@@ -1,29 +1,166 @@
 ﻿#include <iostream>
+#include <fstream>
 #include <list>
 #include <array>
-#include <unordered_map>
+#include <vector>
+#include <string>
+#include <cstdint>
 #include <algorithm>
+#include <chrono>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 
 // tested x64, c++17
 
 using namespace std;
+using namespace std::chrono;
+
+// an index into a sparse set plus the generation of its slot when the handle
+// was made. destroying bumps the generation, so older handles stop matching.
+struct Handle
+{
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+
+    bool operator==(const Handle& other) const {
+        return index == other.index && generation == other.generation;
+    }
+
+    bool operator!=(const Handle& other) const {
+        return !(*this == other);
+    }
+};
+
+ostream& operator<<(ostream& os, const Handle& handle)
+{
+    if (handle.index == UINT32_MAX)
+        return os << "none";
+
+    return os << handle.index << ":" << handle.generation;
+}
+
+// the sparse array maps a handle's index to a slot of the dense arrays.
+// destroy moves the last element into the hole, so iteration has no holes,
+// and freed indices are reused through a free list threaded through sparse.
+template <typename T>
+class SparseSet
+{
+public:
+    template <typename... Args>
+    Handle create(Args&&... args);
+
+    // false for a stale handle
+    bool destroy(Handle handle);
+
+    // nullptr for a stale handle
+    T* get(Handle handle) {
+        return contains(handle) ? &dense[sparse[handle.index].dense] : nullptr;
+    }
+
+    bool contains(Handle handle) const {
+        if (handle.index >= sparse.size())
+            return false;
+
+        uint32_t slot = sparse[handle.index].dense;
+        return slot < denseHandles.size() && denseHandles[slot] == handle;
+    }
+
+    size_t size() const {
+        return dense.size();
+    }
+
+    // dense order, destroy moves the last element
+    typename vector<T>::iterator begin() { return dense.begin(); }
+    typename vector<T>::iterator end() { return dense.end(); }
+
+    Handle handleAt(size_t denseIndex) const {
+        return denseHandles[denseIndex];
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t dense = 0; // next free index while the slot is free
+        uint32_t generation = 0;
+    };
+
+    static const uint32_t NO_SLOT = UINT32_MAX;
+
+    vector<Slot> sparse;
+    vector<T> dense;
+    vector<Handle> denseHandles;
+
+    uint32_t freeHead = NO_SLOT;
+};
+
+template <typename T>
+template <typename... Args>
+Handle SparseSet<T>::create(Args&&... args)
+{
+    uint32_t index = freeHead;
+
+    if (index != NO_SLOT) {
+        freeHead = sparse[index].dense;
+    }
+    else {
+        index = static_cast<uint32_t>(sparse.size());
+        sparse.push_back(Slot());
+    }
+
+    Slot& slot = sparse[index];
+    slot.dense = static_cast<uint32_t>(dense.size());
+
+    Handle handle{ index, slot.generation };
+    dense.emplace_back(forward<Args>(args)...);
+    denseHandles.push_back(handle);
+
+    return handle;
+}
+
+template <typename T>
+bool SparseSet<T>::destroy(Handle handle)
+{
+    if (!contains(handle))
+        return false;
+
+    Slot& slot = sparse[handle.index];
+    uint32_t hole = slot.dense;
+    uint32_t last = static_cast<uint32_t>(dense.size() - 1);
+
+    if (hole != last) {
+        dense[hole] = move(dense[last]);
+        denseHandles[hole] = denseHandles[last];
+        sparse[denseHandles[hole].index].dense = hole;
+    }
+
+    dense.pop_back();
+    denseHandles.pop_back();
+
+    ++slot.generation;
+    slot.dense = freeHead;
+    freeHead = handle.index;
+
+    return true;
+}
+
 
 class Grid;
 
 class Unit
 {
 public:
-    Unit() : grid(nullptr) { create(); }
-    Unit(Grid* grd) : grid(grd) { create(); }
-
+    Unit() : posX(1.), posY(1.), grid(nullptr) {}
     virtual ~Unit() = default;
 
-    void create();
+    // the id comes from the set that owns the unit
+    void create(Handle unitId, Grid* grd);
     void move(double x, double y);
 
 public:
-    int id;
+    Handle id;
     double posX;
     double posY;
 
@@ -32,8 +169,8 @@ private:
 };
 
 
-using unit_map = unordered_map<int, Unit>;
-using id_list = list<int>;
+using unit_map = SparseSet<Unit>;
+using id_list = list<Handle>;
 
 class Grid
 {
@@ -41,6 +178,7 @@ public:
     virtual ~Grid() = default;
 
     void add(Unit* unit);
+    void remove(Unit* unit);
     void move(Unit* unit, double x, double y);
 
     void updateBattle(unit_map& units);
@@ -57,12 +195,10 @@ private:
 };
 
 
-void Unit::create()
+void Unit::create(Handle unitId, Grid* grd)
 {
-    static int genId = 1;
-
-    id = genId;
-    genId++;
+    id = unitId;
+    grid = grd;
 
     posX = 1.;
     posY = 1.;
@@ -94,6 +230,18 @@ void Grid::add(Unit* unit)
     int a = 10;
 }
 
+void Grid::remove(Unit* unit)
+{
+    int cellX = (int)(unit->posX / CELL_SIZE);
+    int cellY = (int)(unit->posY / CELL_SIZE);
+
+    auto& unitIds = cells[NUM_CELLS * cellX + cellY];
+
+    auto it = find(unitIds.begin(), unitIds.end(), unit->id);
+    if (it != unitIds.end())
+        unitIds.erase(it);
+}
+
 void Grid::move(Unit* unit, double x, double y)
 {
     int oldCellX = (int)(unit->posX / CELL_SIZE);
@@ -143,16 +291,17 @@ void Grid::handleCell(id_list& ids, unit_map& units)
                 continue;
 
             // check distance, attack other, self heal...
-            unit_map::iterator unitIter = units.find(unitId);
-            if (unitIter == units.end())
+            // a stale id of a despawned unit finds nothing
+            Unit* unit = units.get(unitId);
+            if (unit == nullptr)
                 continue;
 
-            unit_map::iterator otherIter = units.find(otherId);
-            if (otherIter == units.end())
+            Unit* other = units.get(otherId);
+            if (other == nullptr)
                 continue;
 
-            cout << "attack: " << unitIter->first
-                << " -> " << otherIter->first << endl;
+            cout << "attack: " << unit->id
+                << " -> " << other->id << endl;
         }
     }
 }
@@ -179,21 +328,183 @@ void Grid::dump()
 }
 
 
-int main()
+// benchmark harness, "--bench [out.json]" runs it instead of the demo.
+// the batch size doubles until a batch takes minBatch, which also warms up
+// caches and branch predictors, then every repetition times one batch.
+#if defined(_MSC_VER)
+volatile const void* benchSink = nullptr;
+#endif
+
+// the optimizer has to assume the value is read
+template <typename T>
+void DoNotOptimize(const T& value)
 {
-    Grid grid;
-    unordered_map<int, Unit> units;
+#if defined(_MSC_VER)
+    benchSink = &value;
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : "r,m"(value) : "memory");
+#endif
+}
+
+// and that any memory may have been read or written
+void ClobberMemory()
+{
+#if defined(_MSC_VER)
+    _ReadWriteBarrier();
+#else
+    asm volatile("" : : : "memory");
+#endif
+}
+
+struct BenchResult
+{
+    string name;
+    long long param;      // the sweep point, unit count, batch size...
+    long long iterations; // operations per repetition
+    double median;        // ns per operation
+    double p10;
+    double p90;
+    double fastest;
+};
+
+class Bench
+{
+public:
+    explicit Bench(string_view suite, ostream& report = cout, int repetitions = 11, nanoseconds minBatch = 5ms)
+        : suite(suite), report(report), repetitions(repetitions), minBatch(minBatch) {}
+
+    // f runs one operation
+    template <typename F>
+    void run(string_view name, long long param, F f);
+
+    bool writeJson(const string& path) const;
+
+private:
+    string suite;
+    ostream& report;
+    int repetitions;
+    nanoseconds minBatch;
+
+    vector<BenchResult> results;
+};
+
+template <typename F>
+void Bench::run(string_view name, long long param, F f)
+{
+    auto timeBatch = [&](long long iterations) {
+        steady_clock::time_point begin = steady_clock::now();
+        for (long long i = 0; i < iterations; ++i) {
+            f();
+            ClobberMemory();
+        }
+        return nanoseconds(steady_clock::now() - begin);
+    };
+
+    long long iterations = 1;
+    while (timeBatch(iterations) < minBatch)
+        iterations *= 2;
+
+    vector<double> samples;
+    for (int r = 0; r < repetitions; ++r)
+        samples.push_back(double(timeBatch(iterations).count()) / iterations);
+
+    sort(samples.begin(), samples.end());
+    auto at = [&](double ratio) { return samples[static_cast<size_t>(ratio * (samples.size() - 1) + 0.5)]; };
+
+    BenchResult result{ string(name), param, iterations, at(0.5), at(0.1), at(0.9), samples.front() };
+    results.push_back(result);
+
+    report << name << " [" << param << "]: median " << result.median << " ns"
+           << ", p10: " << result.p10 << ", p90: " << result.p90 << ", iterations: " << iterations << endl;
+}
+
+bool Bench::writeJson(const string& path) const
+{
+    ofstream out(path);
+    if (!out)
+        return false;
 
-    for (int i = 0; i < 10; ++i) {
-        Unit unit(&grid);
-        units.insert_or_assign(unit.id, unit);
+    out << "{\n  \"suite\": \"" << suite << "\",\n  \"results\": [\n";
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        out << "    { \"name\": \"" << r.name << "\", \"param\": " << r.param << ", \"iterations\": " << r.iterations
+            << ", \"median_ns\": " << r.median << ", \"p10_ns\": " << r.p10 << ", \"p90_ns\": " << r.p90
+            << ", \"min_ns\": " << r.fastest << " }" << (i + 1 < results.size() ? "," : "") << "\n";
     }
 
+    out << "  ]\n}\n";
+    return true;
+}
+
+
+// the set hands out the id, the unit joins the grid once it has one
+Handle SpawnUnit(unit_map& units, Grid& grid)
+{
+    Handle id = units.create();
+    units.get(id)->create(id, &grid);
+    return id;
+}
+
+void DespawnUnit(unit_map& units, Grid& grid, Handle id)
+{
+    Unit* unit = units.get(id);
+    if (unit == nullptr)
+        return;
+
+    grid.remove(unit);
+    units.destroy(id);
+}
+
+
+// units spread over the whole grid, the battle log is silenced per call so
+// the numbers are the cell walk and the unit lookups
+void BenchUpdateBattle(Bench& bench)
+{
+    for (int unitCount : { 10, 100, 1000 }) {
+        Grid grid;
+        unit_map units;
+
+        uint32_t seed = 7;
+        for (int i = 0; i < unitCount; ++i) {
+            Handle id = SpawnUnit(units, grid);
+            seed = seed * 1664525u + 1013904223u;
+            units.get(id)->move((seed >> 8) % 200, (seed >> 20) % 200);
+        }
+
+        bench.run("grid update battle", unitCount, [&] {
+            streambuf* console = cout.rdbuf(nullptr);
+            grid.updateBattle(units);
+            cout.rdbuf(console);
+            cout.clear();
+        });
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && string_view(argv[1]) == "--bench") {
+        Bench bench("spatial-partition");
+        BenchUpdateBattle(bench);
+
+        if (argc > 2 && !bench.writeJson(argv[2]))
+            cout << "cannot write: " << argv[2] << endl;
+        return 0;
+    }
+
+    Grid grid;
+    unit_map units;
+    vector<Handle> ids;
+
+    for (int i = 0; i < 10; ++i)
+        ids.push_back(SpawnUnit(units, grid));
+
     grid.dump();
 
     int pos = 3;
     for (auto& unit : units) {
-        unit.second.move(pos, pos);
+        unit.move(pos, pos);
         pos += 7;
     }
 
@@ -201,6 +512,16 @@ int main()
 
     grid.updateBattle(units);
 
+    cout << endl << "despawn =======" << endl;
+
+    DespawnUnit(units, grid, ids[1]);
+    Handle reused = SpawnUnit(units, grid);
+
+    cout << "despawned: " << ids[1] << ", spawned: " << reused
+        << ", stale id finds a unit: " << (units.get(ids[1]) != nullptr ? "yes" : "no") << endl;
+
+    grid.updateBattle(units);
+
     return 0;
 }
 